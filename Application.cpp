@@ -1,6 +1,15 @@
 #include "pch.h"
 #include "Application.hpp"
+#include "AtlasPacker.hpp"
+#include "RegressionTests.hpp"
+#include "UnitTests.hpp"
+#include "QuadBucket.hpp"
+#include "ThreadPool.hpp"
 #include <iostream>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <algorithm>
 
 namespace CEE
 {
@@ -11,7 +20,280 @@ namespace CEE
 #endif	
 	
 	Application* Application::s_Instance = nullptr;
+
+	// Compares DrawQuad's per-call matrix path with the batched SIMD kernel on the CPU alone.
+	static void BenchmarkQuadTransform(const VertexLayout& layout)
+	{
+		const size_t quadCount = 1 << 20;
+		const size_t chunkSize = 1024;
+
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		std::vector<Quad> quads(quadCount);
+		for (Quad& quad : quads)
+		{
+			quad.translation = { distribution(random), distribution(random) };
+			quad.scale = { distribution(random), distribution(random) };
+			quad.rotation = distribution(random) * 3.14159265f;
+			quad.color = { 1.0f, 0.5f, 0.25f, 1.0f };
+		}
+		std::vector<uint8_t> vertices(quadCount * 4 * layout.GetStride());
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < quadCount; i++)
+			WriteQuadVertices(layout, vertices.data() + i * 4 * layout.GetStride(), quads[i].translation, quads[i].scale, quads[i].rotation, quads[i].color);
+		float matrixTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::vector<glm::vec2> translations(chunkSize), scales(chunkSize);
+		std::vector<float> rotations(chunkSize), corners(8 * chunkSize);
+		QuadTransformInput input = { translations.data(), scales.data(), rotations.data() };
+		QuadTransformOutput output;
+		for (uint32_t corner = 0; corner < 4; corner++)
+		{
+			output.cornerX[corner] = corners.data() + corner * chunkSize;
+			output.cornerY[corner] = corners.data() + (4 + corner) * chunkSize;
+		}
+
+		start = std::chrono::steady_clock::now();
+		for (size_t begin = 0; begin < quadCount; begin += chunkSize)
+		{
+			for (size_t i = 0; i < chunkSize; i++)
+			{
+				translations[i] = quads[begin + i].translation;
+				scales[i] = quads[begin + i].scale;
+				rotations[i] = quads[begin + i].rotation;
+			}
+			TransformQuads(input, chunkSize, output);
+			for (size_t i = 0; i < chunkSize; i++)
+			{
+				const glm::vec2 positions[4] = {
+					{ output.cornerX[0][i], output.cornerY[0][i] }, { output.cornerX[1][i], output.cornerY[1][i] },
+					{ output.cornerX[2][i], output.cornerY[2][i] }, { output.cornerX[3][i], output.cornerY[3][i] }
+				};
+				layout.WriteQuad(vertices.data() + (begin + i) * 4 * layout.GetStride(), positions, quads[begin + i].color, glm::vec3(0.0f, 0.0f, -1.0f));
+			}
+		}
+		float kernelTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		printf("Quad transform, %zu quads: matrix path %.2fns/quad, %s kernel %.2fns/quad (%.1fx)\n", quadCount,
+			   matrixTime * 1e6f / quadCount, GetQuadTransformKernelName(), kernelTime * 1e6f / quadCount, matrixTime / kernelTime);
+	}
+	
+	// Records the same quads into one bucket per worker on a thread pool of 1 to N workers, N being the hardware
+	// thread count, and reports the throughput of each pool size. Only recording is timed, not submission.
+	static void BenchmarkQuadBuckets(QuadBatchMode batchMode, const VertexLayout& layout)
+	{
+		const uint32_t quadCount = 1 << 20;
+		const uint32_t repetitions = 5;
+
+		std::mt19937 random(13);
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		std::vector<Quad> quads(quadCount);
+		for (Quad& quad : quads)
+		{
+			quad.translation = { distribution(random), distribution(random) };
+			quad.scale = glm::vec2(0.01f);
+			quad.rotation = distribution(random) * 3.14159265f;
+			quad.color = { 0.25f, 0.5f, 1.0f, 1.0f };
+		}
+
+		uint32_t maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+		float singleWorkerRate = 0.0f;
+		for (uint32_t workers = 1; workers <= maxWorkers; workers++)
+		{
+			ThreadPool pool(workers);
+			std::vector<std::unique_ptr<QuadBucket>> buckets;
+			for (uint32_t i = 0; i < workers; i++)
+			{
+				buckets.push_back(std::make_unique<QuadBucket>(batchMode, layout));
+				buckets.back()->Reserve(quadCount / workers + 1);
+			}
+
+			// The first pass only warms up the threads and the buckets' memory.
+			float bestTime = INFINITY;
+			std::vector<std::future<void>> recordings(workers);
+			for (uint32_t repetition = 0; repetition <= repetitions; repetition++)
+			{
+				auto start = std::chrono::steady_clock::now();
+				for (uint32_t i = 0; i < workers; i++)
+				{
+					QuadBucket* bucket = buckets[i].get();
+					const Quad* first = quads.data() + (size_t)quadCount * i / workers;
+					const Quad* last = quads.data() + (size_t)quadCount * (i + 1) / workers;
+					recordings[i] = pool.Submit([bucket, first, last]() {
+						bucket->Clear();
+						for (const Quad* quad = first; quad != last; quad++)
+							bucket->DrawQuad(quad->translation, quad->scale, quad->rotation, quad->color);
+					});
+				}
+				for (std::future<void>& recording : recordings)
+					recording.wait();
+				float time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+				if (repetition > 0)
+					bestTime = std::min(bestTime, time);
+			}
+
+			float rate = quadCount / (bestTime * 1000.0f);
+			if (workers == 1)
+				singleWorkerRate = rate;
+			printf("Quad buckets, %u quads on %u worker%s: %.2fms, %.2fMquads/s (%.2fx)\n", quadCount, workers,
+				   workers == 1 ? "" : "s", bestTime, rate, rate / singleWorkerRate);
+		}
+	}
+
+	static void BenchmarkUploads(Renderer& renderer)
+	{
+		const std::vector<vk::DeviceSize> sizes = { 4 * 1024, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024, 64 * 1024 * 1024 };
+		std::vector<UploadBandwidth> measurements = renderer.MeasureUploadBandwidth(sizes, 10);
+
+		bool transferQueue = std::any_of(measurements.begin(), measurements.end(), [](const UploadBandwidth& measurement) { return measurement.transferQueue; });
+		if (!transferQueue)
+			printf("Uploads: no dedicated transfer queue, measuring the graphics queue only\n");
+		for (const UploadBandwidth& measurement : measurements)
+		{
+			printf("Uploads, %8.1fKiB on the %-14s queue: %8.3fms, %8.1fMiB/s\n", measurement.size / 1024.0f,
+				   measurement.transferQueue ? "transfer" : "graphics", measurement.time, measurement.bandwidth);
+		}
+	}
+
+	// DrawQuad calls alone over whole scenes, including the flushes of batches that fill up, excluding BeginScene and
+	// EndScene. Every quad is in view so none is culled.
+	static void BenchmarkDrawQuad(Renderer& renderer, uint32_t quadCount)
+	{
+		const uint32_t frameCount = 100;
+
+		std::mt19937 random(9);
+		std::uniform_real_distribution<float> distribution(-0.9f, 0.9f);
+		std::vector<Quad> quads(quadCount);
+		for (Quad& quad : quads)
+		{
+			quad.translation = { distribution(random), distribution(random) };
+			quad.scale = glm::vec2(0.01f);
+			quad.rotation = distribution(random) * 3.14159265f;
+			quad.color = { 0.5f, 1.0f, 0.25f, 1.0f };
+		}
+
+		Camera camera;
+		float drawTime = 0.0f;
+		for (uint32_t frame = 0; frame < frameCount; frame++)
+		{
+			renderer.BeginScene(camera);
+			auto start = std::chrono::steady_clock::now();
+			for (const Quad& quad : quads)
+				renderer.DrawQuad(quad.translation, quad.scale, quad.rotation, quad.color);
+			drawTime += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			renderer.EndScene();
+		}
+
+		size_t drawnQuads = (size_t)quadCount * frameCount;
+		printf("DrawQuad, %u quads per frame, %s batches: %.2fns/quad, %.2fMquads/s\n", quadCount,
+			   renderer.GetBatchMode() == QuadBatchMode::eInstanced ? "instanced" : "per-vertex",
+			   drawTime * 1e6f / drawnQuads, drawnQuads / (drawTime * 1000.0f));
+	}
+	
+	// Viewport sized queries against a uniform grid over a world of quads, next to culling every quad one by one.
+	static void BenchmarkSpatialIndex(uint32_t quadCount)
+	{
+		const uint32_t queryCount = 1000;
+		const float worldSize = 1000.0f, viewportSize = 2.0f;
+
+		std::mt19937 random(11);
+		std::uniform_real_distribution<float> position(-worldSize * 0.5f, worldSize * 0.5f);
+		std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+		std::vector<QuadInstance> instances(quadCount), sorted(quadCount);
+		for (QuadInstance& instance : instances)
+			WriteQuadInstance(&instance, { position(random), position(random) }, glm::vec2(0.05f), angle(random), glm::vec4(1.0f));
+
+		std::vector<glm::vec4> queries(queryCount);
+		for (glm::vec4& query : queries)
+		{
+			glm::vec2 corner(position(random), position(random));
+			query = glm::vec4(corner, corner + glm::vec2(viewportSize));
+		}
+
+		QuadGrid grid(viewportSize * 0.25f);
+		auto start = std::chrono::steady_clock::now();
+		grid.Build(instances.data(), quadCount, sorted.data());
+		float buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::vector<QuadRange> ranges;
+		size_t gridQuads = 0, rangeCount = 0;
+		start = std::chrono::steady_clock::now();
+		for (const glm::vec4& query : queries)
+		{
+			ranges.clear();
+			gridQuads += grid.Query(query, &ranges);
+			rangeCount += ranges.size();
+		}
+		float gridTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		size_t linearQuads = 0;
+		start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < queryCount / 100; i++)
+		{
+			const glm::vec4& query = queries[i];
+			for (const QuadInstance& instance : instances)
+			{
+				glm::vec2 center, halfExtent;
+				GetQuadBounds(instance.translation, instance.scale, instance.rotation, &center, &halfExtent);
+				linearQuads += center.x + halfExtent.x >= query.x && center.x - halfExtent.x <= query.z &&
+							   center.y + halfExtent.y >= query.y && center.y - halfExtent.y <= query.w;
+			}
+		}
+		float linearTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		printf("Spatial index, %u quads in a %ux%u grid: built in %.2fms, %.2fus per query (%.1f quads in %.1f ranges), "
+			   "linear culling %.2fus per query (%.1f quads)\n", quadCount, grid.GetColumnCount(), grid.GetRowCount(), buildTime,
+			   gridTime * 1000.0f / queryCount, (float)gridQuads / queryCount, (float)rangeCount / queryCount,
+			   linearTime * 1000.0f / (queryCount / 100), (float)linearQuads / (queryCount / 100));
+	}
 	
+	// Packs sprites of random sizes into an atlas in arrival order and sorted by height, checking that no two overlap.
+	static void BenchmarkAtlasPacker()
+	{
+		const uint32_t atlasSize = 2048, spriteCount = 5000;
+		std::mt19937 random(3);
+		std::uniform_int_distribution<uint32_t> spriteSize(4, 64);
+		std::vector<glm::uvec2> sizes(spriteCount);
+		for (glm::uvec2& size : sizes)
+			size = glm::uvec2(spriteSize(random), spriteSize(random));
+
+		AtlasPacker packer(atlasSize, atlasSize);
+		std::vector<AtlasRegion> regions;
+		std::vector<uint8_t> coverage((size_t)atlasSize * atlasSize);
+		auto packAll = [&](const char* order)
+		{
+			packer.Reset();
+			regions.clear();
+			auto const start = std::chrono::steady_clock::now();
+			for (const glm::uvec2& size : sizes)
+			{
+				AtlasRegion region;
+				if (packer.Pack(size.x, size.y, &region))
+					regions.push_back(region);
+			}
+			float packTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			size_t overlaps = 0;
+			std::fill(coverage.begin(), coverage.end(), 0);
+			for (const AtlasRegion& region : regions)
+			{
+				CEE_ASSERT_WITH_MESSAGE(region.x + region.width <= atlasSize && region.y + region.height <= atlasSize, "Sprite outside the atlas.");
+				for (uint32_t y = region.y; y < region.y + region.height; y++)
+					for (uint32_t x = region.x; x < region.x + region.width; x++)
+						overlaps += coverage[(size_t)y * atlasSize + x]++ > 0;
+			}
+
+			printf("Atlas packer, %s: %u of %u sprites in %ux%u, %.1f%% occupancy, %.3fus per sprite, %zu overlapping texels\n", order,
+				   packer.GetRegionCount(), spriteCount, atlasSize, atlasSize, packer.GetOccupancy() * 100.0f,
+				   packTime * 1000.0f / spriteCount, overlaps);
+		};
+
+		packAll("arrival order");
+		std::stable_sort(sizes.begin(), sizes.end(), [](const glm::uvec2& a, const glm::uvec2& b) { return a.y > b.y; });
+		packAll("tallest first");
+	}
+
 	CEE::Application::Application(int arg, char** argv)
 	{
 		if (s_Instance != nullptr)
@@ -20,48 +302,438 @@ namespace CEE
 		}
 		else s_Instance = this;
 
-#if defined(CEE_OS_WINDOWS)
-		s_Connection = GetModuleHandle(NULL);
-#elif defined(CEE_WM_XCB)
-		s_Connection = xcb_connect(nullptr, nullptr);
-		if (xcb_connection_has_error(s_Connection))
+		uint32_t framesInFlight = 2;
+		uint32_t swapchainImageCount = 0;
+		vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+		QuadBatchMode batchMode = QuadBatchMode::eInstanced;
+		QuadIndexMode indexMode = QuadIndexMode::eIndexed;
+		VertexLayout vertexLayout = VertexLayout::Packed();
+		bool benchmarkQuadTransform = false;
+		uint32_t stressQuadCount = 0;
+		uint32_t layerQuadCount = 0;
+		bool diffVertexStream = false;
+		bool cullQuads = true;
+		float layerCellSize = 0.0f;
+		uint32_t benchmarkSpatialIndexQuads = 0;
+		bool benchmarkAtlasPacker = false;
+		uint32_t benchmarkDrawQuads = 0;
+		bool benchmarkQuadBuckets = false;
+		bool benchmarkUploads = false;
+		uint32_t spriteCount = 0;
+		std::vector<std::string> textureFilepaths;
+		bool headless = false;
+		vk::Extent2D offscreenExtent(1280, 720);
+		RegressionOptions regression;
+		bool testShaderCache = false;
+		bool testBuddyAllocator = false;
+		bool testUploadBytes = false;
+		bool testAtlasPacker = false;
+		bool gpuProfiling = false;
+		for (int i = 1; i < arg; i++)
+		{
+			if (!strncmp(argv[i], "--frames-in-flight=", 19))
+				framesInFlight = (uint32_t)strtoul(argv[i] + 19, nullptr, 10);
+			else if (!strncmp(argv[i], "--swapchain-images=", 19))
+				swapchainImageCount = (uint32_t)strtoul(argv[i] + 19, nullptr, 10);
+			else if (!strcmp(argv[i], "--present-mode=mailbox"))
+				presentMode = vk::PresentModeKHR::eMailbox;
+			else if (!strcmp(argv[i], "--present-mode=immediate"))
+				presentMode = vk::PresentModeKHR::eImmediate;
+			else if (!strcmp(argv[i], "--present-mode=fifo-relaxed"))
+				presentMode = vk::PresentModeKHR::eFifoRelaxed;
+			else if (!strcmp(argv[i], "--present-mode=fifo"))
+				presentMode = vk::PresentModeKHR::eFifo;
+			else if (!strcmp(argv[i], "--batch-mode=per-vertex"))
+				batchMode = QuadBatchMode::ePerVertex;
+			else if (!strcmp(argv[i], "--batch-mode=instanced"))
+				batchMode = QuadBatchMode::eInstanced;
+			else if (!strcmp(argv[i], "--index-mode=indexed"))
+				indexMode = QuadIndexMode::eIndexed;
+			else if (!strcmp(argv[i], "--index-mode=generated"))
+				indexMode = QuadIndexMode::eGenerated;
+			else if (!strcmp(argv[i], "--vertex-layout=packed"))
+				vertexLayout = VertexLayout::Packed();
+			else if (!strcmp(argv[i], "--vertex-layout=full"))
+				vertexLayout = VertexLayout::Full();
+			else if (!strcmp(argv[i], "--benchmark-quad-transform"))
+				benchmarkQuadTransform = true;
+			else if (!strncmp(argv[i], "--stress-quads=", 15))
+				stressQuadCount = (uint32_t)strtoul(argv[i] + 15, nullptr, 10);
+			else if (!strncmp(argv[i], "--layer-quads=", 14))
+				layerQuadCount = (uint32_t)strtoul(argv[i] + 14, nullptr, 10);
+			else if (!strcmp(argv[i], "--diff-vertex-stream"))
+				diffVertexStream = true;
+			else if (!strcmp(argv[i], "--cull=off"))
+				cullQuads = false;
+			else if (!strncmp(argv[i], "--layer-cell-size=", 18))
+				layerCellSize = strtof(argv[i] + 18, nullptr);
+			else if (!strncmp(argv[i], "--benchmark-spatial-index=", 26))
+				benchmarkSpatialIndexQuads = (uint32_t)strtoul(argv[i] + 26, nullptr, 10);
+			else if (!strcmp(argv[i], "--benchmark-atlas-packer"))
+				benchmarkAtlasPacker = true;
+			else if (!strcmp(argv[i], "--benchmark-quad-buckets"))
+				benchmarkQuadBuckets = true;
+			else if (!strcmp(argv[i], "--benchmark-uploads"))
+				benchmarkUploads = true;
+			else if (!strncmp(argv[i], "--benchmark-draw-quad=", 22))
+				benchmarkDrawQuads = (uint32_t)strtoul(argv[i] + 22, nullptr, 10);
+			else if (!strncmp(argv[i], "--sprites=", 10))
+				spriteCount = (uint32_t)strtoul(argv[i] + 10, nullptr, 10);
+			else if (!strncmp(argv[i], "--load-texture=", 15))
+				textureFilepaths.push_back(argv[i] + 15);
+			else if (!strcmp(argv[i], "--headless"))
+				headless = true;
+			else if (!strncmp(argv[i], "--headless-size=", 16))
+			{
+				char* height = nullptr;
+				offscreenExtent.width = (uint32_t)strtoul(argv[i] + 16, &height, 10);
+				offscreenExtent.height = *height == 'x' ? (uint32_t)strtoul(height + 1, nullptr, 10) : 0;
+			}
+			else if (!strncmp(argv[i], "--frames=", 9))
+				m_FrameLimit = (uint32_t)strtoul(argv[i] + 9, nullptr, 10);
+			else if (!strncmp(argv[i], "--output=", 9))
+				m_OutputPath = argv[i] + 9;
+			else if (!strncmp(argv[i], "--regression=", 13))
+				regression.goldenDirectory = argv[i] + 13;
+			else if (!strcmp(argv[i], "--update-goldens"))
+				regression.updateGoldens = true;
+			else if (!strcmp(argv[i], "--test-shader-cache"))
+				testShaderCache = true;
+			else if (!strcmp(argv[i], "--test-buddy-allocator"))
+				testBuddyAllocator = true;
+			else if (!strcmp(argv[i], "--test-atlas-packer"))
+				testAtlasPacker = true;
+			else if (!strcmp(argv[i], "--test-upload-bytes"))
+				testUploadBytes = true;
+			else if (!strcmp(argv[i], "--stats"))
+				m_PrintStatistics = true;
+			else if (!strcmp(argv[i], "--gpu-profile"))
+				gpuProfiling = true;
+			else if (!strncmp(argv[i], "--gpu-profile=", 14))
+			{
+				gpuProfiling = true;
+				m_GpuProfilePath = argv[i] + 14;
+			}
+		}
+		if (framesInFlight == 0)
+		{
+			fprintf(stderr, "At least one frame in flight is required, continuing with 1.\n");
+			framesInFlight = 1;
+		}
+
+		if (offscreenExtent.width == 0 || offscreenExtent.height == 0)
+		{
+			fprintf(stderr, "Headless size must look like 1280x720, continuing with 1280x720.\n");
+			offscreenExtent = vk::Extent2D(1280, 720);
+		}
+		// Without a window to close, headless runs end on their own.
+		if (headless && m_FrameLimit == 0)
+			m_FrameLimit = 1000;
+		if (!m_OutputPath.empty() && !headless)
+		{
+			fprintf(stderr, "Only headless runs write their last frame, ignoring --output.\n");
+			m_OutputPath.clear();
+		}
+
+		if (benchmarkQuadTransform)
+			BenchmarkQuadTransform(vertexLayout);
+		if (benchmarkSpatialIndexQuads > 0)
+			BenchmarkSpatialIndex(benchmarkSpatialIndexQuads);
+		if (benchmarkAtlasPacker)
+			BenchmarkAtlasPacker();
+		if (benchmarkQuadBuckets)
+			BenchmarkQuadBuckets(batchMode, vertexLayout);
+		if (spriteCount > 0 && batchMode != QuadBatchMode::eInstanced)
+		{
+			fprintf(stderr, "Sprites need the instanced batch mode, drawing none.\n");
+			spriteCount = 0;
+			textureFilepaths.clear();
+		}
+
+		// 65536 quads per batch, past what 16 bit indices can address in the per-vertex mode.
+		RendererCapabilities capabilities(65536 * 6, framesInFlight);
+		capabilities.presentMode = presentMode;
+		capabilities.swapchainImageCount = swapchainImageCount;
+		capabilities.batchMode = batchMode;
+		capabilities.indexMode = indexMode;
+		capabilities.vertexLayout = vertexLayout;
+		capabilities.diffVertexStream = diffVertexStream;
+		capabilities.cullQuads = cullQuads;
+		capabilities.offscreenExtent = offscreenExtent;
+		capabilities.gpuProfiling = gpuProfiling;
+		capabilities.printStatistics = m_PrintStatistics;
+
+		// Test runs bring their own data, regression scenes their own headless renderer, and are done once Run reports.
+		if (testShaderCache || testBuddyAllocator || testAtlasPacker || testUploadBytes || !regression.goldenDirectory.empty())
 		{
-			fprintf(stderr, "XCB connection has error.\n");
+			m_TestRun = true;
+			if (testShaderCache)
+				m_TestFailures += TestShaderCache();
+			if (testBuddyAllocator)
+				m_TestFailures += TestBuddyAllocator();
+			if (testAtlasPacker)
+				m_TestFailures += TestAtlasPacker();
+			if (testUploadBytes)
+				m_TestFailures += TestUploadBytes(capabilities);
+			if (!regression.goldenDirectory.empty())
+				m_TestFailures += RunRegressionTests(capabilities, regression);
+			return;
 		}
+
+		// Stress quads live in separate arrays and are handed to the renderer in place every frame.
+		std::mt19937 random(1);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		m_StressTranslations.resize(stressQuadCount);
+		m_StressScales.resize(stressQuadCount);
+		m_StressRotations.resize(stressQuadCount);
+		m_StressColors.resize(stressQuadCount);
+		for (uint32_t i = 0; i < stressQuadCount; i++)
+		{
+			m_StressTranslations[i] = glm::vec2(unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f);
+			m_StressScales[i] = glm::vec2(0.01f + unit(random) * 0.02f);
+			m_StressRotations[i] = unit(random) * 6.2831853f;
+			m_StressColors[i] = glm::vec4(unit(random), unit(random), unit(random), 1.0f);
+		}
+
+		if (headless)
+			m_Renderer = new Renderer(capabilities);
+		else
+		{
+#if defined(CEE_OS_WINDOWS)
+			s_Connection = GetModuleHandle(NULL);
+#elif defined(CEE_WM_XCB)
+			s_Connection = xcb_connect(nullptr, nullptr);
+			if (xcb_connection_has_error(s_Connection))
+			{
+				fprintf(stderr, "XCB connection has error.\n");
+			}
 #endif
 
 #if defined(CEE_OS_WINDOWS)
-		m_Window = new Window((void*)(&s_Connection), 1280, 720, "Vulkan App");
-		m_Renderer = new Renderer(s_Connection, m_Window, RendererCapabilities(9996));
+			m_Window = new Window((void*)(&s_Connection), 1280, 720, "Vulkan App");
+			m_Renderer = new Renderer(s_Connection, m_Window, capabilities);
 #elif defined(CEE_WM_XCB)
-		m_Window = new Window((void*)s_Connection, 1280, 720, "Vulkan App");
-		m_Renderer = new Renderer(s_Connection, m_Window, RendererCapabilities(9996));
+			m_Window = new Window((void*)s_Connection, 1280, 720, "Vulkan App");
+			m_Renderer = new Renderer(s_Connection, m_Window, capabilities);
 #endif
+		}
 		
-		m_Window->SetDestroyWindowCallback([this](Window* window){
-				if (m_Window == window) m_Running = false;
-		});
+		if (benchmarkDrawQuads > 0)
+			BenchmarkDrawQuad(*m_Renderer, benchmarkDrawQuads);
+		if (benchmarkUploads)
+			BenchmarkUploads(*m_Renderer);
+
+		// Static background, uploaded once and drawn from its own buffer every frame.
+		if (layerQuadCount > 0)
+		{
+			m_BackgroundLayer = m_Renderer->CreateQuadLayer(layerQuadCount, layerCellSize);
+			uint32_t columns = (uint32_t)std::ceil(std::sqrt((float)layerQuadCount));
+			float cellSize = 2.0f / columns;
+			for (uint32_t i = 0; i < layerQuadCount; i++)
+			{
+				glm::vec2 translation(-1.0f + (i % columns + 0.5f) * cellSize, -1.0f + (i / columns + 0.5f) * cellSize);
+				glm::vec4 color((float)(i % columns) / columns, (float)(i / columns) / columns, 0.5f, 1.0f);
+				m_BackgroundLayer->AddQuad(translation, glm::vec2(cellSize * 0.9f), 0.0f, color);
+			}
+		}
+
+		// Procedural sprites in two atlases, a texture each. Sprites of both are drawn in the same batch.
+		if (spriteCount > 0)
+		{
+			const uint32_t atlasSize = 512;
+			std::uniform_int_distribution<uint32_t> spriteSize(16, 64);
+			std::vector<Sprite> spriteTypes;
+			std::vector<uint32_t> atlas(atlasSize * atlasSize);
+			for (uint32_t pattern = 0; pattern < 2; pattern++)
+			{
+				AtlasPacker packer(atlasSize, atlasSize);
+				std::fill(atlas.begin(), atlas.end(), 0);
+				size_t firstSpriteType = spriteTypes.size();
+				AtlasRegion region;
+				while (packer.Pack(spriteSize(random), spriteSize(random), &region))
+				{
+					// Discs in the first atlas, checkerboards in the second, tinted randomly.
+					uint32_t tint = 0xFF000000 | (uint32_t)(random() & 0x00FFFFFF);
+					for (uint32_t y = 0; y < region.height; y++)
+					{
+						for (uint32_t x = 0; x < region.width; x++)
+						{
+							glm::vec2 offset = glm::vec2(x + 0.5f, y + 0.5f) / glm::vec2(region.width, region.height) - 0.5f;
+							bool filled = pattern == 0 ? glm::dot(offset, offset) < 0.25f : ((x / 4) + (y / 4)) % 2 == 0;
+							atlas[(region.y + y) * atlasSize + region.x + x] = filled ? tint : 0xFFFFFFFF;
+						}
+					}
+					Sprite sprite;
+					sprite.texCoords = packer.GetTexCoords(region);
+					spriteTypes.push_back(sprite);
+				}
+
+				uint32_t texture = m_Renderer->CreateTexture(atlasSize, atlasSize, atlas.data());
+				for (size_t i = firstSpriteType; i < spriteTypes.size(); i++)
+					spriteTypes[i].texture = texture;
+			}
+
+			m_SpriteQuads.resize(spriteCount);
+			m_Sprites.resize(spriteCount);
+			for (uint32_t i = 0; i < spriteCount; i++)
+			{
+				m_SpriteQuads[i].translation = glm::vec2(unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f);
+				m_SpriteQuads[i].scale = glm::vec2(0.03f + unit(random) * 0.05f);
+				m_SpriteQuads[i].rotation = unit(random) * 6.2831853f;
+				m_SpriteQuads[i].color = glm::vec4(1.0f);
+				m_Sprites[i] = spriteTypes[random() % spriteTypes.size()];
+			}
+		}
+
+		// Streamed textures side by side along the top, showing the placeholder until each one arrives.
+		for (size_t i = 0; i < textureFilepaths.size(); i++)
+		{
+			float size = 2.0f / textureFilepaths.size();
+			Quad quad;
+			quad.translation = glm::vec2(-1.0f + (i + 0.5f) * size, -1.0f + size * 0.5f);
+			quad.scale = glm::vec2(size * 0.9f);
+			quad.rotation = 0.0f;
+			quad.color = glm::vec4(1.0f);
+			Sprite sprite;
+			sprite.texture = m_Renderer->LoadTexture(textureFilepaths[i]);
+			m_SpriteQuads.push_back(quad);
+			m_Sprites.push_back(sprite);
+		}
+
+		if (m_Window)
+		{
+			m_Window->SetDestroyWindowCallback([this](Window* window){
+					if (m_Window == window) m_Running = false;
+			});
+		}
 	}
 	
 	Application::~Application()
 	{
+		delete m_Renderer;
 		delete m_Window;
 #if defined(CEE_WM_XCB)
-		xcb_disconnect(s_Connection);
+		if (s_Connection)
+			xcb_disconnect(s_Connection);
 #endif
 		s_Instance = nullptr;
 	}
 	
 	int Application::Run()
 	{
+		if (m_TestRun)
+			return m_TestFailures > 0 ? 1 : 0;
+
 		m_Running = true;
+
+		uint32_t frameCount = 0;
+		float frameTimeSum = 0.0f, fenceWaitTimeSum = 0.0f, recordTimeSum = 0.0f, latencySum = 0.0f;
+		uint32_t latencyFrames = 0;
+		size_t bulkQuadSum = 0;
+		float bulkWriteTimeSum = 0.0f;
+		size_t vertexUploadBytesSum = 0, vertexSkippedBytesSum = 0, layerUploadBytesSum = 0, textureUploadBytesSum = 0;
+		size_t visibleQuadSum = 0, culledQuadSum = 0;
+		size_t maxTextureUploadBytes = 0;
 		while (m_Running)
 		{
 			m_Renderer->BeginScene(m_Camera);
+			if (m_BackgroundLayer)
+				m_Renderer->DrawQuadLayer(*m_BackgroundLayer);
 			m_Renderer->DrawQuad({ -0.5f, 0.0f }, { 0.5f, 0.5f }, 0.0f, { 1.0f, 0.0f, 0.6f, 1.0f });
 			m_Renderer->DrawQuad({ 0.5f, 0.0f }, { 0.5f, 0.5f }, 0.0f, { 0.2f, 1.0f, 0.5f, 1.0f });
+			if (!m_StressTranslations.empty())
+			{
+				for (float& rotation : m_StressRotations)
+					rotation += 0.01f;
+
+				QuadArrays quads;
+				quads.translations = m_StressTranslations.data();
+				quads.scales = m_StressScales.data();
+				quads.rotations = m_StressRotations.data();
+				quads.colors = m_StressColors.data();
+				quads.count = m_StressTranslations.size();
+				m_Renderer->DrawQuads(quads);
+			}
+			for (size_t i = 0; i < m_SpriteQuads.size(); i++)
+			{
+				const Quad& quad = m_SpriteQuads[i];
+				m_Renderer->DrawSprite(quad.translation, quad.scale, quad.rotation, m_Sprites[i], quad.color);
+			}
 			m_Renderer->EndScene();
-			m_Window->PollEvents();
+			if (m_Window)
+				m_Window->PollEvents();
+			if (m_FrameLimit > 0 && ++m_FramesRendered == m_FrameLimit)
+				m_Running = false;
+
+			const RendererStatistics& statistics = m_Renderer->GetStatistics();
+			frameTimeSum += statistics.frameTime;
+			fenceWaitTimeSum += statistics.fenceWaitTime;
+			recordTimeSum += statistics.recordTime;
+			if (statistics.acquireToGpuDoneTime > 0.0f)
+			{
+				latencySum += statistics.acquireToGpuDoneTime;
+				latencyFrames++;
+			}
+			bulkQuadSum += statistics.bulkQuads;
+			bulkWriteTimeSum += statistics.bulkWriteTime;
+			vertexUploadBytesSum += statistics.vertexUploadBytes;
+			vertexSkippedBytesSum += statistics.vertexSkippedBytes;
+			layerUploadBytesSum += statistics.layerUploadBytes;
+			textureUploadBytesSum += statistics.textureUploadBytes;
+			maxTextureUploadBytes = std::max(maxTextureUploadBytes, statistics.textureUploadBytes);
+			visibleQuadSum += statistics.visibleQuads;
+			culledQuadSum += statistics.culledQuads;
+			if (++frameCount == 1000)
+			{
+				if (m_PrintStatistics)
+				{
+					printf("Average frame time: %.3fms (%.3fms waiting for fences, %.3fms recording and submitting)\n",
+						   frameTimeSum / frameCount, fenceWaitTimeSum / frameCount, recordTimeSum / frameCount);
+					if (latencyFrames > 0)
+						printf("Average latency from image acquire to GPU completion: %.3fms\n", latencySum / latencyFrames);
+					MemoryStatistics memoryStatistics = m_Renderer->GetMemoryStatistics();
+					printf("Device memory: %u allocations in %u memory objects, %.2fMiB used of %.2fMiB reserved\n",
+						   memoryStatistics.allocationCount, memoryStatistics.deviceMemoryCount,
+						   memoryStatistics.usedBytes / (1024.0 * 1024.0), memoryStatistics.reservedBytes / (1024.0 * 1024.0));
+					if (bulkWriteTimeSum > 0.0f)
+						printf("Bulk quads: %zu per frame at %.2fMquads/s\n",
+							   bulkQuadSum / frameCount, bulkQuadSum / (bulkWriteTimeSum * 1000.0f));
+					printf("Uploads per frame: %.1fKiB vertex stream (%.1fKiB unchanged), %.1fKiB quad layers, %.1fKiB textures\n",
+						   vertexUploadBytesSum / (1024.0 * frameCount), vertexSkippedBytesSum / (1024.0 * frameCount),
+						   layerUploadBytesSum / (1024.0 * frameCount), textureUploadBytesSum / (1024.0 * frameCount));
+					printf("Culling per frame: %zu quads visible, %zu culled\n", visibleQuadSum / frameCount, culledQuadSum / frameCount);
+					printf("Texture loads: %u queued, %.1fKiB streamed in the busiest frame\n", statistics.textureLoadQueueDepth,
+						   maxTextureUploadBytes / 1024.0);
+					GpuProfile gpuProfile = m_Renderer->GetGpuProfile();
+					for (const GpuScopeStatistics& scope : gpuProfile.scopes)
+					{
+						if (scope.name == "frame" || scope.name == "render pass")
+							printf("GPU %s: %.3fms average, %.3fms min, %.3fms p99\n", scope.name.c_str(), scope.avgTime,
+								   scope.minTime, scope.p99Time);
+					}
+				}
+				frameCount = 0;
+				frameTimeSum = fenceWaitTimeSum = recordTimeSum = latencySum = bulkWriteTimeSum = 0.0f;
+				latencyFrames = 0;
+				bulkQuadSum = vertexUploadBytesSum = vertexSkippedBytesSum = layerUploadBytesSum = textureUploadBytesSum = 0;
+				visibleQuadSum = culledQuadSum = maxTextureUploadBytes = 0;
+			}
+		}
+
+		if (!m_OutputPath.empty())
+		{
+			std::vector<uint8_t> pixels;
+			m_Renderer->ReadFrame(&pixels);
+			vk::Extent2D extent = m_Renderer->GetExtent();
+			if (WriteImageFile(m_OutputPath, extent.width, extent.height, pixels.data()) != vk::Result::eSuccess)
+				return 1;
+			printf("Wrote the last frame to %s\n", m_OutputPath.c_str());
+		}
+		if (!m_GpuProfilePath.empty())
+		{
+			if (m_Renderer->WriteGpuProfile(m_GpuProfilePath) != vk::Result::eSuccess)
+				return 1;
+			printf("Wrote the GPU profile to %s\n", m_GpuProfilePath.c_str());
 		}
 		return 0;
 	}
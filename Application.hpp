@@ -4,6 +4,7 @@
 #include "Window.hpp"
 #include "Renderer.hpp"
 #include "Camera.hpp"
+#include "QuadLayer.hpp"
 
 namespace CEE {
 	class Application
@@ -23,12 +24,35 @@ namespace CEE {
 #endif
 		
 	private:
+		// Null for headless runs.
 		Window* m_Window = nullptr;
 		bool m_Running = false;
+		// Run ends after this many frames, 0 runs until the window closes.
+		uint32_t m_FrameLimit = 0;
+		uint32_t m_FramesRendered = 0;
+		// Set by --stats, the renderer's setup and averages of every 1000 frames are printed.
+		bool m_PrintStatistics = false;
+		// Headless runs write their last frame here.
+		std::string m_OutputPath;
+		// Set by --regression and the --test-* modes, Run only reports the outcome of the checks done in the constructor.
+		bool m_TestRun = false;
+		uint32_t m_TestFailures = 0;
+		// Set by --gpu-profile=path, the GPU profile is written there once Run ends.
+		std::string m_GpuProfilePath;
 		
 		Renderer* m_Renderer = nullptr;
 
 		Camera m_Camera;
+
+		std::vector<glm::vec2> m_StressTranslations;
+		std::vector<glm::vec2> m_StressScales;
+		std::vector<float> m_StressRotations;
+		std::vector<glm::vec4> m_StressColors;
+
+		QuadLayer* m_BackgroundLayer = nullptr;
+
+		std::vector<Quad> m_SpriteQuads;
+		std::vector<Sprite> m_Sprites;
 		
 	private:
 		static Application* s_Instance;
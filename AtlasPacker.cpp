@@ -0,0 +1,119 @@
+#include "pch.h"
+#include "AtlasPacker.hpp"
+
+#include <algorithm>
+
+namespace CEE
+{
+	AtlasPacker::AtlasPacker(uint32_t width, uint32_t height, uint32_t padding)
+		: m_Width(width), m_Height(height), m_Padding(padding)
+	{
+		CEE_ASSERT_WITH_MESSAGE(width > 0 && height > 0, "Atlases need a size.");
+		Reset();
+	}
+
+	void AtlasPacker::Reset()
+	{
+		// Rectangles occupy their size plus the padding to their right and below. The atlas is grown by the padding
+		// as well, so rectangles touching its right or bottom edge do not lose texels to padding nobody needs.
+		m_Skyline.clear();
+		m_Skyline.push_back({ 0, 0, m_Width + m_Padding });
+		m_UsedArea = 0;
+		m_RegionCount = 0;
+	}
+
+	bool AtlasPacker::Pack(uint32_t width, uint32_t height, AtlasRegion* region)
+	{
+		if (width == 0 || height == 0 || width > m_Width || height > m_Height)
+			return false;
+
+		uint32_t footprintWidth = width + m_Padding, footprintHeight = height + m_Padding;
+
+		// Lowest top edge wins, ties go to the narrower node to keep wide gaps for wide rectangles.
+		size_t bestNode = SIZE_MAX;
+		uint32_t bestTop = UINT32_MAX, bestWidth = UINT32_MAX, bestY = 0;
+		for (size_t node = 0; node < m_Skyline.size(); node++)
+		{
+			uint32_t y = FitHeight(node, footprintWidth);
+			if (y == UINT32_MAX || y + footprintHeight > m_Height + m_Padding)
+				continue;
+
+			uint32_t top = y + footprintHeight;
+			if (top < bestTop || (top == bestTop && m_Skyline[node].width < bestWidth))
+			{
+				bestNode = node;
+				bestTop = top;
+				bestWidth = m_Skyline[node].width;
+				bestY = y;
+			}
+		}
+		if (bestNode == SIZE_MAX)
+			return false;
+
+		region->x = m_Skyline[bestNode].x;
+		region->y = bestY;
+		region->width = width;
+		region->height = height;
+		AddNode(bestNode, region->x, bestTop, footprintWidth);
+
+		m_UsedArea += (uint64_t)width * height;
+		m_RegionCount++;
+		return true;
+	}
+
+	uint32_t AtlasPacker::FitHeight(size_t node, uint32_t width) const
+	{
+		if (m_Skyline[node].x + width > m_Width + m_Padding)
+			return UINT32_MAX;
+
+		uint32_t y = 0;
+		uint32_t remaining = width;
+		for (size_t i = node; remaining > 0; i++)
+		{
+			y = std::max(y, m_Skyline[i].y);
+			remaining -= std::min(remaining, m_Skyline[i].width);
+		}
+		return y;
+	}
+
+	void AtlasPacker::AddNode(size_t node, uint32_t x, uint32_t y, uint32_t width)
+	{
+		m_Skyline.insert(m_Skyline.begin() + node, { x, y, width });
+
+		// Nodes now under the new one shrink from the left or disappear.
+		uint32_t end = x + width;
+		size_t next = node + 1;
+		while (next < m_Skyline.size() && m_Skyline[next].x < end)
+		{
+			SkylineNode& covered = m_Skyline[next];
+			uint32_t coveredEnd = covered.x + covered.width;
+			if (coveredEnd <= end)
+			{
+				m_Skyline.erase(m_Skyline.begin() + next);
+				continue;
+			}
+			covered.width = coveredEnd - end;
+			covered.x = end;
+			break;
+		}
+
+		// Neighbours at the same height are one node, only the new node's can have changed.
+		size_t i = node > 0 ? node - 1 : 0;
+		while (i + 1 < m_Skyline.size() && i <= node + 1)
+		{
+			if (m_Skyline[i].y == m_Skyline[i + 1].y)
+			{
+				m_Skyline[i].width += m_Skyline[i + 1].width;
+				m_Skyline.erase(m_Skyline.begin() + i + 1);
+			}
+			else
+				i++;
+		}
+	}
+
+	glm::vec4 AtlasPacker::GetTexCoords(const AtlasRegion& region) const
+	{
+		return glm::vec4((float)region.x / m_Width, (float)region.y / m_Height,
+						 (float)(region.x + region.width) / m_Width, (float)(region.y + region.height) / m_Height);
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef _ATLAS_PACKER_HPP
+#define _ATLAS_PACKER_HPP
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace CEE
+{
+	// Texel rectangle of an atlas, y grows downwards from the first row of the image.
+	typedef struct AtlasRegion {
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+		uint32_t height;
+	} AtlasRegion;
+
+	// Places rectangles in a fixed size atlas with the skyline bottom-left heuristic: the atlas is described by the
+	// top edge of everything packed so far, and each rectangle goes where its top ends lowest. Good occupancy for
+	// sprites of mixed sizes at a cost linear in the length of the skyline, which stays short in practice.
+	class AtlasPacker
+	{
+	public:
+		// Every rectangle is kept padding texels away from its neighbours, so filtering does not bleed between sprites.
+		AtlasPacker(uint32_t width, uint32_t height, uint32_t padding = 1);
+
+		// Returns false, leaving region untouched, when the rectangle does not fit anymore.
+		bool Pack(uint32_t width, uint32_t height, AtlasRegion* region);
+		void Reset();
+
+		// Normalized texture coordinates (min u, min v, max u, max v) of a region of this atlas.
+		glm::vec4 GetTexCoords(const AtlasRegion& region) const;
+
+		inline uint32_t GetWidth() const { return m_Width; }
+		inline uint32_t GetHeight() const { return m_Height; }
+		inline uint32_t GetRegionCount() const { return m_RegionCount; }
+		// Share of the atlas covered by packed rectangles, padding excluded.
+		inline float GetOccupancy() const { return (float)((double)m_UsedArea / ((double)m_Width * m_Height)); }
+
+	private:
+		typedef struct SkylineNode {
+			uint32_t x;
+			uint32_t y;
+			uint32_t width;
+		} SkylineNode;
+
+		// Top of the skyline under [x, x + width) starting at node, UINT32_MAX if the span leaves the atlas.
+		uint32_t FitHeight(size_t node, uint32_t width) const;
+		void AddNode(size_t node, uint32_t x, uint32_t y, uint32_t width);
+
+	private:
+		uint32_t m_Width;
+		uint32_t m_Height;
+		uint32_t m_Padding;
+
+		// Left to right, covering the full width without gaps.
+		std::vector<SkylineNode> m_Skyline;
+		uint64_t m_UsedArea = 0;
+		uint32_t m_RegionCount = 0;
+	};
+}
+
+#endif
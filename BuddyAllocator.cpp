@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "BuddyAllocator.hpp"
+
+#include <algorithm>
+
+namespace CEE
+{
+	static bool IsPowerOfTwo(uint64_t value)
+	{
+		return value != 0 && (value & (value - 1)) == 0;
+	}
+
+	BuddyAllocator::BuddyAllocator(uint64_t size, uint64_t minBlockSize)
+		: m_Size(size), m_MinBlockSize(minBlockSize)
+	{
+		CEE_ASSERT_WITH_MESSAGE(IsPowerOfTwo(size) && IsPowerOfTwo(minBlockSize) && minBlockSize <= size,
+								"Buddy allocator sizes must be powers of two.");
+
+		m_MaxOrder = 0;
+		while (OrderSize(m_MaxOrder) < m_Size)
+			m_MaxOrder++;
+
+		m_FreeBlocks.resize(m_MaxOrder + 1);
+		m_FreeBlocks[m_MaxOrder].push_back(0);
+	}
+
+	BuddyAllocator::~BuddyAllocator()
+	{
+
+	}
+
+	bool BuddyAllocator::Allocate(uint64_t size, uint64_t alignment, uint64_t* offset)
+	{
+		uint64_t required = std::max(std::max(size, alignment), m_MinBlockSize);
+		if (required > m_Size)
+			return false;
+
+		uint32_t order = 0;
+		while (OrderSize(order) < required)
+			order++;
+
+		// Smallest free block that fits, split down to the requested order.
+		uint32_t freeOrder = order;
+		while (freeOrder <= m_MaxOrder && m_FreeBlocks[freeOrder].empty())
+			freeOrder++;
+		if (freeOrder > m_MaxOrder)
+			return false;
+
+		uint64_t blockOffset = m_FreeBlocks[freeOrder].back();
+		m_FreeBlocks[freeOrder].pop_back();
+		while (freeOrder > order)
+		{
+			freeOrder--;
+			m_FreeBlocks[freeOrder].push_back(blockOffset + OrderSize(freeOrder));
+		}
+
+		m_Allocations[blockOffset] = order;
+		m_UsedSize += OrderSize(order);
+		*offset = blockOffset;
+		return true;
+	}
+
+	void BuddyAllocator::Free(uint64_t offset)
+	{
+		auto it = m_Allocations.find(offset);
+		CEE_ASSERT_WITH_MESSAGE(it != m_Allocations.end(), "Freeing an offset that was not allocated.");
+		if (it == m_Allocations.end())
+			return;
+
+		uint32_t order = it->second;
+		m_Allocations.erase(it);
+		m_UsedSize -= OrderSize(order);
+
+		// Merge with the buddy for as long as it is free as well.
+		while (order < m_MaxOrder)
+		{
+			uint64_t buddyOffset = offset ^ OrderSize(order);
+			if (!RemoveFreeBlock(order, buddyOffset))
+				break;
+			offset = std::min(offset, buddyOffset);
+			order++;
+		}
+		m_FreeBlocks[order].push_back(offset);
+	}
+
+	uint64_t BuddyAllocator::GetBlockSize(uint64_t offset) const
+	{
+		auto it = m_Allocations.find(offset);
+		if (it == m_Allocations.end())
+			return 0;
+		return OrderSize(it->second);
+	}
+
+	void BuddyAllocator::ForEachAllocation(const std::function<void(uint64_t offset, uint64_t blockSize)>& callback) const
+	{
+		for (const auto& [offset, order] : m_Allocations)
+			callback(offset, OrderSize(order));
+	}
+
+	uint64_t BuddyAllocator::GetLargestFreeBlock() const
+	{
+		for (uint32_t order = m_MaxOrder + 1; order-- > 0;)
+		{
+			if (!m_FreeBlocks[order].empty())
+				return OrderSize(order);
+		}
+		return 0;
+	}
+
+	bool BuddyAllocator::RemoveFreeBlock(uint32_t order, uint64_t offset)
+	{
+		std::vector<uint64_t>& freeBlocks = m_FreeBlocks[order];
+		auto it = std::find(freeBlocks.begin(), freeBlocks.end(), offset);
+		if (it == freeBlocks.end())
+			return false;
+		*it = freeBlocks.back();
+		freeBlocks.pop_back();
+		return true;
+	}
+}
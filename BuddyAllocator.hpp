@@ -0,0 +1,50 @@
+#ifndef _BUDDY_ALLOCATOR_HPP
+#define _BUDDY_ALLOCATOR_HPP
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace CEE
+{
+	// Buddy sub-allocator over an abstract range of offsets, it never touches memory itself. Blocks are powers of
+	// two placed at multiples of their own size, so any power of two alignment up to the block size comes for free.
+	class BuddyAllocator
+	{
+	public:
+		// Both sizes must be powers of two, minBlockSize <= size.
+		BuddyAllocator(uint64_t size, uint64_t minBlockSize);
+		~BuddyAllocator();
+
+		bool Allocate(uint64_t size, uint64_t alignment, uint64_t* offset);
+		void Free(uint64_t offset);
+
+		// Size of the block backing the allocation at offset, zero if there is none.
+		uint64_t GetBlockSize(uint64_t offset) const;
+		void ForEachAllocation(const std::function<void(uint64_t offset, uint64_t blockSize)>& callback) const;
+
+		inline uint64_t GetSize() const { return m_Size; }
+		inline uint64_t GetUsedSize() const { return m_UsedSize; }
+		inline uint32_t GetAllocationCount() const { return (uint32_t)m_Allocations.size(); }
+		inline bool IsEmpty() const { return m_Allocations.empty(); }
+		uint64_t GetLargestFreeBlock() const;
+
+	private:
+		inline uint64_t OrderSize(uint32_t order) const { return m_MinBlockSize << order; }
+		bool RemoveFreeBlock(uint32_t order, uint64_t offset);
+
+	private:
+		uint64_t m_Size;
+		uint64_t m_MinBlockSize;
+		uint32_t m_MaxOrder;
+		uint64_t m_UsedSize = 0;
+
+		// Free block offsets per order, order 0 blocks are m_MinBlockSize bytes.
+		std::vector<std::vector<uint64_t>> m_FreeBlocks;
+		// Allocated block offset to order.
+		std::unordered_map<uint64_t, uint32_t> m_Allocations;
+	};
+}
+
+#endif
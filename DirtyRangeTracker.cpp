@@ -0,0 +1,151 @@
+#include "pch.h"
+#include "DirtyRangeTracker.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace CEE
+{
+	static inline uint64_t RotateLeft(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	static inline uint64_t MixWord(uint64_t hash, uint64_t word)
+	{
+		word *= 0x87C37B91114253D5ull;
+		word = RotateLeft(word, 31);
+		word *= 0x4CF5AD432745937Full;
+		hash ^= word;
+		return RotateLeft(hash, 27) * 5 + 0x52DCE729;
+	}
+
+	uint64_t HashBytes(const uint8_t* data, size_t size)
+	{
+		// Four independent lanes over 32 byte blocks keep the multiplies pipelined, pages are hashed every frame.
+		uint64_t lanes[4] = { 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull };
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32)
+		{
+			uint64_t words[4];
+			memcpy(words, data + i, sizeof(words));
+			for (int lane = 0; lane < 4; lane++)
+				lanes[lane] = MixWord(lanes[lane], words[lane]);
+		}
+
+		uint64_t hash = size;
+		for (int lane = 0; lane < 4; lane++)
+			hash = MixWord(hash, lanes[lane]);
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, sizeof(word));
+			hash = MixWord(hash, word);
+		}
+		if (i < size)
+		{
+			uint64_t word = 0;
+			memcpy(&word, data + i, size - i);
+			hash = MixWord(hash, word);
+		}
+
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 33;
+		hash *= 0xC4CEB9FE1A85EC53ull;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	DirtyRangeTracker::DirtyRangeTracker(size_t pageSize)
+		: m_PageSize(pageSize)
+	{
+		CEE_ASSERT_WITH_MESSAGE(pageSize > 0, "Dirty range pages can not be empty.");
+	}
+
+	void DirtyRangeTracker::MarkDirty(size_t offset, size_t size)
+	{
+		if (size == 0)
+			return;
+
+		size_t firstPage = offset / m_PageSize;
+		size_t endPage = (offset + size + m_PageSize - 1) / m_PageSize;
+		EnsurePages(endPage);
+		// The hash no longer describes what will be uploaded, a later Diff must not take the page for unchanged.
+		for (size_t page = firstPage; page < endPage; page++)
+		{
+			m_PageHashed[page] = 0;
+			MarkPage(page);
+		}
+	}
+
+	void DirtyRangeTracker::MarkAllDirty()
+	{
+		// Forgetting the hashes as well makes the next Diff report everything it covers.
+		std::fill(m_PageHashed.begin(), m_PageHashed.end(), (uint8_t)0);
+		for (size_t page = 0; page < m_PageDirty.size(); page++)
+			MarkPage(page);
+	}
+
+	void DirtyRangeTracker::Diff(const uint8_t* data, size_t begin, size_t end)
+	{
+		if (begin >= end)
+			return;
+
+		size_t firstPage = begin / m_PageSize;
+		size_t endPage = (end + m_PageSize - 1) / m_PageSize;
+		EnsurePages(endPage);
+		for (size_t page = firstPage; page < endPage; page++)
+		{
+			// The size goes into the hash, so a partial page that grew later never matches its shorter self.
+			size_t pageBegin = page * m_PageSize;
+			uint64_t hash = HashBytes(data + pageBegin, std::min(pageBegin + m_PageSize, end) - pageBegin);
+			if (!m_PageHashed[page] || m_PageHashes[page] != hash)
+				MarkPage(page);
+			m_PageHashes[page] = hash;
+			m_PageHashed[page] = 1;
+		}
+	}
+
+	void DirtyRangeTracker::TakeDirtyRanges(size_t end, std::vector<DirtyRange>* ranges)
+	{
+		size_t firstRange = ranges->size();
+		for (size_t page = 0; page < m_PageDirty.size() && m_DirtyPageCount > 0; page++)
+		{
+			if (!m_PageDirty[page])
+				continue;
+
+			m_PageDirty[page] = 0;
+			m_DirtyPageCount--;
+
+			size_t offset = page * m_PageSize;
+			if (offset >= end)
+				continue;
+
+			size_t size = std::min(offset + m_PageSize, end) - offset;
+			if (ranges->size() > firstRange && ranges->back().offset + ranges->back().size == offset)
+				ranges->back().size += size;
+			else
+				ranges->push_back({ offset, size });
+		}
+	}
+
+	void DirtyRangeTracker::EnsurePages(size_t pageCount)
+	{
+		if (m_PageDirty.size() >= pageCount)
+			return;
+
+		m_PageHashes.resize(pageCount, 0);
+		m_PageHashed.resize(pageCount, 0);
+		m_PageDirty.resize(pageCount, 0);
+	}
+
+	void DirtyRangeTracker::MarkPage(size_t page)
+	{
+		if (m_PageDirty[page])
+			return;
+
+		m_PageDirty[page] = 1;
+		m_DirtyPageCount++;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef _DIRTY_RANGE_TRACKER_HPP
+#define _DIRTY_RANGE_TRACKER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace CEE
+{
+	typedef struct DirtyRange {
+		size_t offset;
+		size_t size;
+	} DirtyRange;
+
+	// Splits a byte stream into fixed size pages and remembers which ones changed since the last upload, either because
+	// they were marked explicitly or because Diff found their contents hash differently than last time.
+	class DirtyRangeTracker
+	{
+	public:
+		DirtyRangeTracker(size_t pageSize = 4096);
+
+		void MarkDirty(size_t offset, size_t size);
+		void MarkAllDirty();
+
+		// Hashes every page overlapping [begin, end) of data, which holds the whole stream, and marks the ones whose
+		// contents changed. Pages are hashed from their start, so the bytes before begin have to be current as well.
+		void Diff(const uint8_t* data, size_t begin, size_t end);
+
+		// Appends the dirty pages below end, adjacent ones merged and the last clamped to end. Every page is clean
+		// afterwards, including dirty ones past end.
+		void TakeDirtyRanges(size_t end, std::vector<DirtyRange>* ranges);
+
+		inline bool IsDirty() const { return m_DirtyPageCount > 0; }
+		inline size_t GetPageSize() const { return m_PageSize; }
+
+	private:
+		void EnsurePages(size_t pageCount);
+		void MarkPage(size_t page);
+
+	private:
+		size_t m_PageSize;
+
+		std::vector<uint64_t> m_PageHashes;
+		// Pages without a hash yet never match, whatever their contents.
+		std::vector<uint8_t> m_PageHashed;
+		std::vector<uint8_t> m_PageDirty;
+		size_t m_DirtyPageCount = 0;
+	};
+
+	uint64_t HashBytes(const uint8_t* data, size_t size);
+}
+
+#endif
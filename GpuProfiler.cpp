@@ -0,0 +1,210 @@
+#include "pch.h"
+#include "GpuProfiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace CEE
+{
+	GpuProfiler::GpuProfiler(vk::Device device, uint32_t framesInFlight, float timestampPeriod, uint32_t timestampValidBits,
+							 uint32_t maxScopesPerFrame, uint32_t sampleWindow)
+		: m_Device(device), m_TimestampPeriod(timestampPeriod), m_MaxQueries(maxScopesPerFrame * 2),
+		  m_SampleWindow(sampleWindow), m_FrameCount(framesInFlight)
+	{
+		CEE_ASSERT_WITH_MESSAGE(timestampValidBits > 0, "Queue family does not support timestamps.");
+		CEE_ASSERT_WITH_MESSAGE(maxScopesPerFrame > 0 && sampleWindow > 0, "Profiler needs room for at least one scope and sample.");
+		m_TimestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+
+		auto const queryPoolInfo = vk::QueryPoolCreateInfo()
+			.setQueryType(vk::QueryType::eTimestamp)
+			.setQueryCount(m_MaxQueries);
+
+		m_Frames.reset(new FrameQueries[m_FrameCount]);
+		for (uint32_t i = 0; i < m_FrameCount; i++)
+		{
+			auto result = m_Device.createQueryPool(&queryPoolInfo, nullptr, &m_Frames[i].queryPool);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create timestamp query pool.");
+			m_Frames[i].scopes.reserve(maxScopesPerFrame);
+		}
+		m_Timestamps.resize(m_MaxQueries);
+	}
+
+	GpuProfiler::~GpuProfiler()
+	{
+		for (uint32_t i = 0; i < m_FrameCount; i++)
+			m_Device.destroyQueryPool(m_Frames[i].queryPool, nullptr);
+	}
+
+	uint32_t GpuProfiler::RegisterScope(const std::string& name, bool indexed)
+	{
+		auto scopeId = m_ScopeIds.find(name);
+		if (scopeId != m_ScopeIds.end())
+		{
+			CEE_ASSERT_WITH_MESSAGE(m_Scopes[scopeId->second].indexed == indexed, "Scope registered as indexed and not indexed.");
+			return scopeId->second;
+		}
+
+		RegisteredScope scope;
+		scope.name = name;
+		scope.indexed = indexed;
+		m_Scopes.push_back(scope);
+		m_ScopeIds.emplace(name, (uint32_t)m_Scopes.size() - 1);
+		return (uint32_t)m_Scopes.size() - 1;
+	}
+
+	void GpuProfiler::BeginFrame(uint32_t frameIndex, vk::CommandBuffer commandBuffer)
+	{
+		FrameQueries& frame = m_Frames[frameIndex];
+		CollectFrame(frame);
+
+		commandBuffer.resetQueryPool(frame.queryPool, 0, m_MaxQueries);
+		frame.queryCount = 0;
+		frame.scopes.clear();
+		m_CurrentFrame = &frame;
+	}
+
+	uint32_t GpuProfiler::BeginScope(vk::CommandBuffer commandBuffer, uint32_t scopeId, uint32_t index, vk::PipelineStageFlagBits stage)
+	{
+		CEE_ASSERT_WITH_MESSAGE(scopeId < m_Scopes.size(), "Scope was not registered.");
+		FrameQueries& frame = *m_CurrentFrame;
+		if (frame.queryCount + 2 > m_MaxQueries)
+		{
+			m_DroppedScopes++;
+			return UINT32_MAX;
+		}
+
+		RecordedScope scope;
+		scope.scopeId = scopeId;
+		scope.index = m_Scopes[scopeId].indexed ? index : 0;
+		scope.beginQuery = frame.queryCount;
+		scope.ended = false;
+		frame.queryCount += 2;
+		frame.scopes.push_back(scope);
+
+		commandBuffer.writeTimestamp(stage, frame.queryPool, scope.beginQuery);
+		return (uint32_t)frame.scopes.size() - 1;
+	}
+
+	void GpuProfiler::EndScope(vk::CommandBuffer commandBuffer, uint32_t scope, vk::PipelineStageFlagBits stage)
+	{
+		if (scope == UINT32_MAX)
+			return;
+
+		RecordedScope& recorded = m_CurrentFrame->scopes[scope];
+		commandBuffer.writeTimestamp(stage, m_CurrentFrame->queryPool, recorded.beginQuery + 1);
+		recorded.ended = true;
+	}
+
+	void GpuProfiler::CollectFrame(FrameQueries& frame)
+	{
+		if (frame.scopes.empty())
+			return;
+
+		// Queries of scopes that never ended stay unavailable, which only makes the call report eNotReady.
+		auto result = m_Device.getQueryPoolResults(frame.queryPool, 0, frame.queryCount, frame.queryCount * sizeof(uint64_t),
+												   m_Timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess || result == vk::Result::eNotReady, "Failed to get timestamp query results.");
+
+		for (const RecordedScope& recorded : frame.scopes)
+		{
+			if (!recorded.ended)
+				continue;
+
+			// Masking keeps the difference right when the counter wrapped within its valid bits.
+			uint64_t ticks = (m_Timestamps[recorded.beginQuery + 1] - m_Timestamps[recorded.beginQuery]) & m_TimestampMask;
+			float time = (float)(ticks * (double)m_TimestampPeriod / 1000000.0);
+
+			// Indices grow their samples the first time they are collected, not while recording.
+			std::vector<ScopeSamples>& indexSamples = m_Scopes[recorded.scopeId].samples;
+			if (recorded.index >= indexSamples.size())
+				indexSamples.resize(recorded.index + 1);
+			ScopeSamples& samples = indexSamples[recorded.index];
+			if (samples.times.size() < m_SampleWindow)
+				samples.times.push_back(time);
+			else
+				samples.times[samples.next] = time;
+			samples.next = (samples.next + 1) % m_SampleWindow;
+			samples.totalSamples++;
+		}
+		m_CollectedFrames++;
+	}
+
+	GpuProfile GpuProfiler::GetProfile() const
+	{
+		GpuProfile profile;
+		profile.frames = m_CollectedFrames;
+		profile.droppedScopes = m_DroppedScopes;
+
+		std::vector<float> sorted;
+		for (const RegisteredScope& scope : m_Scopes)
+		{
+			for (size_t index = 0; index < scope.samples.size(); index++)
+			{
+				const ScopeSamples& samples = scope.samples[index];
+				if (samples.totalSamples == 0)
+					continue;
+
+				GpuScopeStatistics statistics;
+				statistics.name = scope.indexed ? scope.name + " " + std::to_string(index) : scope.name;
+				statistics.samples = (uint32_t)samples.times.size();
+				statistics.totalSamples = samples.totalSamples;
+				statistics.minTime = statistics.avgTime = statistics.p99Time = 0.0f;
+				if (!samples.times.empty())
+				{
+					sorted.assign(samples.times.begin(), samples.times.end());
+					std::sort(sorted.begin(), sorted.end());
+					double sum = 0.0;
+					for (float time : sorted)
+						sum += time;
+					statistics.minTime = sorted.front();
+					statistics.avgTime = (float)(sum / sorted.size());
+					statistics.p99Time = sorted[(size_t)std::ceil(0.99 * sorted.size()) - 1];
+				}
+				profile.scopes.push_back(statistics);
+			}
+		}
+		return profile;
+	}
+
+	vk::Result GpuProfiler::WriteProfile(const std::string& filepath) const
+	{
+		FILE* file = fopen(filepath.c_str(), "w");
+		if (!file)
+		{
+			fprintf(stderr, "Failed to open %s for writing.\n", filepath.c_str());
+			return vk::Result::eErrorInitializationFailed;
+		}
+
+		GpuProfile profile = GetProfile();
+		fprintf(file, "# GPU profile over %llu frames, %llu scopes dropped, times in milliseconds\n",
+				(unsigned long long)profile.frames, (unsigned long long)profile.droppedScopes);
+		fprintf(file, "%-24s %10s %10s %10s %10s\n", "scope", "samples", "min", "avg", "p99");
+		for (const GpuScopeStatistics& scope : profile.scopes)
+		{
+			fprintf(file, "%-24s %10u %10.4f %10.4f %10.4f\n", scope.name.c_str(), scope.samples, scope.minTime,
+					scope.avgTime, scope.p99Time);
+		}
+
+		if (fclose(file) != 0)
+		{
+			fprintf(stderr, "Failed to write %s.\n", filepath.c_str());
+			return vk::Result::eErrorInitializationFailed;
+		}
+		return vk::Result::eSuccess;
+	}
+
+	void GpuProfiler::Reset()
+	{
+		for (RegisteredScope& scope : m_Scopes)
+		{
+			for (ScopeSamples& samples : scope.samples)
+			{
+				samples.times.clear();
+				samples.next = 0;
+				samples.totalSamples = 0;
+			}
+		}
+		m_CollectedFrames = 0;
+		m_DroppedScopes = 0;
+	}
+}
@@ -0,0 +1,119 @@
+#ifndef _GPU_PROFILER_HPP
+#define _GPU_PROFILER_HPP
+
+#include <unordered_map>
+
+namespace CEE
+{
+	typedef struct GpuScopeStatistics {
+		std::string name;
+		// Samples in the window the times below are taken over, and samples taken since the last reset.
+		uint32_t samples;
+		uint64_t totalSamples;
+		// Milliseconds between the scope's two timestamps.
+		float minTime;
+		float avgTime;
+		float p99Time;
+	} GpuScopeStatistics;
+
+	typedef struct GpuProfile {
+		// Frames whose timestamps were read back since the last reset.
+		uint64_t frames;
+		// Scopes not recorded because a frame ran out of queries.
+		uint64_t droppedScopes;
+		// In the order scopes were registered, indexed scopes by index. Scopes without samples since the last reset
+		// are left out.
+		std::vector<GpuScopeStatistics> scopes;
+	} GpuProfile;
+
+	// Measures named scopes of command buffers with timestamp queries, one query pool per frame in flight. A frame's
+	// results are read when BeginFrame comes back to its pool, after the frame's fence signaled, so reading them
+	// never waits for the GPU. Each scope keeps its most recent samples for the statistics. Render thread only.
+	//
+	// Scopes are registered once up front and begun by id, so recording one neither formats nor looks up a name.
+	// Indexed scopes stand for a numbered series, such as the n-th draw of a frame, each index sampled on its own.
+	//
+	// Timestamps mark when all earlier commands passed a pipeline stage, so a scope around a draw also includes
+	// whatever work of earlier draws overlaps with it.
+	class GpuProfiler
+	{
+	public:
+		// timestampPeriod is in nanoseconds per tick, timestampValidBits those of the queue family the frames are
+		// submitted to and must not be 0.
+		GpuProfiler(vk::Device device, uint32_t framesInFlight, float timestampPeriod, uint32_t timestampValidBits,
+					uint32_t maxScopesPerFrame = 256, uint32_t sampleWindow = 256);
+		~GpuProfiler();
+
+		// Returns the scope's id, the same one for every registration of a name. Indexed scopes are reported as
+		// "<name> <index>".
+		uint32_t RegisterScope(const std::string& name, bool indexed = false);
+
+		// The frame's previous submission must have completed. Collects its results and records the reset of its
+		// queries, which has to happen outside of a render pass.
+		void BeginFrame(uint32_t frameIndex, vk::CommandBuffer commandBuffer);
+		// Scopes may nest and span render pass boundaries, but have to end in the command buffer they began in. The
+		// index is ignored for scopes not registered as indexed. Returns UINT32_MAX when the frame ran out of
+		// queries, which EndScope ignores.
+		uint32_t BeginScope(vk::CommandBuffer commandBuffer, uint32_t scopeId, uint32_t index = 0,
+							vk::PipelineStageFlagBits stage = vk::PipelineStageFlagBits::eTopOfPipe);
+		void EndScope(vk::CommandBuffer commandBuffer, uint32_t scope,
+					  vk::PipelineStageFlagBits stage = vk::PipelineStageFlagBits::eBottomOfPipe);
+
+		GpuProfile GetProfile() const;
+		// Writes GetProfile as a table of one scope per line.
+		vk::Result WriteProfile(const std::string& filepath) const;
+		void Reset();
+
+	private:
+		// Owns queries beginQuery and beginQuery + 1.
+		typedef struct RecordedScope {
+			uint32_t scopeId;
+			uint32_t index;
+			uint32_t beginQuery;
+			bool ended;
+		} RecordedScope;
+
+		typedef struct FrameQueries {
+			vk::QueryPool queryPool;
+			uint32_t queryCount = 0;
+			std::vector<RecordedScope> scopes;
+		} FrameQueries;
+
+		typedef struct ScopeSamples {
+			// Ring of the latest sampleWindow times in milliseconds.
+			std::vector<float> times;
+			uint32_t next = 0;
+			uint64_t totalSamples = 0;
+		} ScopeSamples;
+
+		typedef struct RegisteredScope {
+			std::string name;
+			bool indexed;
+			// One per index seen so far, only the first for scopes that are not indexed.
+			std::vector<ScopeSamples> samples;
+		} RegisteredScope;
+
+	private:
+		void CollectFrame(FrameQueries& frame);
+
+	private:
+		vk::Device m_Device;
+		float m_TimestampPeriod;
+		uint64_t m_TimestampMask;
+		uint32_t m_MaxQueries;
+		uint32_t m_SampleWindow;
+
+		std::unique_ptr<FrameQueries[]> m_Frames;
+		uint32_t m_FrameCount;
+		FrameQueries* m_CurrentFrame = nullptr;
+
+		std::vector<RegisteredScope> m_Scopes;
+		std::unordered_map<std::string, uint32_t> m_ScopeIds;
+		std::vector<uint64_t> m_Timestamps;
+
+		uint64_t m_CollectedFrames = 0;
+		uint64_t m_DroppedScopes = 0;
+	};
+}
+
+#endif
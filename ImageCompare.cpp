@@ -0,0 +1,102 @@
+#include "pch.h"
+#include "ImageCompare.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace CEE
+{
+	ImageComparison CompareImages(const uint8_t* actual, const uint8_t* expected, uint32_t width, uint32_t height,
+								  const ImageTolerance& tolerance, std::vector<uint8_t>* difference)
+	{
+		size_t pixelCount = (size_t)width * height;
+		if (difference)
+			difference->resize(pixelCount * 4);
+
+		ImageComparison comparison = {};
+		uint64_t differenceSum = 0;
+		for (size_t i = 0; i < pixelCount; i++)
+		{
+			const uint8_t* a = actual + i * 4;
+			const uint8_t* b = expected + i * 4;
+			uint8_t pixelDifference = (uint8_t)std::max({ std::abs(a[0] - b[0]), std::abs(a[1] - b[1]), std::abs(a[2] - b[2]) });
+
+			differenceSum += pixelDifference;
+			comparison.maxChannelDifference = std::max(comparison.maxChannelDifference, pixelDifference);
+			bool differs = pixelDifference > tolerance.channelDifference;
+			if (differs)
+				comparison.differingPixels++;
+
+			if (difference)
+			{
+				uint8_t* pixel = difference->data() + i * 4;
+				pixel[0] = differs ? 255 : b[0] / 4;
+				pixel[1] = differs ? 0 : b[1] / 4;
+				pixel[2] = differs ? 0 : b[2] / 4;
+				pixel[3] = 255;
+			}
+		}
+
+		comparison.meanDifference = pixelCount > 0 ? (float)((double)differenceSum / pixelCount) : 0.0f;
+		comparison.matches = comparison.differingPixels <= (uint64_t)(tolerance.differingPixels * pixelCount);
+		return comparison;
+	}
+
+	vk::Result WriteImageFile(const std::string& filepath, uint32_t width, uint32_t height, const uint8_t* pixels)
+	{
+		FILE* file = fopen(filepath.c_str(), "wb");
+		if (!file)
+		{
+			fprintf(stderr, "Failed to open %s for writing.\n", filepath.c_str());
+			return vk::Result::eErrorInitializationFailed;
+		}
+
+		fprintf(file, "P6\n%u %u\n255\n", width, height);
+		std::vector<uint8_t> row((size_t)width * 3);
+		bool written = true;
+		for (uint32_t y = 0; y < height && written; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+				memcpy(&row[(size_t)x * 3], pixels + ((size_t)y * width + x) * 4, 3);
+			written = fwrite(row.data(), 1, row.size(), file) == row.size();
+		}
+
+		if (fclose(file) != 0 || !written)
+		{
+			fprintf(stderr, "Failed to write %s.\n", filepath.c_str());
+			return vk::Result::eErrorInitializationFailed;
+		}
+		return vk::Result::eSuccess;
+	}
+
+	bool ReadImageTolerance(const std::string& filepath, ImageTolerance* tolerance)
+	{
+		FILE* file = fopen(filepath.c_str(), "r");
+		if (!file)
+			return false;
+
+		char line[256];
+		bool valid = true;
+		while (valid && fgets(line, sizeof(line), file))
+		{
+			char key[64];
+			if (sscanf(line, "%63s", key) != 1 || key[0] == '#')
+				continue;
+
+			unsigned int channelDifference;
+			float differingPixels;
+			if (!strcmp(key, "channelDifference") && sscanf(line, "%*s %u", &channelDifference) == 1 && channelDifference <= 255)
+				tolerance->channelDifference = (uint8_t)channelDifference;
+			else if (!strcmp(key, "differingPixels") && sscanf(line, "%*s %f", &differingPixels) == 1 &&
+					 differingPixels >= 0.0f && differingPixels <= 1.0f)
+				tolerance->differingPixels = differingPixels;
+			else
+				valid = false;
+		}
+		fclose(file);
+
+		if (!valid)
+			fprintf(stderr, "Failed to parse image tolerance %s.\n", filepath.c_str());
+		return valid;
+	}
+}
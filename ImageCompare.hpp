@@ -0,0 +1,38 @@
+#ifndef _IMAGE_COMPARE_HPP
+#define _IMAGE_COMPARE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CEE
+{
+	typedef struct ImageTolerance {
+		// Largest difference in any channel for two pixels to still count as equal.
+		uint8_t channelDifference = 2;
+		// Share of pixels allowed to differ by more, absorbs edge rasterization differences between drivers.
+		float differingPixels = 0.001f;
+	} ImageTolerance;
+
+	typedef struct ImageComparison {
+		bool matches;
+		uint64_t differingPixels;
+		uint8_t maxChannelDifference;
+		// Mean over all pixels of their largest channel difference.
+		float meanDifference;
+	} ImageComparison;
+
+	// Compares the color channels of two R8G8B8A8 images of the same size, alpha is ignored as PPM files do not keep
+	// it. With difference set it receives an R8G8B8A8 image of expected, dimmed, with the differing pixels in red.
+	ImageComparison CompareImages(const uint8_t* actual, const uint8_t* expected, uint32_t width, uint32_t height,
+								  const ImageTolerance& tolerance, std::vector<uint8_t>* difference = nullptr);
+
+	// Writes R8G8B8A8 rows as a binary PPM, which DecodeImageFile reads back. Alpha is dropped.
+	vk::Result WriteImageFile(const std::string& filepath, uint32_t width, uint32_t height, const uint8_t* pixels);
+
+	// Reads "channelDifference <0-255>" and "differingPixels <share>" lines into tolerance, lines starting with # are
+	// comments. Keys missing from the file keep their value. Returns false if the file can't be opened or parsed.
+	bool ReadImageTolerance(const std::string& filepath, ImageTolerance* tolerance);
+}
+
+#endif
@@ -0,0 +1,381 @@
+#include "pch.h"
+#include "MemoryAllocator.hpp"
+
+#include <algorithm>
+
+namespace CEE
+{
+	static const vk::DeviceSize s_MinBlockSize = 1024 * 1024;
+	static const vk::DeviceSize s_MinAllocationSize = 256;
+
+	static vk::DeviceSize AlignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	MemoryAllocator::MemoryAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize)
+		: m_Device(device)
+	{
+		CEE_ASSERT_WITH_MESSAGE(blockSize >= s_MinBlockSize && (blockSize & (blockSize - 1)) == 0, "Block size must be a power of two of at least 1MiB.");
+
+		physicalDevice.getMemoryProperties(&m_MemoryProperties);
+
+		vk::PhysicalDeviceProperties properties;
+		physicalDevice.getProperties(&properties);
+		m_BufferImageGranularity = properties.limits.bufferImageGranularity;
+		m_NonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+
+		// No heap should be taken by a handful of blocks.
+		for (uint32_t i = 0; i < m_MemoryProperties.memoryHeapCount; i++)
+		{
+			vk::DeviceSize heapBlockSize = blockSize;
+			while (heapBlockSize > s_MinBlockSize && heapBlockSize > m_MemoryProperties.memoryHeaps[i].size / 8)
+				heapBlockSize >>= 1;
+			m_HeapBlockSizes[i] = heapBlockSize;
+		}
+
+		memset(m_Statistics, 0, sizeof(m_Statistics));
+	}
+
+	MemoryAllocator::~MemoryAllocator()
+	{
+		for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+		{
+			CEE_ASSERT_WITH_MESSAGE(m_Statistics[i].allocationCount == 0, "Memory allocator destroyed with live allocations.");
+			for (MemoryBlock& block : m_Blocks[i])
+			{
+				if (block.memory)
+					FreeDeviceMemory(i, block.memory, block.allocator->GetSize(), block.mappedPtr != nullptr);
+			}
+		}
+	}
+
+	vk::Result MemoryAllocator::Allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags requiredFlags,
+										 vk::MemoryPropertyFlags preferredFlags, AllocationUsage usage, Allocation* allocation)
+	{
+		uint32_t memoryTypeIndex;
+		if (!FindMemoryType(requirements.memoryTypeBits, requiredFlags, preferredFlags, &memoryTypeIndex))
+			return vk::Result::eErrorFeatureNotPresent;
+
+		vk::DeviceSize size = requirements.size;
+		vk::DeviceSize alignment = requirements.alignment;
+		if (usage == AllocationUsage::eOptimalImage)
+		{
+			// Blocks mix buffers and images, padding optimal images to whole granularity pages keeps linear
+			// resources from ever aliasing a page with them.
+			size = AlignUp(size, m_BufferImageGranularity);
+			alignment = std::max(alignment, m_BufferImageGranularity);
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		vk::DeviceSize blockSize = m_HeapBlockSizes[m_MemoryProperties.memoryTypes[memoryTypeIndex].heapIndex];
+		vk::Result result = vk::Result::eErrorOutOfDeviceMemory;
+		if (size <= blockSize / 2)
+			result = AllocateFromBlocks(memoryTypeIndex, size, alignment, allocation);
+		// Large resources and resources that no longer fit into a new block get their own memory object.
+		if (result != vk::Result::eSuccess)
+			result = AllocateDedicated(memoryTypeIndex, size, allocation);
+		if (result != vk::Result::eSuccess)
+			return result;
+
+		allocation->size = size;
+		m_Statistics[memoryTypeIndex].allocationCount++;
+		m_Statistics[memoryTypeIndex].usedBytes += size;
+		return vk::Result::eSuccess;
+	}
+
+	vk::Result MemoryAllocator::AllocateForBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags requiredFlags, Allocation* allocation,
+												  vk::MemoryPropertyFlags preferredFlags)
+	{
+		vk::MemoryRequirements memoryRequirements;
+		m_Device.getBufferMemoryRequirements(buffer, &memoryRequirements);
+
+		auto result = Allocate(memoryRequirements, requiredFlags, preferredFlags, AllocationUsage::eLinear, allocation);
+		if (result != vk::Result::eSuccess)
+			return result;
+
+		m_Device.bindBufferMemory(buffer, allocation->memory, allocation->offset);
+		return vk::Result::eSuccess;
+	}
+
+	vk::Result MemoryAllocator::AllocateForImage(vk::Image image, vk::ImageTiling tiling, vk::MemoryPropertyFlags requiredFlags, Allocation* allocation,
+												 vk::MemoryPropertyFlags preferredFlags)
+	{
+		vk::MemoryRequirements memoryRequirements;
+		m_Device.getImageMemoryRequirements(image, &memoryRequirements);
+
+		AllocationUsage usage = tiling == vk::ImageTiling::eOptimal ? AllocationUsage::eOptimalImage : AllocationUsage::eLinear;
+		auto result = Allocate(memoryRequirements, requiredFlags, preferredFlags, usage, allocation);
+		if (result != vk::Result::eSuccess)
+			return result;
+
+		m_Device.bindImageMemory(image, allocation->memory, allocation->offset);
+		return vk::Result::eSuccess;
+	}
+
+	void MemoryAllocator::Free(Allocation& allocation)
+	{
+		if (!allocation.memory)
+			return;
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		uint32_t memoryTypeIndex = allocation.memoryTypeIndex;
+		if (allocation.blockIndex == UINT32_MAX)
+		{
+			FreeDeviceMemory(memoryTypeIndex, allocation.memory, allocation.size, allocation.mappedPtr != nullptr);
+		}
+		else
+		{
+			MemoryBlock& block = m_Blocks[memoryTypeIndex][allocation.blockIndex];
+			block.allocator->Free(allocation.offset);
+			block.allocationSizes.erase(allocation.offset);
+		}
+
+		m_Statistics[memoryTypeIndex].allocationCount--;
+		m_Statistics[memoryTypeIndex].usedBytes -= allocation.size;
+		allocation = Allocation();
+	}
+
+	vk::Result MemoryAllocator::Flush(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size)
+	{
+		if (IsHostCoherent(allocation))
+			return vk::Result::eSuccess;
+
+		auto const range = GetMappedRange(allocation, offset, size);
+		return m_Device.flushMappedMemoryRanges(1, &range);
+	}
+
+	vk::Result MemoryAllocator::Invalidate(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size)
+	{
+		if (IsHostCoherent(allocation))
+			return vk::Result::eSuccess;
+
+		auto const range = GetMappedRange(allocation, offset, size);
+		return m_Device.invalidateMappedMemoryRanges(1, &range);
+	}
+
+	vk::MappedMemoryRange MemoryAllocator::GetMappedRange(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const
+	{
+		if (size == VK_WHOLE_SIZE)
+			size = allocation.size - offset;
+
+		// Flushed and invalidated ranges have to be aligned to nonCoherentAtomSize, blocks are always a multiple of it.
+		vk::DeviceSize begin = (allocation.offset + offset) & ~(m_NonCoherentAtomSize - 1);
+		vk::DeviceSize end = AlignUp(allocation.offset + offset + size, m_NonCoherentAtomSize);
+		vk::DeviceSize rangeSize = end - begin;
+		if (allocation.blockIndex == UINT32_MAX && end > allocation.size)
+			rangeSize = VK_WHOLE_SIZE;
+
+		return vk::MappedMemoryRange()
+			.setMemory(allocation.memory)
+			.setOffset(begin)
+			.setSize(rangeSize);
+	}
+
+	bool MemoryAllocator::IsHostCoherent(const Allocation& allocation) const
+	{
+		return (bool)(m_MemoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+	}
+
+	void MemoryAllocator::Defragment(float maxOccupancy, const DefragmentationCallback& callback)
+	{
+		// Collected first, the callback is expected to call back into Allocate and Free.
+		std::vector<Allocation> candidates;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+			{
+				for (uint32_t j = 0; j < (uint32_t)m_Blocks[i].size(); j++)
+				{
+					const MemoryBlock& block = m_Blocks[i][j];
+					if (!block.memory || block.allocator->IsEmpty())
+						continue;
+
+					float occupancy = (float)block.allocator->GetUsedSize() / (float)block.allocator->GetSize();
+					if (occupancy >= maxOccupancy)
+						continue;
+
+					for (const auto& [offset, size] : block.allocationSizes)
+					{
+						Allocation allocation;
+						allocation.memory = block.memory;
+						allocation.offset = offset;
+						allocation.size = size;
+						allocation.memoryTypeIndex = i;
+						allocation.blockIndex = j;
+						allocation.mappedPtr = block.mappedPtr ? block.mappedPtr + offset : nullptr;
+						candidates.push_back(allocation);
+					}
+				}
+			}
+		}
+
+		for (const Allocation& allocation : candidates)
+			callback(allocation);
+	}
+
+	uint32_t MemoryAllocator::ReleaseEmptyBlocks()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		uint32_t releasedCount = 0;
+		for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+		{
+			for (MemoryBlock& block : m_Blocks[i])
+			{
+				if (!block.memory || !block.allocator->IsEmpty())
+					continue;
+
+				FreeDeviceMemory(i, block.memory, block.allocator->GetSize(), block.mappedPtr != nullptr);
+				block = MemoryBlock();
+				releasedCount++;
+			}
+		}
+		return releasedCount;
+	}
+
+	MemoryStatistics MemoryAllocator::GetStatistics() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		MemoryStatistics statistics;
+		memset(&statistics, 0, sizeof(MemoryStatistics));
+		for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+		{
+			statistics.deviceMemoryCount += m_Statistics[i].deviceMemoryCount;
+			statistics.allocationCount += m_Statistics[i].allocationCount;
+			statistics.reservedBytes += m_Statistics[i].reservedBytes;
+			statistics.usedBytes += m_Statistics[i].usedBytes;
+		}
+		return statistics;
+	}
+
+	MemoryStatistics MemoryAllocator::GetStatistics(uint32_t memoryTypeIndex) const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Statistics[memoryTypeIndex];
+	}
+
+	bool MemoryAllocator::FindMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags requiredFlags, vk::MemoryPropertyFlags preferredFlags, uint32_t* typeIndex) const
+	{
+		const vk::MemoryPropertyFlags passes[] { requiredFlags | preferredFlags, requiredFlags };
+		for (vk::MemoryPropertyFlags flags : passes)
+		{
+			for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+			{
+				if ((typeBits & (1u << i)) && (m_MemoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+				{
+					*typeIndex = i;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	vk::Result MemoryAllocator::AllocateDeviceMemory(uint32_t memoryTypeIndex, vk::DeviceSize size, vk::DeviceMemory* memory, uint8_t** mappedPtr)
+	{
+		auto const memoryAllocateInfo = vk::MemoryAllocateInfo()
+			.setAllocationSize(size)
+			.setMemoryTypeIndex(memoryTypeIndex);
+
+		auto result = m_Device.allocateMemory(&memoryAllocateInfo, nullptr, memory);
+		if (result != vk::Result::eSuccess)
+			return result;
+
+		*mappedPtr = nullptr;
+		if (IsHostVisible(memoryTypeIndex))
+		{
+			result = m_Device.mapMemory(*memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), reinterpret_cast<void**>(mappedPtr));
+			if (result != vk::Result::eSuccess)
+			{
+				m_Device.freeMemory(*memory, nullptr);
+				return result;
+			}
+		}
+
+		m_Statistics[memoryTypeIndex].deviceMemoryCount++;
+		m_Statistics[memoryTypeIndex].reservedBytes += size;
+		return vk::Result::eSuccess;
+	}
+
+	vk::Result MemoryAllocator::AllocateFromBlocks(uint32_t memoryTypeIndex, vk::DeviceSize size, vk::DeviceSize alignment, Allocation* allocation)
+	{
+		std::vector<MemoryBlock>& blocks = m_Blocks[memoryTypeIndex];
+
+		uint32_t blockIndex = UINT32_MAX;
+		vk::DeviceSize offset = 0;
+		for (uint32_t i = 0; i < (uint32_t)blocks.size(); i++)
+		{
+			if (blocks[i].memory && blocks[i].allocator->Allocate(size, alignment, &offset))
+			{
+				blockIndex = i;
+				break;
+			}
+		}
+
+		if (blockIndex == UINT32_MAX)
+		{
+			// Reuse a released slot before growing the block list.
+			for (uint32_t i = 0; i < (uint32_t)blocks.size() && blockIndex == UINT32_MAX; i++)
+			{
+				if (!blocks[i].memory)
+					blockIndex = i;
+			}
+			if (blockIndex == UINT32_MAX)
+			{
+				blockIndex = (uint32_t)blocks.size();
+				blocks.emplace_back();
+			}
+
+			MemoryBlock& block = blocks[blockIndex];
+			vk::DeviceSize blockSize = m_HeapBlockSizes[m_MemoryProperties.memoryTypes[memoryTypeIndex].heapIndex];
+			auto result = AllocateDeviceMemory(memoryTypeIndex, blockSize, &block.memory, &block.mappedPtr);
+			if (result != vk::Result::eSuccess)
+			{
+				block = MemoryBlock();
+				return result;
+			}
+			block.allocator = std::make_unique<BuddyAllocator>(blockSize, s_MinAllocationSize);
+
+			bool pass = block.allocator->Allocate(size, alignment, &offset);
+			CEE_ASSERT_WITH_MESSAGE(pass, "Allocation does not fit into an empty block.");
+		}
+
+		MemoryBlock& block = blocks[blockIndex];
+		block.allocationSizes[offset] = size;
+
+		allocation->memory = block.memory;
+		allocation->offset = offset;
+		allocation->memoryTypeIndex = memoryTypeIndex;
+		allocation->blockIndex = blockIndex;
+		allocation->mappedPtr = block.mappedPtr ? block.mappedPtr + offset : nullptr;
+		return vk::Result::eSuccess;
+	}
+
+	vk::Result MemoryAllocator::AllocateDedicated(uint32_t memoryTypeIndex, vk::DeviceSize size, Allocation* allocation)
+	{
+		uint8_t* mappedPtr;
+		auto result = AllocateDeviceMemory(memoryTypeIndex, size, &allocation->memory, &mappedPtr);
+		if (result != vk::Result::eSuccess)
+			return result;
+
+		allocation->offset = 0;
+		allocation->memoryTypeIndex = memoryTypeIndex;
+		allocation->blockIndex = UINT32_MAX;
+		allocation->mappedPtr = mappedPtr;
+		return vk::Result::eSuccess;
+	}
+
+	void MemoryAllocator::FreeDeviceMemory(uint32_t memoryTypeIndex, vk::DeviceMemory memory, vk::DeviceSize size, bool mapped)
+	{
+		if (mapped)
+			m_Device.unmapMemory(memory);
+		m_Device.freeMemory(memory, nullptr);
+
+		m_Statistics[memoryTypeIndex].deviceMemoryCount--;
+		m_Statistics[memoryTypeIndex].reservedBytes -= size;
+	}
+}
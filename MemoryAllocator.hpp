@@ -0,0 +1,114 @@
+#ifndef _MEMORY_ALLOCATOR_HPP
+#define _MEMORY_ALLOCATOR_HPP
+
+#include "BuddyAllocator.hpp"
+
+#include <mutex>
+
+namespace CEE
+{
+	enum class AllocationUsage {
+		// Buffers and linear images.
+		eLinear,
+		// Optimal tiling images, padded to bufferImageGranularity so they never share a page with linear resources.
+		eOptimalImage
+	};
+
+	typedef struct Allocation {
+		vk::DeviceMemory memory;
+		vk::DeviceSize offset = 0;
+		vk::DeviceSize size = 0;
+		uint32_t memoryTypeIndex = UINT32_MAX;
+		// Block the allocation was carved from, UINT32_MAX for a dedicated device memory object.
+		uint32_t blockIndex = UINT32_MAX;
+
+		// Start of the allocation in persistently mapped memory, nullptr unless the memory is host visible.
+		uint8_t* mappedPtr = nullptr;
+	} Allocation;
+
+	typedef struct MemoryStatistics {
+		// Live vk::DeviceMemory objects, blocks and dedicated allocations together.
+		uint32_t deviceMemoryCount;
+		uint32_t allocationCount;
+
+		// Bytes held in device memory objects and bytes handed out of them as requested by the callers.
+		vk::DeviceSize reservedBytes;
+		vk::DeviceSize usedBytes;
+	} MemoryStatistics;
+
+	// Called for each live allocation in a sparse block. The owner may move its resource by allocating again,
+	// copying and freeing the old allocation, after which ReleaseEmptyBlocks returns the drained blocks.
+	typedef std::function<void(const Allocation& allocation)> DefragmentationCallback;
+
+	// Sub-allocates resources from large per memory type blocks instead of one vkAllocateMemory per resource.
+	// Host visible blocks are mapped once for their whole lifetime. Thread safe.
+	class MemoryAllocator
+	{
+	public:
+		MemoryAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize = 64 * 1024 * 1024);
+		~MemoryAllocator();
+
+		// Picks a memory type with all requiredFlags, preferring one that also has preferredFlags.
+		vk::Result Allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags requiredFlags,
+							vk::MemoryPropertyFlags preferredFlags, AllocationUsage usage, Allocation* allocation);
+		// Allocate and bind in one go.
+		vk::Result AllocateForBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags requiredFlags, Allocation* allocation,
+									 vk::MemoryPropertyFlags preferredFlags = vk::MemoryPropertyFlags());
+		vk::Result AllocateForImage(vk::Image image, vk::ImageTiling tiling, vk::MemoryPropertyFlags requiredFlags, Allocation* allocation,
+									vk::MemoryPropertyFlags preferredFlags = vk::MemoryPropertyFlags());
+		void Free(Allocation& allocation);
+
+		// Makes host writes visible to the device, a no-op for host coherent memory. Offset is relative to the allocation.
+		vk::Result Flush(const Allocation& allocation, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE);
+		// Makes device writes visible to the host once they completed, a no-op for host coherent memory.
+		vk::Result Invalidate(const Allocation& allocation, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE);
+		bool IsHostCoherent(const Allocation& allocation) const;
+
+		// Invokes callback for every allocation living in a block whose occupancy is below maxOccupancy.
+		void Defragment(float maxOccupancy, const DefragmentationCallback& callback);
+		// Frees blocks without any allocations, returns how many were released.
+		uint32_t ReleaseEmptyBlocks();
+
+		MemoryStatistics GetStatistics() const;
+		MemoryStatistics GetStatistics(uint32_t memoryTypeIndex) const;
+
+		bool FindMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags requiredFlags, vk::MemoryPropertyFlags preferredFlags, uint32_t* typeIndex) const;
+
+	private:
+		typedef struct MemoryBlock {
+			vk::DeviceMemory memory;
+			std::unique_ptr<BuddyAllocator> allocator;
+			uint8_t* mappedPtr;
+
+			// Requested size of each live allocation by offset, the buddy allocator only knows the rounded size.
+			std::unordered_map<vk::DeviceSize, vk::DeviceSize> allocationSizes;
+		} MemoryBlock;
+
+	private:
+		vk::Result AllocateDeviceMemory(uint32_t memoryTypeIndex, vk::DeviceSize size, vk::DeviceMemory* memory, uint8_t** mappedPtr);
+		vk::Result AllocateFromBlocks(uint32_t memoryTypeIndex, vk::DeviceSize size, vk::DeviceSize alignment, Allocation* allocation);
+		vk::Result AllocateDedicated(uint32_t memoryTypeIndex, vk::DeviceSize size, Allocation* allocation);
+		void FreeDeviceMemory(uint32_t memoryTypeIndex, vk::DeviceMemory memory, vk::DeviceSize size, bool mapped);
+		vk::MappedMemoryRange GetMappedRange(const Allocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const;
+		inline bool IsHostVisible(uint32_t memoryTypeIndex) const
+		{
+			return (bool)(m_MemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+		}
+
+	private:
+		vk::Device m_Device;
+		vk::PhysicalDeviceMemoryProperties m_MemoryProperties;
+		vk::DeviceSize m_BufferImageGranularity;
+		vk::DeviceSize m_NonCoherentAtomSize;
+
+		// Block size per memory heap, smaller heaps such as the host visible device local window get smaller blocks.
+		vk::DeviceSize m_HeapBlockSizes[VK_MAX_MEMORY_HEAPS];
+
+		mutable std::mutex m_Mutex;
+		// Released blocks leave an empty slot so the block indices of live allocations stay valid.
+		std::vector<MemoryBlock> m_Blocks[VK_MAX_MEMORY_TYPES];
+		MemoryStatistics m_Statistics[VK_MAX_MEMORY_TYPES];
+	};
+}
+
+#endif
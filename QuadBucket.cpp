@@ -0,0 +1,54 @@
+#include "pch.h"
+#include "QuadBucket.hpp"
+
+namespace CEE
+{
+	QuadBucket::QuadBucket(QuadBatchMode batchMode, const VertexLayout& vertexLayout)
+		: m_BatchMode(batchMode), m_VertexLayout(vertexLayout)
+	{
+
+	}
+
+	QuadBucket::~QuadBucket()
+	{
+
+	}
+
+	void QuadBucket::DrawQuad(glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color)
+	{
+		if (m_BatchMode == QuadBatchMode::eInstanced)
+		{
+			m_Instances.emplace_back();
+			WriteQuadInstance(&m_Instances.back(), translation, scale, rotationAngle, color);
+		}
+		else
+		{
+			size_t quadSize = 4 * m_VertexLayout.GetStride();
+			m_Vertices.resize(m_Vertices.size() + quadSize);
+			WriteQuadVertices(m_VertexLayout, &m_Vertices[m_Vertices.size() - quadSize], translation, scale, rotationAngle, color);
+		}
+		m_QuadCount++;
+	}
+
+	void QuadBucket::Clear()
+	{
+		m_Vertices.clear();
+		m_Instances.clear();
+		m_QuadCount = 0;
+	}
+
+	void QuadBucket::Reserve(uint32_t quadCount)
+	{
+		if (m_BatchMode == QuadBatchMode::eInstanced)
+			m_Instances.reserve(quadCount);
+		else
+			m_Vertices.reserve((size_t)quadCount * 4 * m_VertexLayout.GetStride());
+	}
+
+	const uint8_t* QuadBucket::GetData() const
+	{
+		if (m_BatchMode == QuadBatchMode::eInstanced)
+			return reinterpret_cast<const uint8_t*>(m_Instances.data());
+		return m_Vertices.data();
+	}
+}
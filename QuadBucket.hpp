@@ -0,0 +1,37 @@
+#ifndef _QUAD_BUCKET_HPP
+#define _QUAD_BUCKET_HPP
+
+#include "Renderer.hpp"
+
+namespace CEE
+{
+	// Quads recorded by a single thread, already in the renderer's batch format so the expensive
+	// per-quad work happens on the recording thread. Hand it to Renderer::SubmitQuadBucket.
+	class QuadBucket
+	{
+	public:
+		// Pass the renderer's GetBatchMode and GetVertexLayout.
+		QuadBucket(QuadBatchMode batchMode, const VertexLayout& vertexLayout);
+		~QuadBucket();
+
+		void DrawQuad(glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color);
+
+		void Clear();
+		void Reserve(uint32_t quadCount);
+
+		inline QuadBatchMode GetBatchMode() const { return m_BatchMode; }
+		inline const VertexLayout& GetVertexLayout() const { return m_VertexLayout; }
+		inline uint32_t GetQuadCount() const { return m_QuadCount; }
+		const uint8_t* GetData() const;
+
+	private:
+		QuadBatchMode m_BatchMode;
+		VertexLayout m_VertexLayout;
+		uint32_t m_QuadCount = 0;
+
+		std::vector<uint8_t> m_Vertices;
+		std::vector<QuadInstance> m_Instances;
+	};
+}
+
+#endif
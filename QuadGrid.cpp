@@ -0,0 +1,98 @@
+#include "pch.h"
+#include "QuadGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace CEE
+{
+	QuadGrid::QuadGrid(float cellSize)
+		: m_CellSize(cellSize), m_Origin(0.0f), m_CellExtent(cellSize), m_MaxHalfExtent(0.0f)
+	{
+		CEE_ASSERT_WITH_MESSAGE(cellSize > 0.0f, "Grid cells need a positive size.");
+	}
+
+	QuadGrid::~QuadGrid()
+	{
+
+	}
+
+	static uint32_t CellCoordinate(float position, float origin, float extent, uint32_t cellCount)
+	{
+		float cell = std::floor((position - origin) / extent);
+		return (uint32_t)std::min(std::max(cell, 0.0f), (float)(cellCount - 1));
+	}
+
+	void QuadGrid::Build(const QuadInstance* instances, uint32_t count, QuadInstance* sorted)
+	{
+		std::vector<glm::vec2> centers(count);
+		glm::vec2 minCenter(0.0f), maxCenter(0.0f);
+		m_MaxHalfExtent = glm::vec2(0.0f);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			glm::vec2 halfExtent;
+			GetQuadBounds(instances[i].translation, instances[i].scale, instances[i].rotation, &centers[i], &halfExtent);
+			m_MaxHalfExtent = glm::max(m_MaxHalfExtent, halfExtent);
+			minCenter = i == 0 ? centers[i] : glm::min(minCenter, centers[i]);
+			maxCenter = i == 0 ? centers[i] : glm::max(maxCenter, centers[i]);
+		}
+
+		glm::vec2 size = maxCenter - minCenter;
+		m_Origin = minCenter;
+		m_Columns = (uint32_t)std::min(size.x / m_CellSize + 1.0f, (float)s_MaxCellsPerAxis);
+		m_Rows = (uint32_t)std::min(size.y / m_CellSize + 1.0f, (float)s_MaxCellsPerAxis);
+		// Capped grids stretch their cells to keep covering every center.
+		m_CellExtent = glm::max(glm::vec2(m_CellSize), size / glm::vec2((float)m_Columns, (float)m_Rows));
+
+		// Counting sort by cell, stable so quads within a cell keep their order.
+		m_CellStarts.assign((size_t)m_Columns * m_Rows + 1, 0);
+		m_QuadCells.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t column = CellCoordinate(centers[i].x, m_Origin.x, m_CellExtent.x, m_Columns);
+			uint32_t row = CellCoordinate(centers[i].y, m_Origin.y, m_CellExtent.y, m_Rows);
+			m_QuadCells[i] = row * m_Columns + column;
+			m_CellStarts[m_QuadCells[i] + 1]++;
+		}
+		for (size_t cell = 1; cell < m_CellStarts.size(); cell++)
+			m_CellStarts[cell] += m_CellStarts[cell - 1];
+
+		std::vector<uint32_t> cursors(m_CellStarts.begin(), m_CellStarts.end() - 1);
+		for (uint32_t i = 0; i < count; i++)
+			sorted[cursors[m_QuadCells[i]]++] = instances[i];
+	}
+
+	uint32_t QuadGrid::Query(const glm::vec4& bounds, std::vector<QuadRange>* ranges) const
+	{
+		if (m_Columns == 0 || m_CellStarts.back() == 0)
+			return 0;
+
+		glm::vec2 gridEnd = m_Origin + m_CellExtent * glm::vec2((float)m_Columns, (float)m_Rows);
+		float minX = bounds.x - m_MaxHalfExtent.x, maxX = bounds.z + m_MaxHalfExtent.x;
+		float minY = bounds.y - m_MaxHalfExtent.y, maxY = bounds.w + m_MaxHalfExtent.y;
+		if (maxX < m_Origin.x || minX > gridEnd.x || maxY < m_Origin.y || minY > gridEnd.y)
+			return 0;
+
+		uint32_t firstColumn = CellCoordinate(minX, m_Origin.x, m_CellExtent.x, m_Columns);
+		uint32_t lastColumn = CellCoordinate(maxX, m_Origin.x, m_CellExtent.x, m_Columns);
+		uint32_t firstRow = CellCoordinate(minY, m_Origin.y, m_CellExtent.y, m_Rows);
+		uint32_t lastRow = CellCoordinate(maxY, m_Origin.y, m_CellExtent.y, m_Rows);
+
+		size_t firstRange = ranges->size();
+		uint32_t quadCount = 0;
+		for (uint32_t row = firstRow; row <= lastRow; row++)
+		{
+			uint32_t first = m_CellStarts[row * m_Columns + firstColumn];
+			uint32_t end = m_CellStarts[row * m_Columns + lastColumn + 1];
+			if (first == end)
+				continue;
+
+			if (ranges->size() > firstRange && ranges->back().first + ranges->back().count == first)
+				ranges->back().count += end - first;
+			else
+				ranges->push_back({ first, end - first });
+			quadCount += end - first;
+		}
+		return quadCount;
+	}
+}
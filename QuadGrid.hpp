@@ -0,0 +1,46 @@
+#ifndef _QUAD_GRID_HPP
+#define _QUAD_GRID_HPP
+
+#include "Renderer.hpp"
+
+namespace CEE
+{
+	// Uniform grid over quads, bucketed by the cell holding their center. Build reorders the quads cell by cell and
+	// row by row, so the quads of a row of cells are contiguous and a query yields a few ranges instead of a list of
+	// quads, each of which can be drawn directly from the reordered buffer.
+	class QuadGrid
+	{
+	public:
+		// Cells grow beyond cellSize when the quads spread over more than s_MaxCellsPerAxis cells on an axis.
+		QuadGrid(float cellSize);
+		~QuadGrid();
+
+		// Writes the quads to sorted, which needs room for count instances, in cell order.
+		void Build(const QuadInstance* instances, uint32_t count, QuadInstance* sorted);
+
+		// Appends the ranges of sorted quads whose cells may overlap bounds (min x, min y, max x, max y), one per row of
+		// cells and merged where rows are contiguous. Returns the number of quads covered.
+		uint32_t Query(const glm::vec4& bounds, std::vector<QuadRange>* ranges) const;
+
+		inline uint32_t GetColumnCount() const { return m_Columns; }
+		inline uint32_t GetRowCount() const { return m_Rows; }
+
+	private:
+		static const uint32_t s_MaxCellsPerAxis = 1024;
+
+		float m_CellSize;
+
+		glm::vec2 m_Origin;
+		glm::vec2 m_CellExtent;
+		uint32_t m_Columns = 0;
+		uint32_t m_Rows = 0;
+		// Quads are bucketed by center, queries are grown by the largest half extent to still find their edges.
+		glm::vec2 m_MaxHalfExtent;
+
+		// Index of the first sorted quad of every cell, plus one past the last quad.
+		std::vector<uint32_t> m_CellStarts;
+		std::vector<uint32_t> m_QuadCells;
+	};
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "QuadLayer.hpp"
+
+namespace CEE
+{
+	QuadLayer::QuadLayer(vk::Device device, MemoryAllocator* allocator, uint32_t capacity, float cellSize)
+		: m_Device(device), m_MemoryAllocator(allocator), m_Capacity(capacity)
+	{
+		CEE_ASSERT_WITH_MESSAGE(capacity > 0, "Quad layers need room for at least one quad.");
+
+		auto const bufferCreateInfo = vk::BufferCreateInfo()
+			.setUsage(vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst)
+			.setSize((vk::DeviceSize)capacity * sizeof(QuadInstance))
+			.setQueueFamilyIndexCount(0)
+			.setPQueueFamilyIndices(nullptr)
+			.setSharingMode(vk::SharingMode::eExclusive);
+
+		auto result = m_Device.createBuffer(&bufferCreateInfo, nullptr, &m_Buffer);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create quad layer buffer.");
+
+		result = m_MemoryAllocator->AllocateForBuffer(m_Buffer, vk::MemoryPropertyFlagBits::eDeviceLocal, &m_Allocation);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate memory for quad layer buffer.");
+
+		m_Instances.reserve(capacity);
+		if (cellSize > 0.0f)
+			m_Grid = std::make_unique<QuadGrid>(cellSize);
+	}
+
+	QuadLayer::~QuadLayer()
+	{
+		m_Device.destroyBuffer(m_Buffer, nullptr);
+		m_MemoryAllocator->Free(m_Allocation);
+	}
+
+	uint32_t QuadLayer::AddQuad(glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color, const Sprite& sprite)
+	{
+		CEE_ASSERT_WITH_MESSAGE(m_Instances.size() < m_Capacity, "Quad layer is full.");
+
+		uint32_t index = (uint32_t)m_Instances.size();
+		m_Instances.emplace_back();
+		WriteQuadInstance(&m_Instances.back(), translation, scale, rotationAngle, color, sprite);
+		MarkQuadDirty(index);
+		return index;
+	}
+
+	void QuadLayer::SetQuad(uint32_t index, glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color, const Sprite& sprite)
+	{
+		CEE_ASSERT_WITH_MESSAGE(index < m_Instances.size(), "Quad index out of range.");
+
+		WriteQuadInstance(&m_Instances[index], translation, scale, rotationAngle, color, sprite);
+		MarkQuadDirty(index);
+	}
+
+	void QuadLayer::SetQuads(const Quad* quads, uint32_t count)
+	{
+		CEE_ASSERT_WITH_MESSAGE(count <= m_Capacity, "Quad layer is too small.");
+
+		m_Instances.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+			WriteQuadInstance(&m_Instances[i], quads[i].translation, quads[i].scale, quads[i].rotation, quads[i].color);
+		if (m_Grid)
+			m_GridDirty = true;
+		else
+			m_DirtyRanges.Diff(reinterpret_cast<const uint8_t*>(m_Instances.data()), 0, (size_t)count * sizeof(QuadInstance));
+	}
+
+	void QuadLayer::Clear()
+	{
+		// Nothing past the quad count is drawn, so the buffer keeps its stale contents. Its hashes are forgotten,
+		// whatever is added next has to be uploaded.
+		m_Instances.clear();
+		m_DirtyRanges.MarkAllDirty();
+		m_GridDirty = m_Grid != nullptr;
+	}
+
+	void QuadLayer::TakeDirtyRanges(std::vector<DirtyRange>* ranges)
+	{
+		// The rebuilt order is diffed against the previous one, quads that kept their place are not sent again.
+		if (m_GridDirty)
+		{
+			m_SortedInstances.resize(m_Instances.size());
+			m_Grid->Build(m_Instances.data(), (uint32_t)m_Instances.size(), m_SortedInstances.data());
+			m_DirtyRanges.Diff(reinterpret_cast<const uint8_t*>(m_SortedInstances.data()), 0, m_SortedInstances.size() * sizeof(QuadInstance));
+			m_GridDirty = false;
+		}
+		m_DirtyRanges.TakeDirtyRanges(m_Instances.size() * sizeof(QuadInstance), ranges);
+	}
+
+	const QuadInstance* QuadLayer::GetBufferData() const
+	{
+		return m_Grid ? m_SortedInstances.data() : m_Instances.data();
+	}
+
+	uint32_t QuadLayer::QueryVisibleRanges(const glm::vec4& bounds, std::vector<QuadRange>* ranges) const
+	{
+		if (m_Grid)
+			return m_Grid->Query(bounds, ranges);
+
+		if (m_BufferQuadCount > 0)
+			ranges->push_back({ 0, m_BufferQuadCount });
+		return m_BufferQuadCount;
+	}
+
+	void QuadLayer::MarkQuadDirty(uint32_t index)
+	{
+		// Any change may move quads between cells, the grid is rebuilt before the next upload.
+		if (m_Grid)
+			m_GridDirty = true;
+		else
+			m_DirtyRanges.MarkDirty((size_t)index * sizeof(QuadInstance), sizeof(QuadInstance));
+	}
+}
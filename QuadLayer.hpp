@@ -0,0 +1,72 @@
+#ifndef _QUAD_LAYER_HPP
+#define _QUAD_LAYER_HPP
+
+#include "Renderer.hpp"
+#include "DirtyRangeTracker.hpp"
+#include "QuadGrid.hpp"
+
+namespace CEE
+{
+	// Quads that persist across frames in a device local instance buffer of their own. Only quads changed since the
+	// last upload are sent again, the renderer does so in BeginScene. Create with Renderer::CreateQuadLayer and draw
+	// with Renderer::DrawQuadLayer, changes made after BeginScene show up in the next scene.
+	//
+	// With a cell size the quads are kept in a QuadGrid and the buffer holds them in cell order, so only the cells
+	// in view are drawn. Any change then rebuilds the grid, which suits content that rarely changes.
+	class QuadLayer
+	{
+	public:
+		QuadLayer(vk::Device device, MemoryAllocator* allocator, uint32_t capacity, float cellSize = 0.0f);
+		~QuadLayer();
+
+		// Returns the quad's index, which stays valid until Clear.
+		uint32_t AddQuad(glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color, const Sprite& sprite = Sprite());
+		void SetQuad(uint32_t index, glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color,
+					 const Sprite& sprite = Sprite());
+		// Replaces every quad. Only pages whose contents changed are uploaded again, for callers that rebuild the
+		// whole layer rather than tracking individual quads.
+		void SetQuads(const Quad* quads, uint32_t count);
+		void Clear();
+
+		inline uint32_t GetQuadCount() const { return (uint32_t)m_Instances.size(); }
+		inline uint32_t GetCapacity() const { return m_Capacity; }
+		inline vk::Buffer GetBuffer() const { return m_Buffer; }
+		inline bool HasSpatialIndex() const { return m_Grid != nullptr; }
+
+		// Instance records in buffer order and byte ranges of them changed since the last upload. Taking the ranges
+		// rebuilds the grid if needed and marks them uploaded.
+		inline bool IsDirty() const { return m_GridDirty || m_DirtyRanges.IsDirty(); }
+		void TakeDirtyRanges(std::vector<DirtyRange>* ranges);
+		const QuadInstance* GetBufferData() const;
+
+		// Appends the ranges of the buffer holding quads that may overlap bounds (min x, min y, max x, max y), as of
+		// the last upload. Returns the number of quads covered.
+		uint32_t QueryVisibleRanges(const glm::vec4& bounds, std::vector<QuadRange>* ranges) const;
+		// Quads in the buffer as of the last upload, which is what gets drawn. Quads added after BeginScene have
+		// not been uploaded yet.
+		inline uint32_t GetBufferQuadCount() const { return m_BufferQuadCount; }
+		// Called by the renderer ahead of its uploads, which leave every current quad in the buffer.
+		inline void UpdateBufferQuadCount() { m_BufferQuadCount = (uint32_t)m_Instances.size(); }
+
+	private:
+		void MarkQuadDirty(uint32_t index);
+
+	private:
+		vk::Device m_Device;
+		MemoryAllocator* m_MemoryAllocator;
+
+		vk::Buffer m_Buffer;
+		Allocation m_Allocation;
+		uint32_t m_Capacity;
+
+		std::vector<QuadInstance> m_Instances;
+		DirtyRangeTracker m_DirtyRanges;
+		uint32_t m_BufferQuadCount = 0;
+
+		std::unique_ptr<QuadGrid> m_Grid;
+		std::vector<QuadInstance> m_SortedInstances;
+		bool m_GridDirty = false;
+	};
+}
+
+#endif
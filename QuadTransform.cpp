@@ -0,0 +1,302 @@
+#include "pch.h"
+#include "QuadTransform.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CEE_QUAD_TRANSFORM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// FMA is deliberately left out, contracted multiply-adds would make the AVX2 results differ from the other paths.
+#if defined(CEE_QUAD_TRANSFORM_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CEE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CEE_TARGET_AVX2
+#endif
+
+namespace CEE
+{
+	// Untransformed corners, matching the quad vertices of the renderer.
+	static const float s_CornerX[4] = { -0.5f,  0.5f, 0.5f, -0.5f };
+	static const float s_CornerY[4] = {  0.5f,  0.5f, -0.5f, -0.5f };
+
+	// sin and cos on [-pi/4, pi/4] after a three part reduction by pi/2 (Cephes sinf/cosf coefficients).
+	static const float s_TwoOverPi = 0.63661977236758134f;
+	static const float s_PiOverTwoHigh = 1.5703125f;
+	static const float s_PiOverTwoMiddle = 4.837512969970703125e-4f;
+	static const float s_PiOverTwoLow = 7.54978995489188216e-8f;
+	static const float s_Sin1 = -1.6666654611e-1f, s_Sin2 = 8.3321608736e-3f, s_Sin3 = -1.9515295891e-4f;
+	static const float s_Cos1 = 4.166664568298827e-2f, s_Cos2 = -1.388731625493765e-3f, s_Cos3 = 2.443315711809948e-5f;
+
+	static inline void SinCos(float x, float* sine, float* cosine)
+	{
+		float k = std::nearbyint(x * s_TwoOverPi);
+		int32_t quadrant = (int32_t)k;
+		float r = ((x - k * s_PiOverTwoHigh) - k * s_PiOverTwoMiddle) - k * s_PiOverTwoLow;
+		float r2 = r * r;
+
+		float s = r + r * r2 * (s_Sin1 + r2 * (s_Sin2 + r2 * s_Sin3));
+		float c = 1.0f - 0.5f * r2 + r2 * r2 * (s_Cos1 + r2 * (s_Cos2 + r2 * s_Cos3));
+
+		// Quadrants 1 and 3 swap sine and cosine, the sign follows the quadrant.
+		float sv = (quadrant & 1) ? c : s;
+		float cv = (quadrant & 1) ? s : c;
+		*sine = (quadrant & 2) ? -sv : sv;
+		*cosine = ((quadrant + 1) & 2) ? -cv : cv;
+	}
+
+	void TransformQuadsScalar(const QuadTransformInput& input, size_t begin, size_t end, const QuadTransformOutput& output)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			float s, c;
+			SinCos(input.rotations[i], &s, &c);
+
+			glm::vec2 translation = input.translations[i];
+			glm::vec2 scale = input.scales[i];
+			for (uint32_t corner = 0; corner < 4; corner++)
+			{
+				float x = s_CornerX[corner] + translation.x;
+				float y = s_CornerY[corner] + translation.y;
+				output.cornerX[corner][i] = scale.x * (c * x - s * y);
+				output.cornerY[corner][i] = scale.y * (s * x + c * y);
+			}
+		}
+	}
+
+#if defined(CEE_QUAD_TRANSFORM_X86)
+	static void TransformQuadsSSE2(const QuadTransformInput& input, size_t count, const QuadTransformOutput& output)
+	{
+		const float* translations = reinterpret_cast<const float*>(input.translations);
+		const float* scales = reinterpret_cast<const float*>(input.scales);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			// Four interleaved vec2s into x and y lanes.
+			__m128 t0 = _mm_loadu_ps(translations + 2 * i), t1 = _mm_loadu_ps(translations + 2 * i + 4);
+			__m128 s0 = _mm_loadu_ps(scales + 2 * i), s1 = _mm_loadu_ps(scales + 2 * i + 4);
+			__m128 tx = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 ty = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1));
+			__m128 sx = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 sy = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1));
+
+			__m128 x = _mm_loadu_ps(input.rotations + i);
+			__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(s_TwoOverPi)));
+			__m128 k = _mm_cvtepi32_ps(quadrant);
+			__m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(s_PiOverTwoHigh)));
+			r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(s_PiOverTwoMiddle)));
+			r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(s_PiOverTwoLow)));
+			__m128 r2 = _mm_mul_ps(r, r);
+
+			__m128 ps = _mm_add_ps(_mm_set1_ps(s_Sin2), _mm_mul_ps(r2, _mm_set1_ps(s_Sin3)));
+			ps = _mm_add_ps(_mm_set1_ps(s_Sin1), _mm_mul_ps(r2, ps));
+			ps = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), ps));
+			__m128 pc = _mm_add_ps(_mm_set1_ps(s_Cos2), _mm_mul_ps(r2, _mm_set1_ps(s_Cos3)));
+			pc = _mm_add_ps(_mm_set1_ps(s_Cos1), _mm_mul_ps(r2, pc));
+			pc = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), pc));
+
+			__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+			__m128 sine = _mm_or_ps(_mm_and_ps(swap, pc), _mm_andnot_ps(swap, ps));
+			__m128 cosine = _mm_or_ps(_mm_and_ps(swap, ps), _mm_andnot_ps(swap, pc));
+			__m128i sineSign = _mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30);
+			__m128i cosineSign = _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30);
+			sine = _mm_xor_ps(sine, _mm_castsi128_ps(sineSign));
+			cosine = _mm_xor_ps(cosine, _mm_castsi128_ps(cosineSign));
+
+			for (uint32_t corner = 0; corner < 4; corner++)
+			{
+				__m128 cx = _mm_add_ps(_mm_set1_ps(s_CornerX[corner]), tx);
+				__m128 cy = _mm_add_ps(_mm_set1_ps(s_CornerY[corner]), ty);
+				__m128 px = _mm_mul_ps(sx, _mm_sub_ps(_mm_mul_ps(cosine, cx), _mm_mul_ps(sine, cy)));
+				__m128 py = _mm_mul_ps(sy, _mm_add_ps(_mm_mul_ps(sine, cx), _mm_mul_ps(cosine, cy)));
+				_mm_storeu_ps(output.cornerX[corner] + i, px);
+				_mm_storeu_ps(output.cornerY[corner] + i, py);
+			}
+		}
+		TransformQuadsScalar(input, i, count, output);
+	}
+
+	CEE_TARGET_AVX2 static void TransformQuadsAVX2(const QuadTransformInput& input, size_t count, const QuadTransformOutput& output)
+	{
+		const float* translations = reinterpret_cast<const float*>(input.translations);
+		const float* scales = reinterpret_cast<const float*>(input.scales);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			// The in-lane shuffle leaves the 64 bit pairs as 0, 2, 1, 3, the permute restores quad order.
+			__m256 t0 = _mm256_loadu_ps(translations + 2 * i), t1 = _mm256_loadu_ps(translations + 2 * i + 8);
+			__m256 s0 = _mm256_loadu_ps(scales + 2 * i), s1 = _mm256_loadu_ps(scales + 2 * i + 8);
+			__m256 tx = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+			__m256 ty = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+			__m256 sx = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+			__m256 sy = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+
+			__m256 x = _mm256_loadu_ps(input.rotations + i);
+			__m256i quadrant = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(s_TwoOverPi)));
+			__m256 k = _mm256_cvtepi32_ps(quadrant);
+			__m256 r = _mm256_sub_ps(x, _mm256_mul_ps(k, _mm256_set1_ps(s_PiOverTwoHigh)));
+			r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(s_PiOverTwoMiddle)));
+			r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(s_PiOverTwoLow)));
+			__m256 r2 = _mm256_mul_ps(r, r);
+
+			__m256 ps = _mm256_add_ps(_mm256_set1_ps(s_Sin2), _mm256_mul_ps(r2, _mm256_set1_ps(s_Sin3)));
+			ps = _mm256_add_ps(_mm256_set1_ps(s_Sin1), _mm256_mul_ps(r2, ps));
+			ps = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), ps));
+			__m256 pc = _mm256_add_ps(_mm256_set1_ps(s_Cos2), _mm256_mul_ps(r2, _mm256_set1_ps(s_Cos3)));
+			pc = _mm256_add_ps(_mm256_set1_ps(s_Cos1), _mm256_mul_ps(r2, pc));
+			pc = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)), _mm256_mul_ps(_mm256_mul_ps(r2, r2), pc));
+
+			__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+			__m256 sine = _mm256_blendv_ps(ps, pc, swap);
+			__m256 cosine = _mm256_blendv_ps(pc, ps, swap);
+			__m256i sineSign = _mm256_slli_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(2)), 30);
+			__m256i cosineSign = _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30);
+			sine = _mm256_xor_ps(sine, _mm256_castsi256_ps(sineSign));
+			cosine = _mm256_xor_ps(cosine, _mm256_castsi256_ps(cosineSign));
+
+			for (uint32_t corner = 0; corner < 4; corner++)
+			{
+				__m256 cx = _mm256_add_ps(_mm256_set1_ps(s_CornerX[corner]), tx);
+				__m256 cy = _mm256_add_ps(_mm256_set1_ps(s_CornerY[corner]), ty);
+				__m256 px = _mm256_mul_ps(sx, _mm256_sub_ps(_mm256_mul_ps(cosine, cx), _mm256_mul_ps(sine, cy)));
+				__m256 py = _mm256_mul_ps(sy, _mm256_add_ps(_mm256_mul_ps(sine, cx), _mm256_mul_ps(cosine, cy)));
+				_mm256_storeu_ps(output.cornerX[corner] + i, px);
+				_mm256_storeu_ps(output.cornerY[corner] + i, py);
+			}
+		}
+		TransformQuadsScalar(input, i, count, output);
+	}
+
+	static bool CpuSupportsAVX2()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		return avx2 && osxsave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+#endif
+
+	static inline float Min4(float a, float b, float c, float d)
+	{
+		return std::min(std::min(a, b), std::min(c, d));
+	}
+
+	static inline float Max4(float a, float b, float c, float d)
+	{
+		return std::max(std::max(a, b), std::max(c, d));
+	}
+
+	static uint32_t CullQuadsScalar(const QuadTransformOutput& corners, size_t begin, size_t end, const glm::vec4& bounds, uint32_t* visible)
+	{
+		uint32_t visibleCount = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			float minX = Min4(corners.cornerX[0][i], corners.cornerX[1][i], corners.cornerX[2][i], corners.cornerX[3][i]);
+			float maxX = Max4(corners.cornerX[0][i], corners.cornerX[1][i], corners.cornerX[2][i], corners.cornerX[3][i]);
+			float minY = Min4(corners.cornerY[0][i], corners.cornerY[1][i], corners.cornerY[2][i], corners.cornerY[3][i]);
+			float maxY = Max4(corners.cornerY[0][i], corners.cornerY[1][i], corners.cornerY[2][i], corners.cornerY[3][i]);
+
+			// Always written, only kept when visible, so the loop has no data dependent branch.
+			visible[visibleCount] = (uint32_t)i;
+			visibleCount += (maxX >= bounds.x) & (minX <= bounds.z) & (maxY >= bounds.y) & (minY <= bounds.w);
+		}
+		return visibleCount;
+	}
+
+	uint32_t CullQuads(const QuadTransformOutput& corners, size_t count, const glm::vec4& bounds, uint32_t* visible)
+	{
+		size_t i = 0;
+		uint32_t visibleCount = 0;
+#if defined(CEE_QUAD_TRANSFORM_X86)
+		const __m128 boundsMinX = _mm_set1_ps(bounds.x), boundsMinY = _mm_set1_ps(bounds.y);
+		const __m128 boundsMaxX = _mm_set1_ps(bounds.z), boundsMaxY = _mm_set1_ps(bounds.w);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x0 = _mm_loadu_ps(corners.cornerX[0] + i), x1 = _mm_loadu_ps(corners.cornerX[1] + i);
+			__m128 x2 = _mm_loadu_ps(corners.cornerX[2] + i), x3 = _mm_loadu_ps(corners.cornerX[3] + i);
+			__m128 y0 = _mm_loadu_ps(corners.cornerY[0] + i), y1 = _mm_loadu_ps(corners.cornerY[1] + i);
+			__m128 y2 = _mm_loadu_ps(corners.cornerY[2] + i), y3 = _mm_loadu_ps(corners.cornerY[3] + i);
+			__m128 minX = _mm_min_ps(_mm_min_ps(x0, x1), _mm_min_ps(x2, x3));
+			__m128 maxX = _mm_max_ps(_mm_max_ps(x0, x1), _mm_max_ps(x2, x3));
+			__m128 minY = _mm_min_ps(_mm_min_ps(y0, y1), _mm_min_ps(y2, y3));
+			__m128 maxY = _mm_max_ps(_mm_max_ps(y0, y1), _mm_max_ps(y2, y3));
+
+			__m128 overlaps = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(maxX, boundsMinX), _mm_cmple_ps(minX, boundsMaxX)),
+										 _mm_and_ps(_mm_cmpge_ps(maxY, boundsMinY), _mm_cmple_ps(minY, boundsMaxY)));
+			int mask = _mm_movemask_ps(overlaps);
+			for (uint32_t lane = 0; lane < 4; lane++)
+			{
+				visible[visibleCount] = (uint32_t)(i + lane);
+				visibleCount += (mask >> lane) & 1;
+			}
+		}
+#endif
+		return visibleCount + CullQuadsScalar(corners, i, count, bounds, visible + visibleCount);
+	}
+
+	void GetQuadBounds(glm::vec2 translation, glm::vec2 scale, float rotation, glm::vec2* center, glm::vec2* halfExtent)
+	{
+		float s, c;
+		SinCos(rotation, &s, &c);
+
+		// The corners are (+-0.5, +-0.5) before rotating, so the rotated box reaches 0.5 * (|cos| + |sin|) either way.
+		float extent = 0.5f * (std::fabs(c) + std::fabs(s));
+		*center = glm::vec2(scale.x * (c * translation.x - s * translation.y), scale.y * (s * translation.x + c * translation.y));
+		*halfExtent = glm::vec2(std::fabs(scale.x) * extent, std::fabs(scale.y) * extent);
+	}
+
+	typedef void (*QuadTransformKernel)(const QuadTransformInput& input, size_t count, const QuadTransformOutput& output);
+
+#if !defined(CEE_QUAD_TRANSFORM_X86)
+	static void TransformQuadsFallback(const QuadTransformInput& input, size_t count, const QuadTransformOutput& output)
+	{
+		TransformQuadsScalar(input, 0, count, output);
+	}
+#endif
+
+	static QuadTransformKernel SelectKernel(const char** name)
+	{
+#if defined(CEE_QUAD_TRANSFORM_X86)
+		if (CpuSupportsAVX2())
+		{
+			*name = "AVX2";
+			return TransformQuadsAVX2;
+		}
+		// SSE2 is part of every x86-64 CPU.
+		*name = "SSE2";
+		return TransformQuadsSSE2;
+#else
+		*name = "scalar";
+		return TransformQuadsFallback;
+#endif
+	}
+
+	static const char* s_KernelName = nullptr;
+	static const QuadTransformKernel s_Kernel = SelectKernel(&s_KernelName);
+
+	void TransformQuads(const QuadTransformInput& input, size_t count, const QuadTransformOutput& output)
+	{
+		s_Kernel(input, count, output);
+	}
+
+	const char* GetQuadTransformKernelName()
+	{
+		return s_KernelName;
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef _QUAD_TRANSFORM_HPP
+#define _QUAD_TRANSFORM_HPP
+
+#include <glm/glm.hpp>
+
+namespace CEE
+{
+	typedef struct QuadTransformInput {
+		const glm::vec2* translations;
+		const glm::vec2* scales;
+		// Radians.
+		const float* rotations;
+	} QuadTransformInput;
+
+	// Corner c of quad i is (cornerX[c][i], cornerY[c][i]), corners in the same order as the quad's vertices.
+	typedef struct QuadTransformOutput {
+		float* cornerX[4];
+		float* cornerY[4];
+	} QuadTransformOutput;
+
+	// Computes the four transformed corners of count quads, the batched equivalent of the scale * rotate * translate
+	// matrix chain used by DrawQuad. Runs on AVX2 or SSE2 when the CPU supports it and falls back to scalar code.
+	// Every path evaluates the same polynomial sine and cosine, so results do not depend on the instruction set.
+	void TransformQuads(const QuadTransformInput& input, size_t count, const QuadTransformOutput& output);
+
+	// Reference path, used for the tail of the vectorized kernels.
+	void TransformQuadsScalar(const QuadTransformInput& input, size_t begin, size_t end, const QuadTransformOutput& output);
+
+	// Writes the indices of the quads whose corners' bounding box overlaps bounds (min x, min y, max x, max y) to
+	// visible, which needs room for count indices, and returns how many there are. SSE2 on x86.
+	uint32_t CullQuads(const QuadTransformOutput& corners, size_t count, const glm::vec4& bounds, uint32_t* visible);
+
+	// Axis aligned bounding box of a quad under the same transform, as its center and half extent.
+	void GetQuadBounds(glm::vec2 translation, glm::vec2 scale, float rotation, glm::vec2* center, glm::vec2* halfExtent);
+
+	// "AVX2", "SSE2" or "scalar".
+	const char* GetQuadTransformKernelName();
+}
+
+#endif
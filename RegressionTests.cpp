@@ -0,0 +1,418 @@
+#include "pch.h"
+#include "RegressionTests.hpp"
+#include "QuadLayer.hpp"
+#include "QuadBucket.hpp"
+#include "AtlasPacker.hpp"
+#include "UnitTests.hpp"
+
+#include <fstream>
+#include <functional>
+#include <random>
+
+namespace CEE
+{
+	// Frames rendered per scene, the last one is read back. Uploads made while setting a scene up land in the first.
+	static const uint32_t s_SceneFrames = 3;
+
+	// Same sequence on every platform, unlike the standard distributions.
+	static float Unit(std::mt19937& random)
+	{
+		return (random() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	static glm::vec4 RandomColor(std::mt19937& random)
+	{
+		float r = Unit(random), g = Unit(random), b = Unit(random);
+		return glm::vec4(r, g, b, 1.0f);
+	}
+
+	// Draw gets the frame's index, changes it makes to quad layers show up from the next frame on.
+	static void RenderFrames(Renderer& renderer, Camera& camera, const std::function<void(uint32_t frame)>& draw)
+	{
+		for (uint32_t frame = 0; frame < s_SceneFrames; frame++)
+		{
+			renderer.BeginScene(camera);
+			draw(frame);
+			if (frame == s_SceneFrames - 1)
+				renderer.RequestReadback();
+			renderer.EndScene();
+		}
+	}
+
+	// DrawQuad and DrawQuads with rotated quads of many sizes, some of them partly or fully off screen.
+	static void RenderQuadsScene(Renderer& renderer)
+	{
+		std::mt19937 random(1);
+		std::vector<Quad> quads(2000);
+		for (Quad& quad : quads)
+		{
+			float x = Unit(random), y = Unit(random);
+			quad.translation = glm::vec2(x * 2.4f - 1.2f, y * 2.4f - 1.2f);
+			quad.scale = glm::vec2(0.02f + Unit(random) * 0.1f);
+			quad.rotation = Unit(random) * 6.2831853f;
+			quad.color = RandomColor(random);
+		}
+
+		Camera camera;
+		RenderFrames(renderer, camera, [&](uint32_t) {
+			renderer.DrawQuad({ -0.5f, 0.0f }, { 0.5f, 0.5f }, 0.0f, { 1.0f, 0.0f, 0.6f, 1.0f });
+			renderer.DrawQuad({ 0.5f, 0.0f }, { 0.5f, 0.5f }, 0.785f, { 0.2f, 1.0f, 0.5f, 1.0f });
+			renderer.DrawQuads(quads.data(), quads.size());
+		});
+	}
+
+	// The structure-of-arrays path with missing rotations, under a rotated and translated camera.
+	static void RenderQuadArraysScene(Renderer& renderer)
+	{
+		std::mt19937 random(2);
+		const size_t quadCount = 4096;
+		std::vector<glm::vec2> translations(quadCount), scales(quadCount);
+		std::vector<glm::vec4> colors(quadCount);
+		for (size_t i = 0; i < quadCount; i++)
+		{
+			float x = Unit(random), y = Unit(random);
+			translations[i] = glm::vec2(x * 3.0f - 1.5f, y * 3.0f - 1.5f);
+			float width = Unit(random), height = Unit(random);
+			scales[i] = glm::vec2(0.01f + width * 0.04f, 0.01f + height * 0.04f);
+			colors[i] = RandomColor(random);
+		}
+
+		QuadArrays quads;
+		quads.translations = translations.data();
+		quads.scales = scales.data();
+		quads.rotations = nullptr;
+		quads.colors = colors.data();
+		quads.count = quadCount;
+
+		Camera camera;
+		camera.Rotate(0.3f);
+		camera.Translate(glm::vec3(0.2f, -0.1f, 0.0f));
+		RenderFrames(renderer, camera, [&](uint32_t) { renderer.DrawQuads(quads); });
+	}
+
+	// A spatially indexed layer partly in view and a plain one, drawn around immediate quads.
+	static void RenderLayersScene(Renderer& renderer)
+	{
+		const uint32_t columns = 64;
+		QuadLayer* grid = renderer.CreateQuadLayer(columns * columns, 0.1f);
+		float cellSize = 4.0f / columns;
+		for (uint32_t i = 0; i < columns * columns; i++)
+		{
+			glm::vec2 translation(-2.0f + (i % columns + 0.5f) * cellSize, -2.0f + (i / columns + 0.5f) * cellSize);
+			glm::vec4 color((float)(i % columns) / columns, (float)(i / columns) / columns, 0.5f, 1.0f);
+			grid->AddQuad(translation, glm::vec2(cellSize * 0.8f), 0.0f, color);
+		}
+
+		std::mt19937 random(3);
+		QuadLayer* plain = renderer.CreateQuadLayer(256);
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			float x = Unit(random), y = Unit(random);
+			float rotation = Unit(random) * 6.2831853f;
+			plain->AddQuad(glm::vec2(x * 2.0f - 1.0f, y * 2.0f - 1.0f), glm::vec2(0.08f), rotation, RandomColor(random));
+		}
+
+		Camera camera;
+		camera.Translate(glm::vec3(0.5f, 0.5f, 0.0f));
+		RenderFrames(renderer, camera, [&](uint32_t) {
+			renderer.DrawQuadLayer(*grid);
+			renderer.DrawQuad({ 0.0f, 0.0f }, { 0.6f, 0.6f }, 0.4f, { 1.0f, 1.0f, 1.0f, 1.0f });
+			renderer.DrawQuadLayer(*plain);
+		});
+
+		renderer.DestroyQuadLayer(plain);
+		renderer.DestroyQuadLayer(grid);
+	}
+
+	// Plain layers shrunk after the first frame, one to a prefix of its quads through SetQuads and one to nothing.
+	// The quads past the new count are still in the buffers, so drawing a stale count shows them.
+	static void RenderShrunkLayersScene(Renderer& renderer)
+	{
+		std::mt19937 random(7);
+		std::vector<Quad> quads(512);
+		for (Quad& quad : quads)
+		{
+			float x = Unit(random), y = Unit(random);
+			quad.translation = glm::vec2(x * 2.0f - 1.0f, y * 2.0f - 1.0f);
+			quad.scale = glm::vec2(0.04f + Unit(random) * 0.08f);
+			quad.rotation = Unit(random) * 6.2831853f;
+			quad.color = RandomColor(random);
+		}
+
+		QuadLayer* shrunk = renderer.CreateQuadLayer((uint32_t)quads.size());
+		shrunk->SetQuads(quads.data(), (uint32_t)quads.size());
+		QuadLayer* emptied = renderer.CreateQuadLayer(128);
+		emptied->SetQuads(quads.data() + quads.size() - 128, 128);
+
+		Camera camera;
+		RenderFrames(renderer, camera, [&](uint32_t frame) {
+			renderer.DrawQuadLayer(*shrunk);
+			renderer.DrawQuadLayer(*emptied);
+			if (frame == 0)
+			{
+				shrunk->SetQuads(quads.data(), 200);
+				emptied->SetQuads(quads.data(), 0);
+			}
+		});
+
+		renderer.DestroyQuadLayer(emptied);
+		renderer.DestroyQuadLayer(shrunk);
+	}
+
+	// Buckets recorded up front and merged into the scene by EndScene.
+	static void RenderBucketsScene(Renderer& renderer)
+	{
+		std::mt19937 random(4);
+		QuadBucket buckets[2] = {
+			QuadBucket(renderer.GetBatchMode(), renderer.GetVertexLayout()),
+			QuadBucket(renderer.GetBatchMode(), renderer.GetVertexLayout())
+		};
+		for (QuadBucket& bucket : buckets)
+		{
+			for (uint32_t i = 0; i < 1000; i++)
+			{
+				float x = Unit(random), y = Unit(random);
+				float size = Unit(random), rotation = Unit(random);
+				bucket.DrawQuad(glm::vec2(x * 2.0f - 1.0f, y * 2.0f - 1.0f), glm::vec2(0.02f + size * 0.05f),
+								rotation * 6.2831853f, RandomColor(random));
+			}
+		}
+
+		Camera camera;
+		RenderFrames(renderer, camera, [&](uint32_t) {
+			for (const QuadBucket& bucket : buckets)
+				renderer.SubmitQuadBucket(bucket);
+		});
+	}
+
+	// Procedural atlas sprites, tinted, alongside untextured quads in the same batches.
+	static void RenderSpritesScene(Renderer& renderer)
+	{
+		const uint32_t atlasSize = 256;
+		std::mt19937 random(5);
+		std::vector<uint32_t> atlas(atlasSize * atlasSize, 0);
+		std::vector<glm::vec4> texCoords;
+		AtlasPacker packer(atlasSize, atlasSize);
+		AtlasRegion region;
+		while (packer.Pack(16 + random() % 48, 16 + random() % 48, &region))
+		{
+			uint32_t color = 0xFF000000 | (uint32_t)(random() & 0x00FFFFFF);
+			for (uint32_t y = 0; y < region.height; y++)
+			{
+				for (uint32_t x = 0; x < region.width; x++)
+				{
+					float u = (x + 0.5f) / region.width - 0.5f, v = (y + 0.5f) / region.height - 0.5f;
+					atlas[(region.y + y) * atlasSize + region.x + x] = u * u + v * v < 0.25f ? color : 0xFFFFFFFF;
+				}
+			}
+			texCoords.push_back(packer.GetTexCoords(region));
+		}
+		uint32_t texture = renderer.CreateTexture(atlasSize, atlasSize, atlas.data());
+
+		std::vector<Quad> quads(500);
+		std::vector<Sprite> sprites(quads.size());
+		for (size_t i = 0; i < quads.size(); i++)
+		{
+			float x = Unit(random), y = Unit(random);
+			quads[i].translation = glm::vec2(x * 2.0f - 1.0f, y * 2.0f - 1.0f);
+			quads[i].scale = glm::vec2(0.05f + Unit(random) * 0.1f);
+			quads[i].rotation = Unit(random) * 6.2831853f;
+			quads[i].color = i % 3 == 0 ? RandomColor(random) : glm::vec4(1.0f);
+			sprites[i].texture = i % 5 == 0 ? 0 : texture;
+			sprites[i].texCoords = texCoords[random() % texCoords.size()];
+		}
+
+		Camera camera;
+		RenderFrames(renderer, camera, [&](uint32_t) {
+			for (size_t i = 0; i < quads.size(); i++)
+				renderer.DrawSprite(quads[i].translation, quads[i].scale, quads[i].rotation, sprites[i], quads[i].color);
+		});
+
+		renderer.DestroyTexture(texture);
+	}
+
+	typedef struct RegressionScene {
+		const char* name;
+		void (*render)(Renderer& renderer);
+		bool instancedOnly;
+		bool texturedOnly;
+	} RegressionScene;
+
+	static const RegressionScene s_Scenes[] = {
+		{ "quads", RenderQuadsScene, false, false },
+		{ "quad_arrays", RenderQuadArraysScene, false, false },
+		{ "layers", RenderLayersScene, false, false },
+		{ "shrunk_layers", RenderShrunkLayersScene, false, false },
+		{ "buckets", RenderBucketsScene, false, false },
+		{ "sprites", RenderSpritesScene, true, true }
+	};
+
+	uint32_t RunRegressionTests(const RendererCapabilities& capabilities, const RegressionOptions& options)
+	{
+		// Goldens from another device may need a looser tolerance, the golden directory can carry its own.
+		ImageTolerance tolerance = options.tolerance;
+		std::string tolerancePath = options.goldenDirectory + "/tolerance.txt";
+		if (std::ifstream(tolerancePath) && !ReadImageTolerance(tolerancePath, &tolerance))
+			return 1;
+		printf("Tolerance: channel difference %u, %.3f%% of pixels\n", tolerance.channelDifference, tolerance.differingPixels * 100.0f);
+
+		Renderer renderer(capabilities);
+
+		uint32_t failures = 0, sceneCount = 0;
+		for (const RegressionScene& scene : s_Scenes)
+		{
+			if (scene.instancedOnly && renderer.GetBatchMode() != QuadBatchMode::eInstanced)
+			{
+				printf("%-14s skipped, needs the instanced batch mode\n", scene.name);
+				continue;
+			}
+			if (scene.texturedOnly && !renderer.HasSpriteTextures())
+			{
+				printf("%-14s skipped, needs non-uniform texture indexing\n", scene.name);
+				continue;
+			}
+			sceneCount++;
+
+			scene.render(renderer);
+			FrameReadback readback;
+			bool readBack = renderer.TakeReadback(&readback, true);
+			CEE_ASSERT_WITH_MESSAGE(readBack, "Regression scene was not read back.");
+
+			std::string goldenPath = options.goldenDirectory + "/" + scene.name + ".ppm";
+			if (!options.updateGoldens && !std::ifstream(goldenPath))
+			{
+				printf("%-14s FAILED, no golden at %s, run with --update-goldens to create it\n", scene.name, goldenPath.c_str());
+				failures++;
+				continue;
+			}
+			if (options.updateGoldens)
+			{
+				if (WriteImageFile(goldenPath, readback.width, readback.height, readback.pixels.data()) != vk::Result::eSuccess)
+				{
+					failures++;
+					continue;
+				}
+				printf("%-14s golden written to %s\n", scene.name, goldenPath.c_str());
+				continue;
+			}
+
+			DecodedImage golden;
+			if (DecodeImageFile(goldenPath, &golden) != vk::Result::eSuccess)
+			{
+				failures++;
+				continue;
+			}
+			if (golden.levels[0].width != readback.width || golden.levels[0].height != readback.height)
+			{
+				printf("%-14s FAILED, golden is %ux%u but %ux%u was rendered\n", scene.name, golden.levels[0].width,
+					   golden.levels[0].height, readback.width, readback.height);
+				failures++;
+				continue;
+			}
+
+			std::vector<uint8_t> difference;
+			ImageComparison comparison = CompareImages(readback.pixels.data(), golden.texels.data(), readback.width, readback.height,
+													   tolerance, &difference);
+			printf("%-14s %s, %llu pixels differ, largest channel difference %u, mean %.3f\n", scene.name,
+				   comparison.matches ? "passed" : "FAILED", (unsigned long long)comparison.differingPixels,
+				   comparison.maxChannelDifference, comparison.meanDifference);
+			if (comparison.matches)
+				continue;
+
+			failures++;
+			std::string basePath = options.goldenDirectory + "/" + scene.name;
+			WriteImageFile(basePath + ".actual.ppm", readback.width, readback.height, readback.pixels.data());
+			WriteImageFile(basePath + ".diff.ppm", readback.width, readback.height, difference.data());
+		}
+
+		printf("Regression: %u of %u scenes failed\n", failures, sceneCount);
+		return failures;
+	}
+
+	uint32_t TestUploadBytes(RendererCapabilities capabilities)
+	{
+		TestResults results;
+		results.name = "Upload bytes";
+
+		capabilities.diffVertexStream = true;
+		capabilities.cullQuads = false;
+		Renderer renderer(capabilities);
+		const uint32_t framesInFlight = capabilities.framesInFlight;
+
+		// Half of the quads end on a page boundary for any stride that is a multiple of two bytes, so shrinking to
+		// them leaves no partly covered page.
+		const uint32_t quadCount = 4096, changedQuad = 1000;
+		const size_t pageSize = DirtyRangeTracker().GetPageSize();
+		std::mt19937 random(6);
+		std::vector<Quad> quads(quadCount);
+		for (Quad& quad : quads)
+		{
+			float x = Unit(random), y = Unit(random);
+			quad.translation = glm::vec2(x * 1.8f - 0.9f, y * 1.8f - 0.9f);
+			quad.scale = glm::vec2(0.02f);
+			quad.rotation = Unit(random) * 6.2831853f;
+			quad.color = RandomColor(random);
+		}
+
+		QuadLayer* layer = renderer.CreateQuadLayer(quadCount);
+		Camera camera;
+		auto renderFrame = [&](uint32_t drawnQuads, uint32_t layerQuads) {
+			layer->SetQuads(quads.data(), layerQuads);
+			renderer.BeginScene(camera);
+			renderer.DrawQuads(quads.data(), drawnQuads);
+			renderer.DrawQuadLayer(*layer);
+			renderer.EndScene();
+			return renderer.GetStatistics();
+		};
+
+		// Every frame in flight streams into vertex buffers of its own, each uploads the whole batch once.
+		RendererStatistics statistics = renderFrame(quadCount, quadCount);
+		const size_t batchBytes = statistics.vertexUploadBytes;
+		CEE_CHECK(batchBytes > 0 && statistics.vertexSkippedBytes == 0);
+		CEE_CHECK(statistics.layerUploadBytes == quadCount * sizeof(QuadInstance));
+		CEE_CHECK(statistics.layerQuads == quadCount);
+		for (uint32_t frame = 1; frame < framesInFlight; frame++)
+		{
+			statistics = renderFrame(quadCount, quadCount);
+			CEE_CHECK(statistics.vertexUploadBytes == batchBytes && statistics.vertexSkippedBytes == 0);
+			CEE_CHECK(statistics.layerUploadBytes == 0);
+		}
+
+		// Unchanged, nothing is uploaded.
+		for (uint32_t frame = 0; frame < framesInFlight; frame++)
+		{
+			statistics = renderFrame(quadCount, quadCount);
+			CEE_CHECK(statistics.vertexUploadBytes == 0 && statistics.vertexSkippedBytes == batchBytes);
+			CEE_CHECK(statistics.layerUploadBytes == 0);
+			CEE_CHECK(statistics.layerQuads == quadCount);
+		}
+
+		// One quad changed, the pages holding it are uploaded once per vertex buffer and once for the layer.
+		quads[changedQuad].color = glm::vec4(1.0f) - quads[changedQuad].color;
+		size_t changedBegin = changedQuad * sizeof(QuadInstance), changedEnd = changedBegin + sizeof(QuadInstance);
+		size_t changedLayerBytes = ((changedEnd - 1) / pageSize - changedBegin / pageSize + 1) * pageSize;
+		for (uint32_t frame = 0; frame < framesInFlight; frame++)
+		{
+			statistics = renderFrame(quadCount, quadCount);
+			CEE_CHECK(statistics.vertexUploadBytes > 0 && statistics.vertexUploadBytes <= 2 * pageSize);
+			CEE_CHECK(statistics.vertexUploadBytes + statistics.vertexSkippedBytes == batchBytes);
+			CEE_CHECK(statistics.layerUploadBytes == (frame == 0 ? changedLayerBytes : 0));
+		}
+		statistics = renderFrame(quadCount, quadCount);
+		CEE_CHECK(statistics.vertexUploadBytes == 0 && statistics.layerUploadBytes == 0);
+
+		// Shrunk to a prefix of what was uploaded, nothing is uploaded and only the remaining quads are drawn.
+		for (uint32_t frame = 0; frame < framesInFlight; frame++)
+		{
+			statistics = renderFrame(quadCount / 2, quadCount / 2);
+			CEE_CHECK(statistics.vertexUploadBytes == 0 && statistics.vertexSkippedBytes == batchBytes / 2);
+			CEE_CHECK(statistics.layerUploadBytes == 0);
+			CEE_CHECK(statistics.layerQuads == quadCount / 2);
+		}
+		statistics = renderFrame(quadCount / 2, 0);
+		CEE_CHECK(statistics.layerUploadBytes == 0 && statistics.layerQuads == 0);
+
+		renderer.DestroyQuadLayer(layer);
+		return ReportTests(results);
+	}
+}
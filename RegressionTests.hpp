@@ -0,0 +1,30 @@
+#ifndef _REGRESSION_TESTS_HPP
+#define _REGRESSION_TESTS_HPP
+
+#include "Renderer.hpp"
+#include "ImageCompare.hpp"
+
+namespace CEE
+{
+	typedef struct RegressionOptions {
+		// Holds <scene>.ppm golden images and optionally a tolerance.txt overriding tolerance, see ReadImageTolerance.
+		// Failed scenes leave <scene>.actual.ppm and <scene>.diff.ppm next to them.
+		std::string goldenDirectory;
+		// Writes every rendered image as the new golden instead of comparing. Without it a missing golden fails its
+		// scene, so a typo in the directory cannot pass by writing fresh goldens.
+		bool updateGoldens = false;
+		ImageTolerance tolerance;
+	} RegressionOptions;
+
+	// Renders each reference scene with a headless renderer of the given capabilities, reads it back and compares it
+	// with its golden image. The scenes cover every drawing path, so refactoring one of them shows up as a mismatch.
+	// Returns the number of scenes that did not match.
+	uint32_t RunRegressionTests(const RendererCapabilities& capabilities, const RegressionOptions& options);
+
+	// Checks the bytes the renderer reports uploading for immediate quads and a quad layer while the scene stays the
+	// same, one quad changes and the quad count shrinks. Runs with vertex stream diffing and without culling,
+	// whatever the capabilities say. Returns the number of failed checks.
+	uint32_t TestUploadBytes(RendererCapabilities capabilities);
+}
+
+#endif
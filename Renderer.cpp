@@ -1,18 +1,30 @@
 #include "pch.h"
 #include "Renderer.hpp"
+#include "QuadBucket.hpp"
+#include "QuadLayer.hpp"
 
 #include <vulkan/vulkan.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <fstream>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <filesystem>
+#include <thread>
 
 namespace CEE
 {
 	
-	constexpr Vertex g_QuadVertices[] = {
-		{ { -0.5f,  0.5f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, -1.0f } },
-		{ {  0.5f,  0.5f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, -1.0f } },
-		{ {  0.5f, -0.5f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, -1.0f } },
-		{ { -0.5f, -0.5f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, -1.0f } }
+	constexpr glm::vec2 g_QuadCorners[] = {
+		{ -0.5f,  0.5f },
+		{  0.5f,  0.5f },
+		{  0.5f, -0.5f },
+		{ -0.5f, -0.5f }
 	};
+	constexpr glm::vec3 g_QuadNormal = { 0.0f, 0.0f, -1.0f };
+
+	// Quads handed to the transform kernel at a time.
+	constexpr uint32_t g_QuadTransformChunkSize = 1024;
 
 #if defined(CEE_OS_WINDOWS)
 	HINSTANCE Renderer::s_Connection = NULL;
@@ -37,17 +49,33 @@ namespace CEE
 	}
 #endif
 
+	Renderer::Renderer(RendererCapabilities capabilities)
+		: m_Capabilities(capabilities)
+	{
+		m_Headless = true;
+		InitalizeRenderer();
+	}
+
 	void Renderer::InitalizeRenderer()
 	{
+		CEE_ASSERT_WITH_MESSAGE(m_Capabilities.framesInFlight > 0, "At least one frame in flight is required.");
 		m_PolygonMode = vk::PolygonMode::eFill;
+		m_Frames.reset(new FrameResources[m_Capabilities.framesInFlight]);
+		m_ThreadPool = std::make_unique<ThreadPool>();
 		
 		InitalizeInstance();
-		InitalizeSurface();
+		if (!m_Headless)
+			InitalizeSurface();
 		InitalizeDevice();
 		InitalizeCommandBuffer();
-		InitalizeSwapchain();
+		InitalizeUploadManager();
+		if (m_Headless)
+			InitalizeOffscreenTargets();
+		else
+			InitalizeSwapchain();
 		InitalizeDepthBuffer();
 		InitalizeUniformBuffer();
+		InitalizeTextures();
 		InitalizePipelineLayout();
 		InitalizeDescriptorSet();
 		InitalizeRenderPass();
@@ -55,47 +83,83 @@ namespace CEE
 		InitalizeFramebuffers();
 		InitalizeVertexBuffer();
 		InitalizeIndexBuffer();
+		InitalizePipelineCache();
 		InitalizePipeline();
 		InitalizeSyncronisation();
+		InitalizeGpuProfiler();
+		InitalizeLatencyQueries();
 		memset(&m_Statistics, 0, sizeof(RendererStatistics));
+		memset(&m_LastFrameStatistics, 0, sizeof(RendererStatistics));
+		m_LastBeginSceneTime = std::chrono::steady_clock::now();
 		m_Prepared = true;
 	}
 
 	Renderer::~Renderer()
 	{
-		m_Device.unmapMemory(m_MvpBuffer.deviceMemory);
-		m_Device.destroySemaphore(m_ImageAcquiredSemaphore, nullptr);
-		m_Device.destroyFence(m_Fence, nullptr);
+		WaitIdle();
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+		{
+			m_Device.destroySemaphore(m_Frames[i].imageAcquiredSemaphore, nullptr);
+			m_Device.destroyFence(m_Frames[i].fence, nullptr);
+		}
+		m_QuadLayers.clear();
+		m_GpuProfiler.reset(nullptr);
+		if (m_LatencyQueryPool)
+			m_Device.destroyQueryPool(m_LatencyQueryPool, nullptr);
+		m_TextureLoader.reset(nullptr);
+		for (Texture& texture : m_Textures)
+			DestroyTextureResources(texture);
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+		{
+			for (Texture& texture : m_Frames[i].retiredTextures)
+				DestroyTextureResources(texture);
+		}
+		m_Device.destroySampler(m_TextureSampler, nullptr);
+		if (m_InstancedPipeline != m_Pipeline)
+			m_Device.destroyPipeline(m_InstancedPipeline, nullptr);
 		m_Device.destroyPipeline(m_Pipeline, nullptr);
+		SavePipelineCache();
+		m_Device.destroyPipelineCache(m_PipelineCache, nullptr);
 		m_Device.destroyDescriptorPool(m_DescriptorPool, nullptr);
-		m_Shader.reset(nullptr);
+		m_Shader = nullptr;
+		m_InstancedShader = nullptr;
+		m_ShaderLibrary.reset(nullptr);
 		m_Device.destroyBuffer(m_IndexBuffer.buffer, nullptr);
-		m_Device.freeMemory(m_IndexBuffer.deviceMemory, nullptr);
-		m_Device.destroyBuffer(m_VertexBuffer.buffer, nullptr);
-		m_Device.freeMemory(m_VertexBuffer.deviceMemory, nullptr);
+		m_MemoryAllocator->Free(m_IndexBuffer.allocation);
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+		{
+			for (VertexBuffer& vertexBuffer : m_Frames[i].vertexBuffers)
+				DestroyVertexBuffer(vertexBuffer);
+			DestroyStagingBuffer(m_Frames[i].layerStaging);
+			DestroyStagingBuffer(m_Frames[i].textureStaging);
+			DestroyStagingBuffer(m_Frames[i].readback);
+		}
 		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
 			m_Device.destroyFramebuffer(m_Framebuffers[i], nullptr);
 		m_Device.destroyRenderPass(m_RenderPass, nullptr);
-		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
-			m_Device.destroyDescriptorSetLayout(m_DescriptorSetLayouts[i], nullptr);
+		m_Device.destroyDescriptorSetLayout(m_DescriptorSetLayouts[0], nullptr);
 		m_Device.destroyPipelineLayout(m_PipelineLayout, nullptr);
-		m_Device.destroyBuffer(m_MvpBuffer.buffer, nullptr);
-		m_Device.freeMemory(m_MvpBuffer.deviceMemory, nullptr);
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+		{
+			m_Device.destroyBuffer(m_Frames[i].mvpBuffer.buffer, nullptr);
+			m_MemoryAllocator->Free(m_Frames[i].mvpBuffer.allocation);
+		}
 		m_Device.destroyImageView(m_DepthBuffer.view, nullptr);
 		m_Device.destroyImage(m_DepthBuffer.image, nullptr);
-		m_Device.freeMemory(m_DepthBuffer.memory, nullptr);
-		vk::CommandBuffer commandBuffers[] =
-		{
-			m_CommandBuffer
-		};
-		m_Device.freeCommandBuffers(m_CommandPool, sizeof(commandBuffers) / sizeof(commandBuffers[0]), commandBuffers);
-		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
-			m_Device.destroyImageView(m_SwapchainResources[i].view, nullptr);
-		m_Device.destroySwapchainKHR(m_Swapchain, nullptr);
+		m_MemoryAllocator->Free(m_DepthBuffer.allocation);
+		std::unique_ptr<vk::CommandBuffer[]> commandBuffers(new vk::CommandBuffer[m_Capabilities.framesInFlight]);
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+			commandBuffers[i] = m_Frames[i].commandBuffer;
+		m_Device.freeCommandBuffers(m_CommandPool, m_Capabilities.framesInFlight, commandBuffers.get());
+		DestroySwapchainResources();
+		if (!m_Headless)
+			m_Device.destroySwapchainKHR(m_Swapchain, nullptr);
 		m_Device.destroyCommandPool(m_CommandPool, nullptr);
-		m_Device.waitIdle();
+		m_UploadManager.reset(nullptr);
+		m_MemoryAllocator.reset(nullptr);
 		m_Device.destroy(nullptr);
-		m_Instance.destroySurfaceKHR(m_Surface, nullptr);
+		if (!m_Headless)
+			m_Instance.destroySurfaceKHR(m_Surface, nullptr);
 		m_Instance.destroy();
 	}
 	
@@ -153,7 +217,8 @@ namespace CEE
 		auto result = vk::enumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, static_cast<vk::ExtensionProperties*>(nullptr));
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to enumerate instance extension properties");
 
-		if (instanceExtensionCount > 0)
+		// Headless renderers present nothing and run on drivers without any window system integration.
+		if (instanceExtensionCount > 0 && !m_Headless)
 		{
 			std::unique_ptr<vk::ExtensionProperties[]> extenstionProperties(new vk::ExtensionProperties[instanceExtensionCount]);
 			result = vk::enumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, extenstionProperties.get());
@@ -183,7 +248,7 @@ namespace CEE
 			}
 		}
 
-		CEE_ASSERT(surfaceExtFound && platformExtFound);
+		CEE_ASSERT(m_Headless || (surfaceExtFound && platformExtFound));
 
 		auto const appInfo = vk::ApplicationInfo()
 			.setApiVersion(VK_MAKE_API_VERSION(0, 1, 2, 0))
@@ -279,16 +344,25 @@ namespace CEE
 
 			for (uint32_t i = 0; i < deviceExtensionCount; i++)
 			{
-				if (!strcmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, deviceExtensions[i].extensionName))
+				if (!m_Headless && !strcmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, deviceExtensions[i].extensionName))
 				{
 					swapchainExtensionFound = VK_TRUE;
 					m_EnabledExtensionNames.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 				}
+				// Core since Vulkan 1.2.
+				if (m_PhysicalDeviceProperties.apiVersion < VK_API_VERSION_1_2 &&
+					!strcmp(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, deviceExtensions[i].extensionName))
+					m_EnabledExtensionNames.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+				if (!strcmp(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME, deviceExtensions[i].extensionName))
+				{
+					m_CalibratedTimestamps = true;
+					m_EnabledExtensionNames.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+				}
 			}
 			CEE_ASSERT(m_EnabledExtensionNames.size() < 64);
 		}
 
-		CEE_ASSERT(swapchainExtensionFound == VK_TRUE);
+		CEE_ASSERT(m_Headless || swapchainExtensionFound == VK_TRUE);
 
 		auto deviceQueueCreateInfo = vk::DeviceQueueCreateInfo();
 		m_PhysicalDevice.getQueueFamilyProperties(&m_QueueFamilyCount, static_cast<vk::QueueFamilyProperties*>(nullptr));
@@ -301,6 +375,10 @@ namespace CEE
 		std::unique_ptr<vk::Bool32[]> supportsPresent(new vk::Bool32[m_QueueFamilyCount]);
 		for (uint32_t i = 0; i < m_QueueFamilyCount; i++)
 		{
+			supportsPresent[i] = VK_FALSE;
+			if (m_Headless)
+				continue;
+
 			result = m_PhysicalDevice.getSurfaceSupportKHR(i, m_Surface, &supportsPresent[i]);
 			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to get surface supports present");
 		}
@@ -320,9 +398,12 @@ namespace CEE
 				}
 			}
 		}
+		// Nothing is presented, the graphics queue stands in so no present queue is created.
+		if (m_Headless)
+			m_PresentQueueFamilyIndex = m_GraphicsQueueFamilyIndex;
 		if (m_PresentQueueFamilyIndex == UINT32_MAX)
 		{
-			for (uint32_t i = 0; i < m_GraphicsQueueFamilyIndex; i++)
+			for (uint32_t i = 0; i < m_QueueFamilyCount; i++)
 			{
 				if (supportsPresent[i] == VK_TRUE)
 				{
@@ -341,29 +422,73 @@ namespace CEE
 			exit(-1);
 		}
 
+		// Uploads prefer a transfer only family, which maps to the copy engines on discrete GPUs, then any other
+		// non-graphics family. Compute families support transfers even when they do not report it.
+		for (uint32_t i = 0; i < m_QueueFamilyCount && m_TransferQueueFamilyIndex == UINT32_MAX; i++)
+		{
+			vk::QueueFlags flags = m_QueueFamilyProperties[i].queueFlags;
+			if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+				m_TransferQueueFamilyIndex = i;
+		}
+		for (uint32_t i = 0; i < m_QueueFamilyCount && m_TransferQueueFamilyIndex == UINT32_MAX; i++)
+		{
+			vk::QueueFlags flags = m_QueueFamilyProperties[i].queueFlags;
+			if ((flags & (vk::QueueFlagBits::eTransfer | vk::QueueFlagBits::eCompute)) && !(flags & vk::QueueFlagBits::eGraphics))
+				m_TransferQueueFamilyIndex = i;
+		}
+		// The present queue is used from the render thread only, it can not double as the upload queue.
+		if (m_TransferQueueFamilyIndex != UINT32_MAX && !(m_SeperatePresentQueue && m_TransferQueueFamilyIndex == m_PresentQueueFamilyIndex))
+			m_SeperateTransferQueue = true;
+		else
+			m_TransferQueueFamilyIndex = m_GraphicsQueueFamilyIndex;
+		if (m_Capabilities.printStatistics)
+			printf("Uploads run on queue family %u%s\n", m_TransferQueueFamilyIndex, m_SeperateTransferQueue ? " (dedicated transfer queue)" : " (graphics queue)");
+
 		float const priorities[] = { 1.0f };
-		const vk::DeviceQueueCreateInfo deviceQueueCreateInfos[] = {
-			vk::DeviceQueueCreateInfo()
+		std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos;
+		deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo()
+			.setPQueuePriorities(priorities)
+			.setQueueCount(1)
+			.setQueueFamilyIndex(m_GraphicsQueueFamilyIndex));
+		if (m_SeperatePresentQueue)
+		{
+			deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo()
 				.setPQueuePriorities(priorities)
 				.setQueueCount(1)
-				.setQueueFamilyIndex(m_GraphicsQueueFamilyIndex),
-			vk::DeviceQueueCreateInfo()
+				.setQueueFamilyIndex(m_PresentQueueFamilyIndex));
+		}
+		if (m_SeperateTransferQueue)
+		{
+			deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo()
 				.setPQueuePriorities(priorities)
 				.setQueueCount(1)
-				.setQueueFamilyIndex(m_PresentQueueFamilyIndex)
-		};
+				.setQueueFamilyIndex(m_TransferQueueFamilyIndex));
+		}
+		// Sprites of one batch sample different textures, the fragment shader's index into the texture array is not
+		// dynamically uniform. Without the feature every quad samples the white texture of slot 0.
+		auto supportedDescriptorIndexingFeatures = vk::PhysicalDeviceDescriptorIndexingFeatures();
+		auto supportedFeatures = vk::PhysicalDeviceFeatures2().setPNext(&supportedDescriptorIndexingFeatures);
+		m_PhysicalDevice.getFeatures2(&supportedFeatures);
+		m_NonUniformTextureIndexing = supportedDescriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing;
+		if (!m_NonUniformTextureIndexing)
+			fprintf(stderr, "Non-uniform indexing of sampled image arrays not supported, drawing sprites untextured.\n");
+		auto const descriptorIndexingFeatures = vk::PhysicalDeviceDescriptorIndexingFeatures()
+			.setShaderSampledImageArrayNonUniformIndexing(VK_TRUE);
+
 		auto deviceCreateInfo = vk::DeviceCreateInfo()
-			.setPQueueCreateInfos(deviceQueueCreateInfos)
+			.setPNext(m_NonUniformTextureIndexing ? &descriptorIndexingFeatures : nullptr)
+			.setQueueCreateInfoCount((uint32_t)deviceQueueCreateInfos.size())
+			.setPQueueCreateInfos(deviceQueueCreateInfos.data())
 			.setEnabledExtensionCount(static_cast<uint32_t>(m_EnabledExtensionNames.size()))
 			.setPpEnabledExtensionNames(m_EnabledExtensionNames.data())
 			.setEnabledLayerCount(0)
 			.setPpEnabledLayerNames(nullptr)
 			.setPEnabledFeatures(nullptr);
-		if (m_SeperatePresentQueue) deviceCreateInfo.setQueueCreateInfoCount(2);
-		else deviceCreateInfo.setQueueCreateInfoCount(1);
-		
+
 		result = m_PhysicalDevice.createDevice(&deviceCreateInfo, nullptr, &m_Device);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create device.");
+
+		m_MemoryAllocator = std::make_unique<MemoryAllocator>(m_PhysicalDevice, m_Device);
 	}
 	
 	void Renderer::InitalizeCommandBuffer()
@@ -378,17 +503,23 @@ namespace CEE
 			.setCommandBufferCount(1)
 			.setCommandPool(m_CommandPool);
 
-		result = m_Device.allocateCommandBuffers(&commandBufferAllocateInfo, &m_CommandBuffer);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate command buffer.");
-
-		auto const beginInfo = vk::CommandBufferBeginInfo()
-			.setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse).setPInheritanceInfo(nullptr);
-		result = m_CommandBuffer.begin(&beginInfo);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to start recording command buffer.");
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+		{
+			result = m_Device.allocateCommandBuffers(&commandBufferAllocateInfo, &m_Frames[i].commandBuffer);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate command buffer.");
+		}
 
 		m_Device.getQueue(m_GraphicsQueueFamilyIndex, 0, &m_GraphicsQueue);
 		if (m_SeperatePresentQueue) m_Device.getQueue(m_PresentQueueFamilyIndex, 0, &m_PresentQueue);
 		else m_PresentQueue = m_GraphicsQueue;
+		if (m_SeperateTransferQueue) m_Device.getQueue(m_TransferQueueFamilyIndex, 0, &m_TransferQueue);
+		else m_TransferQueue = m_GraphicsQueue;
+	}
+
+	void Renderer::InitalizeUploadManager()
+	{
+		m_UploadManager = std::make_unique<UploadManager>(m_Device, m_MemoryAllocator.get(), m_TransferQueueFamilyIndex, m_TransferQueue,
+														  &m_QueueMutex, m_GraphicsQueueFamilyIndex);
 	}
 	
 	void Renderer::InitalizeSwapchain()
@@ -441,8 +572,17 @@ namespace CEE
 			swapchainExtent = surfaceCapabilities.currentExtent;
 		m_SwapchainExtent = swapchainExtent;
 
-		vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+		vk::PresentModeKHR presentMode = SelectPresentMode(presentModes.get(), presentModeCount);
+		if (m_Capabilities.printStatistics && (presentMode != m_PresentMode || !m_Swapchain))
+			printf("Present mode: %s\n", vk::to_string(presentMode).c_str());
+		m_PresentMode = presentMode;
+
 		uint32_t desiredNumberOfSwapchainImages = surfaceCapabilities.minImageCount;
+		if (m_Capabilities.swapchainImageCount > desiredNumberOfSwapchainImages)
+			desiredNumberOfSwapchainImages = m_Capabilities.swapchainImageCount;
+		// A maxImageCount of zero means there is no upper limit.
+		if (surfaceCapabilities.maxImageCount > 0 && desiredNumberOfSwapchainImages > surfaceCapabilities.maxImageCount)
+			desiredNumberOfSwapchainImages = surfaceCapabilities.maxImageCount;
 
 		vk::SurfaceTransformFlagBitsKHR preTransform;
 		if (surfaceCapabilities.supportedTransforms & vk::SurfaceTransformFlagBitsKHR::eIdentity)
@@ -470,6 +610,12 @@ namespace CEE
 			}
 		}
 
+		// Needed for readbacks only, which are refused where the surface does not allow it.
+		vk::ImageUsageFlags imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+		m_ColorImagesReadable = (bool)(surfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc);
+		if (m_ColorImagesReadable)
+			imageUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+
 		auto swapchainCreateInfo = vk::SwapchainCreateInfoKHR()
 			.setSurface(m_Surface)
 			.setMinImageCount(desiredNumberOfSwapchainImages)
@@ -482,7 +628,7 @@ namespace CEE
 			.setOldSwapchain(nullptr)
 			.setClipped(true)
 			.setImageColorSpace(vk::ColorSpaceKHR::eSrgbNonlinear)
-			.setImageUsage(vk::ImageUsageFlagBits::eColorAttachment)
+			.setImageUsage(imageUsage)
 			.setImageSharingMode(vk::SharingMode::eExclusive)
 			.setQueueFamilyIndexCount(0)
 			.setPQueueFamilyIndices(nullptr);
@@ -504,10 +650,16 @@ namespace CEE
 		result = m_Device.getSwapchainImagesKHR(m_Swapchain, &m_SwapchainImageCount, swapchainImages.get());
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to get swapchain images.");
 
+		auto const semaphoreCreateInfo = vk::SemaphoreCreateInfo()
+			.setFlags({});
+
 		m_SwapchainResources.reset(new SwapchainResources[m_SwapchainImageCount]);
 		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
 		{
 			m_SwapchainResources[i].image = swapchainImages[i];
+
+			result = m_Device.createSemaphore(&semaphoreCreateInfo, nullptr, &m_SwapchainResources[i].renderFinishedSemaphore);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create render finished semaphore.");
 		}
 		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
 		{
@@ -522,6 +674,104 @@ namespace CEE
 			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create swapchain image view.");
 		}
 		m_CurrentBuffer = 0;
+		m_SwapchainOutOfDate = false;
+	}
+
+	vk::PresentModeKHR Renderer::SelectPresentMode(const vk::PresentModeKHR* presentModes, uint32_t presentModeCount) const
+	{
+		// Fallbacks are ordered by latency, FIFO is always supported so it terminates every chain.
+		std::vector<vk::PresentModeKHR> candidates;
+		switch (m_Capabilities.presentMode)
+		{
+			case vk::PresentModeKHR::eMailbox:
+				candidates = { vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate };
+				break;
+			case vk::PresentModeKHR::eImmediate:
+				candidates = { vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox };
+				break;
+			case vk::PresentModeKHR::eFifoRelaxed:
+				candidates = { vk::PresentModeKHR::eFifoRelaxed };
+				break;
+			default:
+				break;
+		}
+
+		for (vk::PresentModeKHR candidate : candidates)
+		{
+			for (uint32_t i = 0; i < presentModeCount; i++)
+			{
+				if (presentModes[i] == candidate)
+					return candidate;
+			}
+		}
+		if (m_Capabilities.presentMode != vk::PresentModeKHR::eFifo)
+			fprintf(stderr, "Present mode %s not supported, falling back to FIFO.\n", vk::to_string(m_Capabilities.presentMode).c_str());
+		return vk::PresentModeKHR::eFifo;
+	}
+
+	void Renderer::InitalizeOffscreenTargets()
+	{
+		// Laid out like the readback, the swapchain's surface format is not known without a surface anyway.
+		m_Format = vk::Format::eR8G8B8A8Unorm;
+		m_SwapchainExtent = m_Capabilities.offscreenExtent;
+		CEE_ASSERT_WITH_MESSAGE(m_SwapchainExtent.width > 0 && m_SwapchainExtent.height > 0, "Offscreen images need a size.");
+
+		// One image per frame in flight, so frames never wait for each other's image.
+		m_SwapchainImageCount = m_Capabilities.framesInFlight;
+		m_SwapchainResources.reset(new SwapchainResources[m_SwapchainImageCount]);
+		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
+		{
+			SwapchainResources& resources = m_SwapchainResources[i];
+
+			auto const imageCreateInfo = vk::ImageCreateInfo()
+				.setImageType(vk::ImageType::e2D)
+				.setFormat(m_Format)
+				.setExtent(vk::Extent3D(m_SwapchainExtent.width, m_SwapchainExtent.height, 1))
+				.setMipLevels(1)
+				.setArrayLayers(1)
+				.setSamples(vk::SampleCountFlagBits::e1)
+				.setTiling(vk::ImageTiling::eOptimal)
+				.setInitialLayout(vk::ImageLayout::eUndefined)
+				.setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc)
+				.setQueueFamilyIndexCount(0)
+				.setPQueueFamilyIndices(nullptr)
+				.setSharingMode(vk::SharingMode::eExclusive);
+
+			auto result = m_Device.createImage(&imageCreateInfo, nullptr, &resources.image);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create offscreen image.");
+
+			result = m_MemoryAllocator->AllocateForImage(resources.image, vk::ImageTiling::eOptimal, vk::MemoryPropertyFlagBits::eDeviceLocal, &resources.allocation);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate memory for offscreen image.");
+
+			auto const imageViewCreateInfo = vk::ImageViewCreateInfo()
+				.setImage(resources.image)
+				.setViewType(vk::ImageViewType::e2D)
+				.setFormat(m_Format)
+				.setComponents(vk::ComponentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA))
+				.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+			result = m_Device.createImageView(&imageViewCreateInfo, nullptr, &resources.view);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create offscreen image view.");
+		}
+		if (m_Capabilities.printStatistics)
+			printf("Rendering offscreen at %ux%u\n", m_SwapchainExtent.width, m_SwapchainExtent.height);
+		m_CurrentBuffer = 0;
+		m_ColorImagesReadable = true;
+	}
+
+	void Renderer::DestroySwapchainResources()
+	{
+		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
+		{
+			m_Device.destroyImageView(m_SwapchainResources[i].view, nullptr);
+			m_Device.destroySemaphore(m_SwapchainResources[i].renderFinishedSemaphore, nullptr);
+			// Swapchain images belong to the swapchain.
+			if (m_Headless)
+			{
+				m_Device.destroyImage(m_SwapchainResources[i].image, nullptr);
+				m_MemoryAllocator->Free(m_SwapchainResources[i].allocation);
+			}
+		}
 	}
 	
 	void Renderer::InitalizeDepthBuffer()
@@ -556,22 +806,9 @@ namespace CEE
 		auto result = m_Device.createImage(&imageCreateInfo, nullptr, &m_DepthBuffer.image);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create depth buffer image.");
 
-		vk::MemoryRequirements memoryRequirements;
-		m_Device.getImageMemoryRequirements(m_DepthBuffer.image, &memoryRequirements);
-
-		uint32_t memoryTypeIndex;
-		bool pass = GetMemoryTypeFromProperties(memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal, &memoryTypeIndex);
-		CEE_ASSERT_WITH_MESSAGE(pass, "Required memory type for depth buffer not supported.");
-
-		auto const memoryAllocateInfo = vk::MemoryAllocateInfo()
-			.setAllocationSize(memoryRequirements.size)
-			.setMemoryTypeIndex(memoryTypeIndex);
-
-		result = m_Device.allocateMemory(&memoryAllocateInfo, nullptr, &m_DepthBuffer.memory);
+		result = m_MemoryAllocator->AllocateForImage(m_DepthBuffer.image, tiling, vk::MemoryPropertyFlagBits::eDeviceLocal, &m_DepthBuffer.allocation);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess , "Unable to allocate memory for depth buffer.");
 
-		m_Device.bindImageMemory(m_DepthBuffer.image, m_DepthBuffer.memory, 0);
-
 		auto const imageViewCreateInfo = vk::ImageViewCreateInfo()
 			.setImage(m_DepthBuffer.image)
 			.setFormat(m_DepthBuffer.format)
@@ -593,40 +830,31 @@ namespace CEE
 			m_View = glm::identity<glm::mat4>();
 			m_Projection = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f);
 
-			glm::mat4 mvp = m_Model * m_View * m_Projection;
-
-			auto const unifromBufferCreateInfo = vk::BufferCreateInfo()
-				.setPQueueFamilyIndices(nullptr)
-				.setQueueFamilyIndexCount(0)
-				.setSharingMode(vk::SharingMode::eExclusive)
-				.setSize(sizeof(glm::mat4))
-				.setUsage(vk::BufferUsageFlagBits::eUniformBuffer);
-
-			auto result = m_Device.createBuffer(&unifromBufferCreateInfo, nullptr, &m_MvpBuffer.buffer);
-			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create MVP uniform buffer.");
-
-			m_Device.getBufferMemoryRequirements(m_MvpBuffer.buffer, &m_MvpBuffer.memoryRequirements);
+			glm::mat4 mvp = m_Projection * m_View * m_Model;
 
-			vk::MemoryPropertyFlags typeBits = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-			uint32_t typeIndex;
-			bool pass = GetMemoryTypeFromProperties(m_MvpBuffer.memoryRequirements.memoryTypeBits, typeBits, &typeIndex);
-			CEE_ASSERT_WITH_MESSAGE(pass, "Required memory type for MVP uniform buffer not supported.");
-
-			auto const memoryAllocateInfo = vk::MemoryAllocateInfo()
-				.setAllocationSize(m_MvpBuffer.memoryRequirements.size)
-				.setMemoryTypeIndex(typeIndex);
-
-			result = m_Device.allocateMemory(&memoryAllocateInfo, nullptr, &m_MvpBuffer.deviceMemory);
-			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "failed to allocate memory for MVP uniform buffer.");
+			// One buffer per frame in flight so writing the next frame's matrix never races the GPU.
+			for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+			{
+				UniformBuffer& mvpBuffer = m_Frames[i].mvpBuffer;
+				auto const unifromBufferCreateInfo = vk::BufferCreateInfo()
+					.setPQueueFamilyIndices(nullptr)
+					.setQueueFamilyIndexCount(0)
+					.setSharingMode(vk::SharingMode::eExclusive)
+					.setSize(sizeof(glm::mat4))
+					.setUsage(vk::BufferUsageFlagBits::eUniformBuffer);
 
-			result = m_Device.mapMemory(m_MvpBuffer.deviceMemory, 0, m_MvpBuffer.memoryRequirements.size, vk::MemoryMapFlags(), reinterpret_cast<void**>(&m_MvpBuffer.cpuMemoryPtr));
-			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to map memory for MVP uniform buffer.");
+				auto result = m_Device.createBuffer(&unifromBufferCreateInfo, nullptr, &mvpBuffer.buffer);
+				CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create MVP uniform buffer.");
 
-			memcpy(m_MvpBuffer.cpuMemoryPtr, &mvp, sizeof(mvp));
+				vk::MemoryPropertyFlags typeBits = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+				result = m_MemoryAllocator->AllocateForBuffer(mvpBuffer.buffer, typeBits, &mvpBuffer.allocation);
+				CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "failed to allocate memory for MVP uniform buffer.");
 
-			m_Device.bindBufferMemory(m_MvpBuffer.buffer, m_MvpBuffer.deviceMemory, 0);
+				mvpBuffer.cpuMemoryPtr = mvpBuffer.allocation.mappedPtr;
+				memcpy(mvpBuffer.cpuMemoryPtr, &mvp, sizeof(mvp));
 
-			m_MvpBuffer.bufferInfo.setBuffer(m_MvpBuffer.buffer).setOffset(0).setRange(sizeof(mvp));
+				mvpBuffer.bufferInfo.setBuffer(mvpBuffer.buffer).setOffset(0).setRange(sizeof(mvp));
+			}
 		}
 		// Lighting uniform buffer.
 		{
@@ -634,6 +862,62 @@ namespace CEE
 		}
 	}
 	
+	void Renderer::InitalizeTextures()
+	{
+		const vk::PhysicalDeviceLimits& limits = m_PhysicalDeviceProperties.limits;
+		m_MaxTextures = std::min({ m_Capabilities.maxTextures, limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages,
+								   limits.maxDescriptorSetSamplers, limits.maxDescriptorSetSampledImages });
+		CEE_ASSERT_WITH_MESSAGE(m_MaxTextures > 0, "Renderer capabilities must allow at least one texture.");
+		if (m_MaxTextures < m_Capabilities.maxTextures)
+			fprintf(stderr, "%u textures requested, the device allows %u.\n", m_Capabilities.maxTextures, m_MaxTextures);
+
+		// Atlases keep their sprites apart by padding, clamping only matters at the atlas edges.
+		auto const samplerCreateInfo = vk::SamplerCreateInfo()
+			.setMagFilter(vk::Filter::eLinear)
+			.setMinFilter(vk::Filter::eLinear)
+			.setMipmapMode(vk::SamplerMipmapMode::eLinear)
+			.setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+			.setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+			.setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+			.setMipLodBias(0.0f)
+			.setAnisotropyEnable(VK_FALSE)
+			.setMaxAnisotropy(1.0f)
+			.setCompareEnable(VK_FALSE)
+			.setCompareOp(vk::CompareOp::eNever)
+			.setMinLod(0.0f)
+			.setMaxLod(VK_LOD_CLAMP_NONE)
+			.setBorderColor(vk::BorderColor::eFloatOpaqueWhite)
+			.setUnnormalizedCoordinates(VK_FALSE);
+
+		auto result = m_Device.createSampler(&samplerCreateInfo, nullptr, &m_TextureSampler);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create texture sampler.");
+
+		// Handed out lowest slot first.
+		m_Textures.resize(m_MaxTextures);
+		m_TextureLoadRequests.resize(m_MaxTextures, 0);
+		for (uint32_t i = m_MaxTextures; i > 0; i--)
+			m_FreeTextures.push_back(i - 1);
+
+		const uint32_t white = 0xFFFFFFFF;
+		uint32_t whiteTexture = CreateTexture(1, 1, &white);
+		CEE_ASSERT(whiteTexture == 0);
+
+		// Shown by textures still loading, a checkerboard that is hard to mistake for content.
+		if (m_MaxTextures > 1)
+		{
+			uint32_t checker[8 * 8];
+			for (uint32_t y = 0; y < 8; y++)
+			{
+				for (uint32_t x = 0; x < 8; x++)
+					checker[y * 8 + x] = ((x / 4) ^ (y / 4)) ? 0xFFFF00FF : 0xFF000000;
+			}
+			uint32_t placeholderTexture = CreateTexture(8, 8, checker);
+			CEE_ASSERT(placeholderTexture == 1);
+		}
+
+		m_TextureLoader = std::make_unique<TextureLoader>(m_Device, m_MemoryAllocator.get(), m_UploadManager.get(), m_ThreadPool.get());
+	}
+
 	void Renderer::InitalizePipelineLayout()
 	{
 		const vk::DescriptorSetLayoutBinding layoutBindings[]
@@ -646,6 +930,10 @@ namespace CEE
 				.setBinding(1).setDescriptorType(vk::DescriptorType::eUniformBuffer)
 				.setDescriptorCount(1)
 				.setStageFlags(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment)
+				.setPImmutableSamplers(nullptr),
+			vk::DescriptorSetLayoutBinding()
+				.setBinding(2).setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+				.setDescriptorCount(m_MaxTextures).setStageFlags(vk::ShaderStageFlagBits::eFragment)
 				.setPImmutableSamplers(nullptr)
 		};
 
@@ -669,43 +957,53 @@ namespace CEE
 	
 	void Renderer::InitalizeDescriptorSet()
 	{
-		m_DescriptorSetCount = 1;
+		m_DescriptorSetCount = m_Capabilities.framesInFlight;
 
 		vk::DescriptorPoolSize typeCounts[] =
 		{
-			vk::DescriptorPoolSize().setDescriptorCount(2).setType(vk::DescriptorType::eUniformBuffer)
+			vk::DescriptorPoolSize().setDescriptorCount(2 * m_DescriptorSetCount).setType(vk::DescriptorType::eUniformBuffer),
+			vk::DescriptorPoolSize().setDescriptorCount(m_MaxTextures * m_DescriptorSetCount).setType(vk::DescriptorType::eCombinedImageSampler)
 		};
 		auto const descriptorPoolCreateInfo = vk::DescriptorPoolCreateInfo()
-			.setPoolSizeCount(1)
+			.setPoolSizeCount(sizeof(typeCounts) / sizeof(typeCounts[0]))
 			.setPPoolSizes(typeCounts)
 			.setMaxSets(m_DescriptorSetCount);
 
 		auto result = m_Device.createDescriptorPool(&descriptorPoolCreateInfo, nullptr, &m_DescriptorPool);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "failed to create descriptor pool.");
 
+		std::unique_ptr<vk::DescriptorSetLayout[]> setLayouts(new vk::DescriptorSetLayout[m_DescriptorSetCount]);
+		for (uint32_t i = 0; i < m_DescriptorSetCount; i++)
+			setLayouts[i] = m_DescriptorSetLayouts[0];
+
 		vk::DescriptorSetAllocateInfo const descriptorSetAllocateInfo[] =
 		{
 			vk::DescriptorSetAllocateInfo()
 				.setDescriptorPool(m_DescriptorPool)
 				.setDescriptorSetCount(m_DescriptorSetCount)
-				.setPSetLayouts(m_DescriptorSetLayouts.get())
+				.setPSetLayouts(setLayouts.get())
 		};
 
 		m_DescriptorSets.reset(new vk::DescriptorSet[m_DescriptorSetCount]);
 		result = m_Device.allocateDescriptorSets(descriptorSetAllocateInfo, m_DescriptorSets.get());
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "failed to allocate memory for descriptor sets.");
 
-		const vk::WriteDescriptorSet writeDescriptorSets[] =
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
 		{
-			vk::WriteDescriptorSet()
-			.setDstSet(m_DescriptorSets[0])
-			.setDescriptorCount(1)
-			.setDescriptorType(vk::DescriptorType::eUniformBuffer)
-			.setPBufferInfo(&m_MvpBuffer.bufferInfo)
-			.setDstArrayElement(0)
-			.setDstBinding(0)
-		};
-		m_Device.updateDescriptorSets((sizeof(writeDescriptorSets) / sizeof(writeDescriptorSets[0])), writeDescriptorSets, 0, nullptr);
+			m_Frames[i].descriptorSet = m_DescriptorSets[i];
+
+			const vk::WriteDescriptorSet writeDescriptorSets[] =
+			{
+				vk::WriteDescriptorSet()
+				.setDstSet(m_Frames[i].descriptorSet)
+				.setDescriptorCount(1)
+				.setDescriptorType(vk::DescriptorType::eUniformBuffer)
+				.setPBufferInfo(&m_Frames[i].mvpBuffer.bufferInfo)
+				.setDstArrayElement(0)
+				.setDstBinding(0)
+			};
+			m_Device.updateDescriptorSets((sizeof(writeDescriptorSets) / sizeof(writeDescriptorSets[0])), writeDescriptorSets, 0, nullptr);
+		}
 	}
 	
 	void Renderer::InitalizeRenderPass()
@@ -720,7 +1018,7 @@ namespace CEE
 				.setInitialLayout(vk::ImageLayout::eUndefined)
 				.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
 				.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
-				.setFinalLayout(vk::ImageLayout::ePresentSrcKHR),
+				.setFinalLayout(m_Headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR),
 			vk::AttachmentDescription()
 				.setFormat(m_DepthBuffer.format)
 				.setSamples(vk::SampleCountFlagBits::e1)
@@ -748,13 +1046,17 @@ namespace CEE
 			.setPreserveAttachmentCount(0)
 			.setPPreserveAttachments(nullptr);
 
+		// Every frame in flight shares the depth buffer, so the depth clear and writes of a frame have to wait for
+		// those of the frame submitted before it.
 		auto const subpassDependency = vk::SubpassDependency()
 			.setSrcSubpass(VK_SUBPASS_EXTERNAL)
 			.setDstSubpass(0)
-			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-			.setSrcAccessMask(vk::AccessFlags())
-			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite);
+			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests |
+							 vk::PipelineStageFlagBits::eLateFragmentTests)
+			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests |
+							 vk::PipelineStageFlagBits::eLateFragmentTests)
+			.setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite);
 
 		auto const RenderPassCreateInfo = vk::RenderPassCreateInfo()
 			.setAttachmentCount(sizeof(attachmentDescriptions) / sizeof(attachmentDescriptions[0]))
@@ -770,10 +1072,29 @@ namespace CEE
 	
 	void Renderer::InitalizeShaders()
 	{
-		m_Shader = std::make_unique<Shader>(&m_Device);
+		m_ShaderCache = std::make_unique<ShaderCache>("shader_cache");
+		m_ShaderLibrary = std::make_unique<ShaderLibrary>(&m_Device, m_ShaderCache.get(), m_ThreadPool.get());
+
+		// Quad layers are always drawn instanced, the per-vertex batch mode needs its own shader on top.
+		const char* fragmentShader = m_NonUniformTextureIndexing ? "../res/shaders/basic.frag" : "../res/shaders/untextured.frag";
+		m_ShaderLibrary->Add("quad_instanced", "../res/shaders/quad_instanced.vert", fragmentShader);
+		if (m_Capabilities.batchMode == QuadBatchMode::ePerVertex)
+			m_ShaderLibrary->Add("quad", "../res/shaders/basic.vert", fragmentShader);
 
-		auto result = m_Shader->CompileShadersFromFiles("../res/shaders/basic.vert", "../res/shaders/basic.frag");
+		auto result = m_ShaderLibrary->CompileAll();
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to compile shaders");
+		if (m_Capabilities.printStatistics)
+		{
+			for (const ShaderTiming& timing : m_ShaderLibrary->GetTimings())
+			{
+				printf("Shader %s: vertex %.3fms%s, fragment %.3fms%s\n", timing.name.c_str(),
+					   timing.vertexTime, timing.vertexCacheHit ? " (cached)" : "",
+					   timing.fragmentTime, timing.fragmentCacheHit ? " (cached)" : "");
+			}
+		}
+
+		m_InstancedShader = m_ShaderLibrary->Get("quad_instanced");
+		m_Shader = m_Capabilities.batchMode == QuadBatchMode::eInstanced ? m_InstancedShader : m_ShaderLibrary->Get("quad");
 	}
 	
 	void Renderer::InitalizeFramebuffers()
@@ -802,65 +1123,207 @@ namespace CEE
 	}
 	
 	void Renderer::InitalizeVertexBuffer()
+	{
+		m_BatchQuadCapacity = (uint32_t)(m_Capabilities.maxIndices / 6);
+		CEE_ASSERT_WITH_MESSAGE(m_BatchQuadCapacity > 0, "Renderer capabilities must allow at least one quad per batch.");
+
+		// Instanced batches and quad layers share the QuadInstance format.
+		m_InstanceBindingDescription.setBinding(0).setInputRate(vk::VertexInputRate::eInstance).setStride(sizeof(QuadInstance));
+
+		m_InstanceAttributeDescriptions.resize(7);
+		m_InstanceAttributeDescriptions[0]
+			.setBinding(0)
+			.setLocation(0)
+			.setFormat(vk::Format::eR32G32Sfloat)
+			.setOffset(offsetof(QuadInstance, translation));
+		m_InstanceAttributeDescriptions[1]
+			.setBinding(0)
+			.setLocation(1)
+			.setFormat(vk::Format::eR32G32Sfloat)
+			.setOffset(offsetof(QuadInstance, scale));
+		m_InstanceAttributeDescriptions[2]
+			.setBinding(0)
+			.setLocation(2)
+			.setFormat(vk::Format::eR32Sfloat)
+			.setOffset(offsetof(QuadInstance, rotation));
+		m_InstanceAttributeDescriptions[3]
+			.setBinding(0)
+			.setLocation(3)
+			.setFormat(vk::Format::eR8G8B8A8Unorm)
+			.setOffset(offsetof(QuadInstance, color));
+		m_InstanceAttributeDescriptions[4]
+			.setBinding(0)
+			.setLocation(4)
+			.setFormat(vk::Format::eR32Uint)
+			.setOffset(offsetof(QuadInstance, texture));
+		m_InstanceAttributeDescriptions[5]
+			.setBinding(0)
+			.setLocation(5)
+			.setFormat(vk::Format::eR16G16Unorm)
+			.setOffset(offsetof(QuadInstance, texCoordMin));
+		m_InstanceAttributeDescriptions[6]
+			.setBinding(0)
+			.setLocation(6)
+			.setFormat(vk::Format::eR16G16Unorm)
+			.setOffset(offsetof(QuadInstance, texCoordMax));
+
+		if (m_Capabilities.batchMode == QuadBatchMode::eInstanced)
+		{
+			m_BatchQuadStride = sizeof(QuadInstance);
+			m_VertexInputBindingDescription = m_InstanceBindingDescription;
+			m_VertexInputAttributeDescriptions = m_InstanceAttributeDescriptions;
+		}
+		else
+		{
+			const VertexLayout& layout = m_Capabilities.vertexLayout;
+			m_BatchQuadStride = 4 * layout.GetStride();
+			m_VertexInputBindingDescription = layout.GetBindingDescription(0);
+			m_VertexInputAttributeDescriptions = layout.GetAttributeDescriptions(0);
+		}
+		if (m_Capabilities.printStatistics)
+			printf("Batch data: %u bytes per quad, %s quad transform kernel\n", m_BatchQuadStride, GetQuadTransformKernelName());
+
+		m_ScratchTranslations.resize(g_QuadTransformChunkSize);
+		m_ScratchScales.resize(g_QuadTransformChunkSize);
+		m_ScratchRotations.resize(g_QuadTransformChunkSize);
+		m_ScratchColors.resize(g_QuadTransformChunkSize);
+		m_ScratchCorners.resize(8 * g_QuadTransformChunkSize);
+		m_ScratchVisible.resize(g_QuadTransformChunkSize);
+		if (m_Capabilities.diffVertexStream)
+			m_BatchShadow.resize((size_t)m_BatchQuadCapacity * m_BatchQuadStride);
+
+		// Each frame in flight streams its batches into its own vertex buffers, more are created on demand.
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+		{
+			m_Frames[i].vertexBuffers.emplace_back();
+			CreateVertexBuffer(m_Frames[i].vertexBuffers.back());
+			m_Frames[i].vertexBufferCount = 0;
+		}
+	}
+	
+	void Renderer::CreateVertexBuffer(VertexBuffer& vertexBuffer)
 	{
 		auto const vertexBufferCreateInfo = vk::BufferCreateInfo()
 			.setUsage(vk::BufferUsageFlagBits::eVertexBuffer)
-			.setSize(m_Capabilities.maxVertices * sizeof(Vertex))
+			.setSize(m_BatchQuadCapacity * m_BatchQuadStride)
 			.setQueueFamilyIndexCount(0)
 			.setPQueueFamilyIndices(nullptr)
 			.setSharingMode(vk::SharingMode::eExclusive);
 
-		auto result = m_Device.createBuffer(&vertexBufferCreateInfo, nullptr, &m_VertexBuffer.buffer);
+		auto result = m_Device.createBuffer(&vertexBufferCreateInfo, nullptr, &vertexBuffer.buffer);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create vertex buffer.");
 
-		vk::MemoryRequirements memoryRequirements;
-		m_Device.getBufferMemoryRequirements(m_VertexBuffer.buffer, &memoryRequirements);
+		// Rewritten every frame and read once, so it is written in place rather than staged. Device local host visible
+		// memory, where available, spares the GPU from reading it across the bus. Non-coherent memory is flushed by
+		// WriteBatchToDevice.
+		vk::MemoryPropertyFlags preferredFlags = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostCoherent;
+		result = m_MemoryAllocator->AllocateForBuffer(vertexBuffer.buffer, vk::MemoryPropertyFlagBits::eHostVisible, &vertexBuffer.allocation, preferredFlags);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "No mappable memory.");
 
-		uint32_t memoryTypeIndex;
-		vk::MemoryPropertyFlags typeBits = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-		bool pass = GetMemoryTypeFromProperties(memoryRequirements.memoryTypeBits, typeBits, &memoryTypeIndex);
-		CEE_ASSERT_WITH_MESSAGE(pass, "Required memory type for vertex buffer not supported.");
+		vertexBuffer.cpuMemoryPtr = vertexBuffer.allocation.mappedPtr;
+		vertexBuffer.bufferInfo.setBuffer(vertexBuffer.buffer).setOffset(0).setRange(vertexBufferCreateInfo.size);
+	}
 
-		auto const vertexBufferAllocateInfo = vk::MemoryAllocateInfo()
-			.setAllocationSize(memoryRequirements.size)
-			.setMemoryTypeIndex(memoryTypeIndex);
+	void Renderer::DestroyVertexBuffer(VertexBuffer& vertexBuffer)
+	{
+		m_Device.destroyBuffer(vertexBuffer.buffer, nullptr);
+		m_MemoryAllocator->Free(vertexBuffer.allocation);
+		vertexBuffer.cpuMemoryPtr = nullptr;
+	}
 
-		result = m_Device.allocateMemory(&vertexBufferAllocateInfo, nullptr, &m_VertexBuffer.deviceMemory);
-		CEE_ASSERT_WITH_MESSAGE(pass, "No mappable, coherant memory.");
+	void Renderer::CreateStagingBuffer(StagingBuffer& stagingBuffer, vk::DeviceSize size)
+	{
+		auto const stagingBufferCreateInfo = vk::BufferCreateInfo()
+			.setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+			.setSize(size)
+			.setQueueFamilyIndexCount(0)
+			.setPQueueFamilyIndices(nullptr)
+			.setSharingMode(vk::SharingMode::eExclusive);
 
-		result = m_Device.mapMemory(m_VertexBuffer.deviceMemory, 0, memoryRequirements.size, vk::MemoryMapFlags(), (void**)&m_VertexBuffer.cpuMemoryPtr);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to map memory for vertex buffer.");
+		auto result = m_Device.createBuffer(&stagingBufferCreateInfo, nullptr, &stagingBuffer.buffer);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create staging buffer.");
 
-		//memset(&m_VertexBuffer.cpuMemoryPtr, 0, memoryRequirements.size);
+		// Writers flush what they wrote in case the memory is not coherent.
+		result = m_MemoryAllocator->AllocateForBuffer(stagingBuffer.buffer, vk::MemoryPropertyFlagBits::eHostVisible, &stagingBuffer.allocation,
+													  vk::MemoryPropertyFlagBits::eHostCoherent);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "No mappable memory.");
 
-		m_Device.bindBufferMemory(m_VertexBuffer.buffer, m_VertexBuffer.deviceMemory, 0);
+		stagingBuffer.size = size;
+		stagingBuffer.cpuMemoryPtr = stagingBuffer.allocation.mappedPtr;
+	}
 
-		m_VertexInputBindingDescription.setBinding(0).setInputRate(vk::VertexInputRate::eVertex).setStride(sizeof(Vertex));
+	void Renderer::CreateReadbackBuffer(StagingBuffer& stagingBuffer, vk::DeviceSize size)
+	{
+		auto const readbackBufferCreateInfo = vk::BufferCreateInfo()
+			.setUsage(vk::BufferUsageFlagBits::eTransferDst)
+			.setSize(size)
+			.setQueueFamilyIndexCount(0)
+			.setPQueueFamilyIndices(nullptr)
+			.setSharingMode(vk::SharingMode::eExclusive);
 
-		m_VertexInputAttributeDescriptions[0]
-			.setBinding(0)
-			.setLocation(0)
-			.setFormat(vk::Format::eR32G32B32A32Sfloat)
-			.setOffset(0);
-		m_VertexInputAttributeDescriptions[1]
-			.setBinding(0)
-			.setLocation(1)
-			.setFormat(vk::Format::eR32G32B32A32Sfloat)
-			.setOffset(sizeof(float) * 4);
-		m_VertexInputAttributeDescriptions[2]
-			.setBinding(0)
-			.setLocation(2)
-			.setFormat(vk::Format::eR32G32B32Sfloat)
-			.setOffset((sizeof(float) * 4) + (sizeof(float) * 4));
+		auto result = m_Device.createBuffer(&readbackBufferCreateInfo, nullptr, &stagingBuffer.buffer);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create readback buffer.");
+
+		// Readers invalidate what they read in case the memory is not coherent.
+		result = m_MemoryAllocator->AllocateForBuffer(stagingBuffer.buffer, vk::MemoryPropertyFlagBits::eHostVisible, &stagingBuffer.allocation,
+													  vk::MemoryPropertyFlagBits::eHostCached);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "No mappable memory.");
+
+		stagingBuffer.size = size;
+		stagingBuffer.cpuMemoryPtr = stagingBuffer.allocation.mappedPtr;
+	}
+
+	void Renderer::DestroyStagingBuffer(StagingBuffer& stagingBuffer)
+	{
+		if (!stagingBuffer.buffer)
+			return;
 
-		m_VertexBuffer.bufferInfo.setBuffer(m_VertexBuffer.buffer).setOffset(0).setRange(memoryRequirements.size);
+		m_Device.destroyBuffer(stagingBuffer.buffer, nullptr);
+		m_MemoryAllocator->Free(stagingBuffer.allocation);
+		stagingBuffer.buffer = nullptr;
+		stagingBuffer.size = 0;
+		stagingBuffer.cpuMemoryPtr = nullptr;
 	}
 	
+	template<typename T>
+	static void WriteQuadIndices(T* indices, size_t quadCount)
+	{
+		T offset = 0;
+		for (size_t i = 0; i < quadCount * 6; i += 6)
+		{
+			indices[i + 0] = offset + 0;
+			indices[i + 1] = offset + 1;
+			indices[i + 2] = offset + 2;
+
+			indices[i + 3] = offset + 2;
+			indices[i + 4] = offset + 3;
+			indices[i + 5] = offset + 0;
+
+			offset += 4;
+		}
+	}
+
 	void Renderer::InitalizeIndexBuffer()
 	{
+		m_IndexMode = m_Capabilities.indexMode;
+		if (m_IndexMode == QuadIndexMode::eGenerated && m_Capabilities.batchMode != QuadBatchMode::eInstanced)
+		{
+			fprintf(stderr, "Generated quad indices require the instanced batch mode, using an index buffer.\n");
+			m_IndexMode = QuadIndexMode::eIndexed;
+		}
+		// The vertex shader derives both triangles from gl_VertexIndex, there is nothing to index.
+		if (m_IndexMode == QuadIndexMode::eGenerated)
+			return;
+
+		// Instances all reuse the first quad, otherwise every quad of a full batch needs its own six indices. Those
+		// only fit 16 bits while a batch stays within 65536 vertices.
+		size_t quadCount = m_Capabilities.batchMode == QuadBatchMode::eInstanced ? 1 : m_BatchQuadCapacity;
+		m_IndexBuffer.indexType = quadCount * 4 > 65536 ? vk::IndexType::eUint32 : vk::IndexType::eUint16;
+		size_t indexSize = m_IndexBuffer.indexType == vk::IndexType::eUint32 ? sizeof(uint32_t) : sizeof(uint16_t);
+
 		auto const indexBufferCreateInfo = vk::BufferCreateInfo()
-			.setSize(m_Capabilities.maxIndices * sizeof(uint16_t))
-			.setUsage(vk::BufferUsageFlagBits::eIndexBuffer)
+			.setSize(quadCount * 6 * indexSize)
+			.setUsage(vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst)
 			.setQueueFamilyIndexCount(0)
 			.setPQueueFamilyIndices(nullptr)
 			.setSharingMode(vk::SharingMode::eExclusive);
@@ -868,53 +1331,46 @@ namespace CEE
 		auto result = m_Device.createBuffer(&indexBufferCreateInfo, nullptr, &m_IndexBuffer.buffer);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create index buffer.");
 
-		vk::MemoryRequirements memoryRequirements;
-		m_Device.getBufferMemoryRequirements(m_IndexBuffer.buffer, &memoryRequirements);
-
-		uint32_t typeIndex;
-		vk::MemoryPropertyFlags typeBits = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-		bool pass = GetMemoryTypeFromProperties(memoryRequirements.memoryTypeBits, typeBits, &typeIndex);
-		CEE_ASSERT_WITH_MESSAGE(pass, "No mappable, coherant memory.");
-
-		auto const indexBufferAllocateInfo = vk::MemoryAllocateInfo()
-			.setAllocationSize(memoryRequirements.size)
-			.setMemoryTypeIndex(typeIndex);
-		result = m_Device.allocateMemory(&indexBufferAllocateInfo, nullptr, &m_IndexBuffer.deviceMemory);
+		// Static data, it lives in device local memory and is filled once through the staging ring.
+		result = m_MemoryAllocator->AllocateForBuffer(m_IndexBuffer.buffer, vk::MemoryPropertyFlagBits::eDeviceLocal, &m_IndexBuffer.allocation);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate memory for index buffer.");
 
-		result = m_Device.mapMemory(m_IndexBuffer.deviceMemory, 0, memoryRequirements.size, vk::MemoryMapFlags(), (void**)&m_IndexBuffer.cpuMemoryPtr);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, {"Failed to map memory for index buffer.");
-
 		{
-			uint16_t* indices = (uint16_t*)malloc(memoryRequirements.size);
+			void* indices = malloc(indexBufferCreateInfo.size);
 			CEE_ASSERT(indices != NULL);
 
-			uint16_t offset = 0;
-			for (uint16_t i = 0; i < m_Capabilities.maxIndices - 6; i += 6)
-			{
-				indices[i + 0] = offset + 0;
-				indices[i + 1] = offset + 1;
-				indices[i + 2] = offset + 2;
-
-				indices[i + 3] = offset + 2;
-				indices[i + 4] = offset + 3;
-				indices[i + 5] = offset + 0;
-				
-				offset += 4;
-			}
-			memcpy(m_IndexBuffer.cpuMemoryPtr, indices, memoryRequirements.size);
+			if (m_IndexBuffer.indexType == vk::IndexType::eUint32)
+				WriteQuadIndices(static_cast<uint32_t*>(indices), quadCount);
+			else
+				WriteQuadIndices(static_cast<uint16_t*>(indices), quadCount);
+
+			m_UploadManager->Upload(m_IndexBuffer.buffer, 0, indices, indexBufferCreateInfo.size);
+			m_UploadManager->Wait(m_UploadManager->Submit());
 			free(indices);
 		}
-		m_Device.unmapMemory(m_IndexBuffer.deviceMemory);
-		m_IndexBuffer.cpuMemoryPtr = nullptr;
-
-		m_IndexBuffer.bufferInfo.setBuffer(m_IndexBuffer.buffer).setOffset(0).setRange(m_Capabilities.maxIndices * sizeof(uint16_t));
-		m_IndexBuffer.indexType = vk::IndexType::eUint16;
 
-		m_Device.bindBufferMemory(m_IndexBuffer.buffer, m_IndexBuffer.deviceMemory, 0);
+		m_IndexBuffer.bufferInfo.setBuffer(m_IndexBuffer.buffer).setOffset(0).setRange(indexBufferCreateInfo.size);
 	}
 	
 	void Renderer::InitalizePipeline()
+	{
+		auto const pipelineCreationStart = std::chrono::steady_clock::now();
+		bool instanced = m_Capabilities.batchMode == QuadBatchMode::eInstanced;
+		CreateQuadPipeline(m_Shader, m_VertexInputBindingDescription, m_VertexInputAttributeDescriptions, instanced, &m_Pipeline);
+		if (instanced)
+			m_InstancedPipeline = m_Pipeline;
+		else
+			CreateQuadPipeline(m_InstancedShader, m_InstanceBindingDescription, m_InstanceAttributeDescriptions, true, &m_InstancedPipeline);
+		if (m_Capabilities.printStatistics)
+			printf("Graphics pipelines created in %.3fms (%s pipeline cache).\n",
+				   std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - pipelineCreationStart).count(),
+				   m_PipelineCacheWarm ? "warm" : "cold");
+
+		UpdateViewport();
+	}
+
+	void Renderer::CreateQuadPipeline(Shader* shader, const vk::VertexInputBindingDescription& bindingDescription,
+									  const std::vector<vk::VertexInputAttributeDescription>& attributeDescriptions, bool instanced, vk::Pipeline* pipeline)
 	{
 		vk::DynamicState stateEnables[2];
 		memset(stateEnables, 0, sizeof(stateEnables));
@@ -923,9 +1379,9 @@ namespace CEE
 
 		auto const vertexInputStateCreateInfo = vk::PipelineVertexInputStateCreateInfo()
 			.setVertexBindingDescriptionCount(1)
-			.setPVertexBindingDescriptions(&m_VertexInputBindingDescription)
-			.setVertexAttributeDescriptionCount(3)
-			.setPVertexAttributeDescriptions(m_VertexInputAttributeDescriptions);
+			.setPVertexBindingDescriptions(&bindingDescription)
+			.setVertexAttributeDescriptionCount((uint32_t)attributeDescriptions.size())
+			.setPVertexAttributeDescriptions(attributeDescriptions.data());
 
 		auto const inputAssemblyStateCreateInfo = vk::PipelineInputAssemblyStateCreateInfo()
 			.setPrimitiveRestartEnable(VK_FALSE)
@@ -989,17 +1445,40 @@ namespace CEE
 			.setAlphaToOneEnable(VK_FALSE)
 			.setMinSampleShading(0.0f);
 
+		// Constant 0 of the instanced vertex shader selects whether gl_VertexIndex walks an index buffer or both triangles.
+		const vk::Bool32 generatedIndices = m_IndexMode == QuadIndexMode::eGenerated ? VK_TRUE : VK_FALSE;
+		auto const specializationMapEntry = vk::SpecializationMapEntry()
+			.setConstantID(0)
+			.setOffset(0)
+			.setSize(sizeof(vk::Bool32));
+		auto const vertexSpecializationInfo = vk::SpecializationInfo()
+			.setMapEntryCount(1)
+			.setPMapEntries(&specializationMapEntry)
+			.setDataSize(sizeof(vk::Bool32))
+			.setPData(&generatedIndices);
+
+		// Constant 1 of the fragment shader sizes its texture array.
+		auto const fragmentSpecializationMapEntry = vk::SpecializationMapEntry()
+			.setConstantID(1)
+			.setOffset(0)
+			.setSize(sizeof(uint32_t));
+		auto const fragmentSpecializationInfo = vk::SpecializationInfo()
+			.setMapEntryCount(1)
+			.setPMapEntries(&fragmentSpecializationMapEntry)
+			.setDataSize(sizeof(uint32_t))
+			.setPData(&m_MaxTextures);
+
 		vk::PipelineShaderStageCreateInfo shaderStageCreateInfo[] = {
 			vk::PipelineShaderStageCreateInfo()
-			.setModule(m_Shader->GetVertexModule())
+			.setModule(shader->GetVertexModule())
 			.setPName("main")
 			.setStage(vk::ShaderStageFlagBits::eVertex)
-			.setPSpecializationInfo(nullptr),
+			.setPSpecializationInfo(instanced ? &vertexSpecializationInfo : nullptr),
 			vk::PipelineShaderStageCreateInfo()
-			.setModule(m_Shader->GetFragmentModule())
+			.setModule(shader->GetFragmentModule())
 			.setPName("main")
 			.setStage(vk::ShaderStageFlagBits::eFragment)
-			.setPSpecializationInfo(nullptr)
+			.setPSpecializationInfo(&fragmentSpecializationInfo)
 		};
 
 		auto const graphicsPipelineCreateInfo = vk::GraphicsPipelineCreateInfo()
@@ -1020,9 +1499,12 @@ namespace CEE
 			.setRenderPass(m_RenderPass)
 			.setSubpass(0);
 
-		auto result = m_Device.createGraphicsPipelines(nullptr, 1, &graphicsPipelineCreateInfo, nullptr, &m_Pipeline);
+		auto result = m_Device.createGraphicsPipelines(m_PipelineCache, 1, &graphicsPipelineCreateInfo, nullptr, pipeline);
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create graphics pipeline.");
+	}
 
+	void Renderer::UpdateViewport()
+	{
 		m_Viewport = vk::Viewport()
 			.setWidth((float)m_SwapchainExtent.width)
 			.setHeight((float)m_SwapchainExtent.height)
@@ -1034,98 +1516,300 @@ namespace CEE
 		m_ScissorRect = vk::Rect2D(vk::Offset2D(0, 0), m_SwapchainExtent);
 	}
 	
-	void Renderer::InitalizeSyncronisation()
+	void Renderer::InitalizePipelineCache()
 	{
-		auto const imageAcquiredSemaphoreCreateInfo = vk::SemaphoreCreateInfo()
-			.setFlags({});
+		// Keyed by everything that invalidates a driver's cache so switching GPUs or drivers never feeds it stale data.
+		char uuid[2 * VK_UUID_SIZE + 1];
+		for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+			snprintf(uuid + 2 * i, 3, "%02x", m_PhysicalDeviceProperties.pipelineCacheUUID[i]);
+		char fileName[128];
+		snprintf(fileName, sizeof(fileName), "pipeline_cache_%04x_%04x_%08x_%s.bin", m_PhysicalDeviceProperties.vendorID,
+				 m_PhysicalDeviceProperties.deviceID, m_PhysicalDeviceProperties.driverVersion, uuid);
+		m_PipelineCachePath = fileName;
+
+		std::vector<char> cacheData;
+		std::ifstream cacheFile(m_PipelineCachePath, std::ios::binary | std::ios::ate);
+		if (cacheFile.is_open())
+		{
+			cacheData.resize((size_t)cacheFile.tellg());
+			cacheFile.seekg(0, std::ios::beg);
+			cacheFile.read(cacheData.data(), cacheData.size());
+			cacheFile.close();
+		}
+
+		// Validate the VkPipelineCacheHeaderVersionOne header ourselves, not every driver rejects foreign data gracefully.
+		m_PipelineCacheWarm = false;
+		if (cacheData.size() >= 16 + VK_UUID_SIZE)
+		{
+			uint32_t header[4];
+			memcpy(header, cacheData.data(), sizeof(header));
+			m_PipelineCacheWarm = header[0] >= 16 + VK_UUID_SIZE &&
+				header[1] == (uint32_t)vk::PipelineCacheHeaderVersion::eOne &&
+				header[2] == m_PhysicalDeviceProperties.vendorID &&
+				header[3] == m_PhysicalDeviceProperties.deviceID &&
+				!memcmp(cacheData.data() + 16, m_PhysicalDeviceProperties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+		}
+		if (!m_PipelineCacheWarm && !cacheData.empty())
+			fprintf(stderr, "Ignoring incompatible pipeline cache %s.\n", m_PipelineCachePath.c_str());
 
-		auto result = m_Device.createSemaphore(&imageAcquiredSemaphoreCreateInfo, nullptr, &m_ImageAcquiredSemaphore);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create image acquired semaphore.");
+		auto const pipelineCacheCreateInfo = vk::PipelineCacheCreateInfo()
+			.setInitialDataSize(m_PipelineCacheWarm ? cacheData.size() : 0)
+			.setPInitialData(m_PipelineCacheWarm ? cacheData.data() : nullptr);
 
-		auto const fenceCreateInfo = vk::FenceCreateInfo();
-		result = m_Device.createFence(&fenceCreateInfo, nullptr, &m_Fence);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create fence.");
+		auto result = m_Device.createPipelineCache(&pipelineCacheCreateInfo, nullptr, &m_PipelineCache);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create pipeline cache.");
 	}
 
-	const bool Renderer::GetMemoryTypeFromProperties(uint32_t typeBits, vk::MemoryPropertyFlags requirementsMask, uint32_t* typeIndex)
+	void Renderer::SavePipelineCache()
 	{
-		for (uint32_t i = 0; i < m_PhysicalDeviceMemoryProperties.memoryTypeCount; i++)
+		size_t dataSize = 0;
+		auto result = m_Device.getPipelineCacheData(m_PipelineCache, &dataSize, nullptr);
+		if (result != vk::Result::eSuccess || dataSize == 0)
+			return;
+
+		std::vector<char> cacheData(dataSize);
+		result = m_Device.getPipelineCacheData(m_PipelineCache, &dataSize, cacheData.data());
+		if (result != vk::Result::eSuccess)
+			return;
+
+		// Written to a temporary file and renamed, a crash mid write leaves the previous cache intact instead of a
+		// truncated one.
+		std::string temporaryPath = m_PipelineCachePath + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
 		{
-			if ((typeBits & 1) == 1)
+			std::ofstream cacheFile(temporaryPath, std::ios::binary | std::ios::trunc);
+			if (cacheFile.is_open())
+				cacheFile.write(cacheData.data(), dataSize);
+			if (!cacheFile)
 			{
-				if ((m_PhysicalDeviceMemoryProperties.memoryTypes[i].propertyFlags & requirementsMask) == requirementsMask)
-				{
-					*typeIndex = i;
-					return true;
-				}
+				fprintf(stderr, "Failed to write pipeline cache %s.\n", m_PipelineCachePath.c_str());
+				return;
 			}
-			typeBits >>= 1;
 		}
-		return false;
-	}
 
-	void Renderer::Resize()
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, m_PipelineCachePath, error);
+		if (error)
+			fprintf(stderr, "Failed to write pipeline cache %s.\n", m_PipelineCachePath.c_str());
+	}
+	
+	void Renderer::InitalizeSyncronisation()
 	{
-		if (!m_Prepared)
-			return;
+		auto const semaphoreCreateInfo = vk::SemaphoreCreateInfo()
+			.setFlags({});
 
-		m_Device.destroyPipeline(m_Pipeline, nullptr);
-		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
-		{
-			m_Device.destroyFramebuffer(m_Framebuffers[i], nullptr);
-		}
-		m_Device.destroyImage(m_DepthBuffer.image, nullptr);
-		m_Device.destroyImageView(m_DepthBuffer.view, nullptr);
-		m_Device.freeMemory(m_DepthBuffer.memory);
-		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
+		// Fences start signaled so the first pass around the ring does not block.
+		auto const fenceCreateInfo = vk::FenceCreateInfo()
+			.setFlags(vk::FenceCreateFlagBits::eSignaled);
+
+		for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
 		{
-			m_Device.destroyImageView(m_SwapchainResources[i].view, nullptr);
-		}
-		m_Device.destroySwapchainKHR(m_Swapchain, nullptr);
+			auto result = m_Device.createSemaphore(&semaphoreCreateInfo, nullptr, &m_Frames[i].imageAcquiredSemaphore);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create image acquired semaphore.");
 
-		InitalizeSwapchain();
-		InitalizeDepthBuffer();
-		InitalizeFramebuffers();
-		InitalizePipeline();
+			result = m_Device.createFence(&fenceCreateInfo, nullptr, &m_Frames[i].fence);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create fence.");
+		}
 	}
 
-	void Renderer::BeginScene(Camera& camera)
+	void Renderer::InitalizeGpuProfiler()
 	{
-		if (!m_Prepared)
+		if (!m_Capabilities.gpuProfiling)
 			return;
 
-		m_CommandBuffer.reset(vk::CommandBufferResetFlagBits::eReleaseResources);
-
-		auto const beginInfo = vk::CommandBufferBeginInfo()
-			.setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse)
-			.setPInheritanceInfo(nullptr);
+		uint32_t timestampValidBits = m_QueueFamilyProperties[m_GraphicsQueueFamilyIndex].timestampValidBits;
+		if (timestampValidBits == 0)
+		{
+			fprintf(stderr, "Graphics queue does not support timestamps, GPU profiling is disabled.\n");
+			return;
+		}
+		m_GpuProfiler = std::make_unique<GpuProfiler>(m_Device, m_Capabilities.framesInFlight,
+													  m_PhysicalDeviceProperties.limits.timestampPeriod, timestampValidBits);
+		m_GpuScopeIds.frame = m_GpuProfiler->RegisterScope("frame");
+		m_GpuScopeIds.uploads = m_GpuProfiler->RegisterScope("uploads");
+		m_GpuScopeIds.renderPass = m_GpuProfiler->RegisterScope("render pass");
+		m_GpuScopeIds.batch = m_GpuProfiler->RegisterScope("batch", true);
+		m_GpuScopeIds.layer = m_GpuProfiler->RegisterScope("layer", true);
+		m_GpuScopeIds.readback = m_GpuProfiler->RegisterScope("readback");
+	}
 
-		auto result = m_CommandBuffer.begin(&beginInfo);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to begin recording commands.");
+	void Renderer::InitalizeLatencyQueries()
+	{
+		// Frame end timestamps are only comparable with the host clock when the device timestamp can be read on the host.
+		bool deviceTimeDomain = false;
+		uint32_t timestampValidBits = m_QueueFamilyProperties[m_GraphicsQueueFamilyIndex].timestampValidBits;
+		if (m_CalibratedTimestamps && timestampValidBits > 0)
+		{
+			auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)m_Instance.getProcAddr(
+				"vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+			m_GetCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT)m_Device.getProcAddr("vkGetCalibratedTimestampsEXT");
 
-		m_View = camera.GetTransformationMatrix();
-		glm::mat4 mvp = m_Model * m_View * m_Projection;
-		memcpy(m_MvpBuffer.cpuMemoryPtr, &mvp, sizeof(mvp));
+			uint32_t timeDomainCount = 0;
+			if (getTimeDomains && m_GetCalibratedTimestamps &&
+				getTimeDomains(static_cast<VkPhysicalDevice>(m_PhysicalDevice), &timeDomainCount, nullptr) == VK_SUCCESS)
+			{
+				std::vector<VkTimeDomainEXT> timeDomains(timeDomainCount);
+				if (getTimeDomains(static_cast<VkPhysicalDevice>(m_PhysicalDevice), &timeDomainCount, timeDomains.data()) == VK_SUCCESS)
+					deviceTimeDomain = std::find(timeDomains.begin(), timeDomains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != timeDomains.end();
+			}
+		}
+		if (!deviceTimeDomain)
+		{
+			if (m_Capabilities.printStatistics)
+				fprintf(stderr, "Calibrated timestamps not supported, acquire to GPU completion latency is not measured.\n");
+			return;
+		}
 
-		result = m_Device.acquireNextImageKHR(m_Swapchain, UINT64_MAX, m_ImageAcquiredSemaphore, nullptr, &m_CurrentBuffer);
-		if (result == vk::Result::eErrorOutOfDateKHR)
+		m_LatencyTimestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+		auto const queryPoolInfo = vk::QueryPoolCreateInfo()
+			.setQueryType(vk::QueryType::eTimestamp)
+			.setQueryCount(m_Capabilities.framesInFlight);
+		auto result = m_Device.createQueryPool(&queryPoolInfo, nullptr, &m_LatencyQueryPool);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create latency query pool.");
+	}
+
+	void Renderer::Resize()
+	{
+		// Offscreen images keep the size they were created with.
+		if (!m_Prepared || m_Headless)
+			return;
+
+		// Frames still in flight reference the framebuffers and swapchain images about to be destroyed.
+		WaitIdle();
+
+		for (uint32_t i = 0; i < m_SwapchainImageCount; i++)
 		{
-			Resize();
+			m_Device.destroyFramebuffer(m_Framebuffers[i], nullptr);
 		}
-		else if (result == vk::Result::eSuboptimalKHR)
+		m_Device.destroyImage(m_DepthBuffer.image, nullptr);
+		m_Device.destroyImageView(m_DepthBuffer.view, nullptr);
+		m_MemoryAllocator->Free(m_DepthBuffer.allocation);
+		DestroySwapchainResources();
+		m_Device.destroySwapchainKHR(m_Swapchain, nullptr);
+
+		vk::Format previousFormat = m_Format;
+		InitalizeSwapchain();
+		InitalizeDepthBuffer();
+
+		// Viewport and scissor are dynamic state, so the pipeline only has to be rebuilt when the surface format
+		// changes and the render pass with it. The pipeline cache makes that rebuild cheap.
+		if (m_Format != previousFormat)
 		{
-			// Do nothing.
+			if (m_InstancedPipeline != m_Pipeline)
+				m_Device.destroyPipeline(m_InstancedPipeline, nullptr);
+			m_Device.destroyPipeline(m_Pipeline, nullptr);
+			m_Device.destroyRenderPass(m_RenderPass, nullptr);
+			InitalizeRenderPass();
+			InitalizeFramebuffers();
+			InitalizePipeline();
 		}
-		else if (result == vk::Result::eErrorSurfaceLostKHR)
+		else
 		{
-			m_Instance.destroySurfaceKHR(m_Surface, nullptr);
-			InitalizeSurface();
-			Resize();
+			InitalizeFramebuffers();
+			UpdateViewport();
 		}
+	}
+
+	void Renderer::BeginScene(Camera& camera)
+	{
+		if (!m_Prepared)
+			return;
+
+		auto const beginSceneTime = std::chrono::steady_clock::now();
+		m_Statistics.frameTime = std::chrono::duration<float, std::milli>(beginSceneTime - m_LastBeginSceneTime).count();
+		m_LastBeginSceneTime = beginSceneTime;
+
+		FrameResources& frame = m_Frames[m_FrameIndex];
+
+		// Only blocks once the ring has wrapped and this frame's previous submission is still executing.
+		vk::Result result;
+		do {
+			result = m_Device.waitForFences(1, &frame.fence, VK_TRUE, 10000000000);
+		} while (result == vk::Result::eTimeout);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to wait for fences.");
+		m_Statistics.fenceWaitTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - beginSceneTime).count();
+
+		for (Texture& texture : frame.retiredTextures)
+			DestroyTextureResources(texture);
+		frame.retiredTextures.clear();
+		// Kept until taken, the frame's readback buffer is about to be reused.
+		if (frame.readbackPending)
+			CollectReadback(frame);
+		if (frame.latencyPending)
+			CollectLatency(frame);
+
+		if (m_Headless)
+			m_CurrentBuffer = m_FrameIndex;
 		else
+			AcquireNextImage(frame);
+		m_ImageAcquiredTime = std::chrono::steady_clock::now();
+
+		// With more frames in flight than swapchain images an older frame may still be rendering into this image.
+		SwapchainResources& swapchainResources = m_SwapchainResources[m_CurrentBuffer];
+		if (swapchainResources.inFlightFence && swapchainResources.inFlightFence != frame.fence)
 		{
-			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to acquire next image.");
+			do {
+				result = m_Device.waitForFences(1, &swapchainResources.inFlightFence, VK_TRUE, 10000000000);
+			} while (result == vk::Result::eTimeout);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to wait for fences.");
 		}
+		swapchainResources.inFlightFence = frame.fence;
+
+		// The fence is only reset once a submission that will signal it again is guaranteed.
+		result = m_Device.resetFences(1, &frame.fence);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to reset fence.");
+		frame.vertexBufferCount = 0;
+		m_BatchVertexBuffer = nullptr;
+		m_BatchMemory = nullptr;
+		m_BatchQuadCount = 0;
+		m_BatchFirstQuad = 0;
+
+		frame.commandBuffer.reset(vk::CommandBufferResetFlagBits::eReleaseResources);
+
+		auto const beginInfo = vk::CommandBufferBeginInfo()
+			.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+			.setPInheritanceInfo(nullptr);
+
+		result = frame.commandBuffer.begin(&beginInfo);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to begin recording commands.");
+
+		// The frame's fence was waited on, so the results of its previous timestamps are ready.
+		if (m_GpuProfiler)
+			m_GpuProfiler->BeginFrame(m_FrameIndex, frame.commandBuffer);
+		if (m_LatencyQueryPool)
+			frame.commandBuffer.resetQueryPool(m_LatencyQueryPool, m_FrameIndex, 1);
+		m_GpuBatchScopes = 0;
+		m_GpuLayerScopes = 0;
+		m_GpuFrameScope = BeginGpuScope(m_GpuScopeIds.frame);
+
+		// Streamed textures whose upload completed are acquired below along with everything else.
+		UpdateTextureLoads(frame);
+		uint32_t uploadScope = BeginGpuScope(m_GpuScopeIds.uploads);
+		// Takes ownership of everything uploaded on the transfer queue that completed since the last frame.
+		m_UploadManager->RecordAcquires(frame.commandBuffer);
+		// Copies are not allowed inside a render pass.
+		UploadQuadLayers(frame);
+		UploadTextures(frame);
+		EndGpuScope(uploadScope);
+		// Only textures uploaded above are referenced, and the set is not bound yet.
+		UpdateTextureDescriptors(frame);
+
+		m_View = camera.GetTransformationMatrix();
+		glm::mat4 mvp = m_Projection * m_View * m_Model;
+		memcpy(frame.mvpBuffer.cpuMemoryPtr, &mvp, sizeof(mvp));
+
+		// Clip space corners of the viewport taken back to model space, their bounding box stays conservative
+		// under a rotated camera.
+		glm::mat4 inverseMvp = glm::inverse(mvp);
+		glm::vec2 viewMin(FLT_MAX), viewMax(-FLT_MAX);
+		const glm::vec2 clipCorners[4] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+		for (const glm::vec2& clipCorner : clipCorners)
+		{
+			glm::vec4 corner = inverseMvp * glm::vec4(clipCorner, 0.0f, 1.0f);
+			glm::vec2 position = glm::vec2(corner) / corner.w;
+			viewMin = glm::min(viewMin, position);
+			viewMax = glm::max(viewMax, position);
+		}
+		m_ViewBounds = glm::vec4(viewMin, viewMax);
 
 		vk::ClearValue clearValues[] = {
 			vk::ClearValue().setColor(vk::ClearColorValue(std::array<float, 4>({ 0.2f, 0.0f, 0.8f, 1.0f }))),
@@ -1138,89 +1822,1196 @@ namespace CEE
 			.setClearValueCount(sizeof(clearValues) / sizeof(clearValues[0]))
 			.setPClearValues(clearValues);
 
-		m_CommandBuffer.beginRenderPass(&renderPassBeginInfo, vk::SubpassContents::eInline);
+		m_GpuRenderPassScope = BeginGpuScope(m_GpuScopeIds.renderPass);
+		frame.commandBuffer.beginRenderPass(&renderPassBeginInfo, vk::SubpassContents::eInline);
 
-		m_CommandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_Pipeline);
-		m_CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0,
-			m_DescriptorSetCount, m_DescriptorSets.get(), 0, nullptr);
+		frame.commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_Pipeline);
+		m_BoundPipeline = m_Pipeline;
+		frame.commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0,
+			1, &frame.descriptorSet, 0, nullptr);
 
-		m_CommandBuffer.setViewport(0, 1, &m_Viewport);
-		m_CommandBuffer.setScissor(0, 1, &m_ScissorRect);
+		frame.commandBuffer.setViewport(0, 1, &m_Viewport);
+		frame.commandBuffer.setScissor(0, 1, &m_ScissorRect);
 	}
 	
+	void Renderer::AcquireNextImage(FrameResources& frame)
+	{
+		if (m_SwapchainOutOfDate)
+			Resize();
+
+		auto result = m_Device.acquireNextImageKHR(m_Swapchain, UINT64_MAX, frame.imageAcquiredSemaphore, nullptr, &m_CurrentBuffer);
+		if (result == vk::Result::eErrorOutOfDateKHR)
+		{
+			Resize();
+			result = m_Device.acquireNextImageKHR(m_Swapchain, UINT64_MAX, frame.imageAcquiredSemaphore, nullptr, &m_CurrentBuffer);
+		}
+		else if (result == vk::Result::eErrorSurfaceLostKHR)
+		{
+			m_Instance.destroySurfaceKHR(m_Surface, nullptr);
+			InitalizeSurface();
+			Resize();
+			result = m_Device.acquireNextImageKHR(m_Swapchain, UINT64_MAX, frame.imageAcquiredSemaphore, nullptr, &m_CurrentBuffer);
+		}
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess || result == vk::Result::eSuboptimalKHR, "Failed to acquire next image.");
+	}
+
+	UploadTicket Renderer::UploadBuffer(vk::Buffer buffer, vk::DeviceSize offset, const void* data, vk::DeviceSize size)
+	{
+		m_UploadManager->Upload(buffer, offset, data, size);
+		return m_UploadManager->Submit();
+	}
+
+	std::vector<UploadBandwidth> Renderer::MeasureUploadBandwidth(const std::vector<vk::DeviceSize>& sizes, uint32_t repetitions)
+	{
+		std::vector<UploadBandwidth> measurements;
+		if (sizes.empty() || repetitions == 0)
+			return measurements;
+		vk::DeviceSize maxSize = *std::max_element(sizes.begin(), sizes.end());
+
+		auto const bufferCreateInfo = vk::BufferCreateInfo()
+			.setUsage(vk::BufferUsageFlagBits::eTransferDst)
+			.setSize(maxSize)
+			.setQueueFamilyIndexCount(0)
+			.setPQueueFamilyIndices(nullptr)
+			.setSharingMode(vk::SharingMode::eExclusive);
+		vk::Buffer buffer;
+		auto result = m_Device.createBuffer(&bufferCreateInfo, nullptr, &buffer);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create upload benchmark buffer.");
+		Allocation allocation;
+		result = m_MemoryAllocator->AllocateForBuffer(buffer, vk::MemoryPropertyFlagBits::eDeviceLocal, &allocation);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate memory for upload benchmark buffer.");
+
+		std::vector<uint8_t> data(maxSize);
+		for (vk::DeviceSize i = 0; i < maxSize; i++)
+			data[i] = (uint8_t)(i * 31);
+
+		typedef struct UploadQueue {
+			bool transferQueue;
+			uint32_t queueFamilyIndex;
+			vk::Queue queue;
+		} UploadQueue;
+		std::vector<UploadQueue> queues;
+		if (m_SeperateTransferQueue)
+			queues.push_back({ true, m_TransferQueueFamilyIndex, m_TransferQueue });
+		queues.push_back({ false, m_GraphicsQueueFamilyIndex, m_GraphicsQueue });
+
+		for (const UploadQueue& queue : queues)
+		{
+			// Each queue keeps the buffer to itself, its contents are never read, so no ownership is transferred.
+			UploadManager uploads(m_Device, m_MemoryAllocator.get(), queue.queueFamilyIndex, queue.queue, &m_QueueMutex,
+								  queue.queueFamilyIndex);
+			uploads.Upload(buffer, 0, data.data(), std::min<vk::DeviceSize>(maxSize, 64 * 1024));
+			uploads.Wait(uploads.Submit());
+
+			for (vk::DeviceSize size : sizes)
+			{
+				float bestTime = FLT_MAX;
+				for (uint32_t i = 0; i < repetitions; i++)
+				{
+					auto const start = std::chrono::steady_clock::now();
+					uploads.Upload(buffer, 0, data.data(), size);
+					uploads.Wait(uploads.Submit());
+					bestTime = std::min(bestTime, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+				}
+				measurements.push_back({ size, queue.transferQueue, bestTime, (size / (1024.0f * 1024.0f)) / (bestTime / 1000.0f) });
+			}
+		}
+
+		m_Device.destroyBuffer(buffer, nullptr);
+		m_MemoryAllocator->Free(allocation);
+		return measurements;
+	}
+
+	bool Renderer::IsUploadComplete(UploadTicket ticket)
+	{
+		return m_UploadManager->IsComplete(ticket);
+	}
+
+	void Renderer::WaitForUpload(UploadTicket ticket)
+	{
+		m_UploadManager->Wait(ticket);
+	}
+
 	void Renderer::EndScene()
 	{
 		if (!m_Prepared)
 			return;
 
-		vk::DeviceSize offsets[] = { 0 };
-
-		memcpy(m_VertexBuffer.cpuMemoryPtr, m_Vertices.data(), m_Vertices.size() * sizeof(Vertex));
-
-		m_CommandBuffer.bindVertexBuffers(0, 1, &m_VertexBuffer.buffer, offsets);
-		m_CommandBuffer.bindIndexBuffer(m_IndexBuffer.buffer, 0, m_IndexBuffer.indexType);
+		FrameResources& frame = m_Frames[m_FrameIndex];
+		SwapchainResources& swapchainResources = m_SwapchainResources[m_CurrentBuffer];
 
-		m_CommandBuffer.drawIndexed(m_Statistics.indices, 1, 0, 0, 0);
+		{
+			std::lock_guard<std::mutex> lock(m_SubmittedBucketsMutex);
+			for (const QuadBucket* bucket : m_SubmittedBuckets)
+				AppendQuadBucket(*bucket);
+			m_SubmittedBuckets.clear();
+		}
+		Flush();
 
-		m_CommandBuffer.endRenderPass();
+		frame.commandBuffer.endRenderPass();
+		EndGpuScope(m_GpuRenderPassScope);
+		if (m_ReadbackRequested)
+		{
+			uint32_t readbackScope = BeginGpuScope(m_GpuScopeIds.readback);
+			RecordReadback(frame);
+			EndGpuScope(readbackScope);
+		}
+		EndGpuScope(m_GpuFrameScope);
+		if (m_LatencyQueryPool)
+		{
+			frame.commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_LatencyQueryPool, m_FrameIndex);
+			frame.latencyPending = true;
+			frame.acquiredTime = m_ImageAcquiredTime;
+		}
 
-		m_CommandBuffer.end();
+		frame.commandBuffer.end();
 
 		const vk::CommandBuffer commandBuffers[] =
 		{
-			m_CommandBuffer
+			frame.commandBuffer
 		};
 
+		// Offscreen images are neither acquired nor presented, the frame's fence orders everything else.
 		vk::PipelineStageFlags pipelineStageFlags = vk::PipelineStageFlagBits::eColorAttachmentOutput;
 		auto const submitInfo = vk::SubmitInfo()
-			.setWaitSemaphoreCount(1)
-			.setPWaitSemaphores(&m_ImageAcquiredSemaphore)
+			.setWaitSemaphoreCount(m_Headless ? 0 : 1)
+			.setPWaitSemaphores(&frame.imageAcquiredSemaphore)
 			.setPWaitDstStageMask(&pipelineStageFlags)
 			.setCommandBufferCount(sizeof(commandBuffers) / sizeof(commandBuffers[0]))
 			.setPCommandBuffers(commandBuffers)
-			.setSignalSemaphoreCount(0)
-			.setPSignalSemaphores(nullptr);
+			.setSignalSemaphoreCount(m_Headless ? 0 : 1)
+			.setPSignalSemaphores(&swapchainResources.renderFinishedSemaphore);
 
-		auto result = m_GraphicsQueue.submit(1, &submitInfo, m_Fence);
+		vk::Result result;
+		{
+			std::lock_guard<std::mutex> lock(m_QueueMutex);
+			result = m_GraphicsQueue.submit(1, &submitInfo, frame.fence);
+		}
 		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to submit render command buffer to graphics queue.");
+		m_FrameRendered = true;
+		m_FrameNumber++;
+
+		if (!m_Headless)
+			Present(swapchainResources);
+		m_Statistics.recordTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_ImageAcquiredTime).count();
 
+		m_FrameIndex = (m_FrameIndex + 1) % m_Capabilities.framesInFlight;
+
+		if (m_Statistics.bulkWriteTime > 0.0f)
+			m_Statistics.bulkQuadsPerSecond = m_Statistics.bulkQuads / (m_Statistics.bulkWriteTime / 1000.0f);
+		m_LastFrameStatistics = m_Statistics;
+		memset(&m_Statistics, 0, sizeof(RendererStatistics));
+	}
+
+	void Renderer::Present(SwapchainResources& swapchainResources)
+	{
+		// Presentation is ordered after rendering on the GPU, including when present runs on its own queue family,
+		// since the swapchain images are shared concurrently between both families.
 		auto const present = vk::PresentInfoKHR()
 			.setSwapchainCount(1)
 			.setPSwapchains(&m_Swapchain)
 			.setPImageIndices(&m_CurrentBuffer)
 			.setPResults(nullptr)
-			.setWaitSemaphoreCount(0)
-			.setPWaitSemaphores(nullptr);
+			.setWaitSemaphoreCount(1)
+			.setPWaitSemaphores(&swapchainResources.renderFinishedSemaphore);
 
-		do {
-			result = m_Device.waitForFences(1, &m_Fence, VK_TRUE, 10000000000);
-		} while (result == vk::Result::eTimeout);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to wait for fences.");
-		result = m_PresentQueue.presentKHR(&present);
-		CEE_ASSERT_WITH_MESSAGE((uint32_t)result >= 0, "Failed to present.");
-		result = m_Device.resetFences(1, &m_Fence);
-		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to reset fence.");
+		vk::Result result;
+		{
+			std::lock_guard<std::mutex> lock(m_QueueMutex);
+			result = m_PresentQueue.presentKHR(&present);
+		}
+		if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
+			m_SwapchainOutOfDate = true;
+		else
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to present.");
+	}
 
-		memset(&m_Statistics, 0, sizeof(RendererStatistics));
-		m_Vertices.clear();
+	void Renderer::WaitIdle()
+	{
+		std::lock_guard<std::mutex> lock(m_QueueMutex);
+		m_Device.waitIdle();
+	}
+
+	void Renderer::RequestReadback()
+	{
+		CEE_ASSERT_WITH_MESSAGE(m_ColorImagesReadable, "The surface does not allow reading swapchain images back.");
+		CEE_ASSERT_WITH_MESSAGE(m_Format == vk::Format::eR8G8B8A8Unorm || m_Format == vk::Format::eR8G8B8A8Srgb ||
+								m_Format == vk::Format::eB8G8R8A8Unorm || m_Format == vk::Format::eB8G8R8A8Srgb,
+								"Readbacks need a four channel 8 bit color format.");
+		m_ReadbackRequested = true;
+	}
+
+	void Renderer::RecordReadback(FrameResources& frame)
+	{
+		m_ReadbackRequested = false;
+
+		// Only this frame copies into its readback buffer and BeginScene already collected the previous copy, so the
+		// buffer can be replaced when the extent grew.
+		vk::DeviceSize size = (vk::DeviceSize)m_SwapchainExtent.width * m_SwapchainExtent.height * 4;
+		if (frame.readback.size < size)
+		{
+			DestroyStagingBuffer(frame.readback);
+			CreateReadbackBuffer(frame.readback, size);
+		}
+
+		// Swapchain images go back to ePresentSrcKHR after the copy, offscreen images are already where the render
+		// pass left them.
+		const vk::Image image = m_SwapchainResources[m_CurrentBuffer].image;
+		const vk::ImageLayout finalLayout = m_Headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+		auto imageBarrier = vk::ImageMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+			.setOldLayout(finalLayout)
+			.setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(image)
+			.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+		frame.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer,
+											vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+		auto const region = vk::BufferImageCopy()
+			.setBufferOffset(0)
+			.setBufferRowLength(0)
+			.setBufferImageHeight(0)
+			.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+			.setImageOffset(vk::Offset3D(0, 0, 0))
+			.setImageExtent(vk::Extent3D(m_SwapchainExtent.width, m_SwapchainExtent.height, 1));
+		frame.commandBuffer.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, frame.readback.buffer, 1, &region);
+
+		if (!m_Headless)
+		{
+			// Presentation waits on a semaphore, which already makes the copy's reads complete before it.
+			imageBarrier
+				.setSrcAccessMask(vk::AccessFlagBits::eTransferRead)
+				.setDstAccessMask(vk::AccessFlags())
+				.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+				.setNewLayout(vk::ImageLayout::ePresentSrcKHR);
+			frame.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+												vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &imageBarrier);
+		}
+
+		auto const memoryBarrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eHostRead);
+		frame.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(),
+											1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		frame.readbackExtent = m_SwapchainExtent;
+		frame.readbackPending = true;
+		frame.readbackFrame = m_FrameNumber;
+	}
+
+	void Renderer::CollectReadback(FrameResources& frame)
+	{
+		FrameReadback readback;
+		readback.frame = frame.readbackFrame;
+		readback.width = frame.readbackExtent.width;
+		readback.height = frame.readbackExtent.height;
+
+		size_t size = (size_t)readback.width * readback.height * 4;
+		auto result = m_MemoryAllocator->Invalidate(frame.readback.allocation, 0, size);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to invalidate readback buffer.");
+		readback.pixels.assign(frame.readback.cpuMemoryPtr, frame.readback.cpuMemoryPtr + size);
+
+		if (m_Format == vk::Format::eB8G8R8A8Unorm || m_Format == vk::Format::eB8G8R8A8Srgb)
+		{
+			for (size_t i = 0; i < size; i += 4)
+				std::swap(readback.pixels[i], readback.pixels[i + 2]);
+		}
+
+		m_CompletedReadbacks.push_back(std::move(readback));
+		frame.readbackPending = false;
+	}
+
+	void Renderer::CollectLatency(FrameResources& frame)
+	{
+		uint32_t query = (uint32_t)(&frame - m_Frames.get());
+		uint64_t frameEnd = 0;
+		auto result = m_Device.getQueryPoolResults(m_LatencyQueryPool, query, 1, sizeof(uint64_t), &frameEnd, sizeof(uint64_t),
+												   vk::QueryResultFlagBits::e64);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to get latency query result.");
+
+		// The device timestamp read next to the host clock tells when, in host time, the frame's last command finished.
+		VkCalibratedTimestampInfoEXT timestampInfo = {};
+		timestampInfo.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+		timestampInfo.timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+		uint64_t deviceNow = 0, maxDeviation = 0;
+		VkResult calibrateResult = m_GetCalibratedTimestamps(static_cast<VkDevice>(m_Device), 1, &timestampInfo, &deviceNow, &maxDeviation);
+		auto const hostNow = std::chrono::steady_clock::now();
+		CEE_ASSERT_WITH_MESSAGE(calibrateResult == VK_SUCCESS, "Failed to get calibrated timestamps.");
+
+		float sinceFrameEnd = ((deviceNow - frameEnd) & m_LatencyTimestampMask) * m_PhysicalDeviceProperties.limits.timestampPeriod / 1e6f;
+		m_Statistics.acquireToGpuDoneTime =
+			std::chrono::duration<float, std::milli>(hostNow - frame.acquiredTime).count() - sinceFrameEnd;
+		frame.latencyPending = false;
+	}
+
+	bool Renderer::TakeReadback(FrameReadback* readback, bool wait)
+	{
+		// Frames finish in submission order, so collecting the oldest pending frame first keeps readbacks in order.
+		while (true)
+		{
+			FrameResources* oldest = nullptr;
+			for (uint32_t i = 0; i < m_Capabilities.framesInFlight; i++)
+			{
+				FrameResources& frame = m_Frames[i];
+				if (frame.readbackPending && (!oldest || frame.readbackFrame < oldest->readbackFrame))
+					oldest = &frame;
+			}
+			if (!oldest)
+				break;
+
+			vk::Result result = m_Device.getFenceStatus(oldest->fence);
+			if (result == vk::Result::eNotReady)
+			{
+				if (!wait || !m_CompletedReadbacks.empty())
+					break;
+
+				do {
+					result = m_Device.waitForFences(1, &oldest->fence, VK_TRUE, 10000000000);
+				} while (result == vk::Result::eTimeout);
+			}
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to wait for fences.");
+			CollectReadback(*oldest);
+		}
+
+		if (m_CompletedReadbacks.empty())
+			return false;
+
+		*readback = std::move(m_CompletedReadbacks.front());
+		m_CompletedReadbacks.pop_front();
+		return true;
+	}
+
+	void Renderer::ReadFrame(std::vector<uint8_t>* pixels)
+	{
+		CEE_ASSERT_WITH_MESSAGE(m_Headless, "Only headless renderers read frames back.");
+		CEE_ASSERT_WITH_MESSAGE(m_FrameRendered, "No frame has been rendered yet.");
+
+		StagingBuffer readback;
+		CreateReadbackBuffer(readback, (vk::DeviceSize)m_SwapchainExtent.width * m_SwapchainExtent.height * 4);
+
+		auto const commandBufferAllocateInfo = vk::CommandBufferAllocateInfo()
+			.setCommandBufferCount(1)
+			.setCommandPool(m_CommandPool);
+		vk::CommandBuffer commandBuffer;
+		auto result = m_Device.allocateCommandBuffers(&commandBufferAllocateInfo, &commandBuffer);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate command buffer.");
+
+		auto const beginInfo = vk::CommandBufferBeginInfo()
+			.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+			.setPInheritanceInfo(nullptr);
+		result = commandBuffer.begin(&beginInfo);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to begin recording commands.");
+
+		// The render pass left the image in eTransferSrcOptimal, only its writes have to be made visible to the copy.
+		const vk::Image image = m_SwapchainResources[m_CurrentBuffer].image;
+		auto const imageBarrier = vk::ImageMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+			.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(image)
+			.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(),
+									  0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+		auto const region = vk::BufferImageCopy()
+			.setBufferOffset(0)
+			.setBufferRowLength(0)
+			.setBufferImageHeight(0)
+			.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+			.setImageOffset(vk::Offset3D(0, 0, 0))
+			.setImageExtent(vk::Extent3D(m_SwapchainExtent.width, m_SwapchainExtent.height, 1));
+		commandBuffer.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, readback.buffer, 1, &region);
+
+		auto const memoryBarrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eHostRead);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(),
+									  1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		commandBuffer.end();
+
+		// Queue order puts the copy after the frame that rendered the image.
+		auto const submitInfo = vk::SubmitInfo()
+			.setCommandBufferCount(1)
+			.setPCommandBuffers(&commandBuffer);
+		{
+			std::lock_guard<std::mutex> lock(m_QueueMutex);
+			result = m_GraphicsQueue.submit(1, &submitInfo, nullptr);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to submit readback command buffer to graphics queue.");
+			result = m_GraphicsQueue.waitIdle();
+		}
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to wait for readback.");
+
+		result = m_MemoryAllocator->Invalidate(readback.allocation);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to invalidate readback buffer.");
+		pixels->assign(readback.cpuMemoryPtr, readback.cpuMemoryPtr + readback.size);
+
+		m_Device.freeCommandBuffers(m_CommandPool, 1, &commandBuffer);
+		DestroyStagingBuffer(readback);
+	}
+
+	GpuProfile Renderer::GetGpuProfile() const
+	{
+		if (!m_GpuProfiler)
+			return GpuProfile();
+		return m_GpuProfiler->GetProfile();
+	}
+
+	vk::Result Renderer::WriteGpuProfile(const std::string& filepath) const
+	{
+		if (!m_GpuProfiler)
+		{
+			fprintf(stderr, "GPU profiling is disabled, not writing %s.\n", filepath.c_str());
+			return vk::Result::eErrorFeatureNotPresent;
+		}
+		return m_GpuProfiler->WriteProfile(filepath);
+	}
+
+	void Renderer::ResetGpuProfile()
+	{
+		if (m_GpuProfiler)
+			m_GpuProfiler->Reset();
+	}
+
+	uint32_t Renderer::BeginGpuScope(uint32_t scopeId, uint32_t index)
+	{
+		if (!m_GpuProfiler)
+			return UINT32_MAX;
+		return m_GpuProfiler->BeginScope(m_Frames[m_FrameIndex].commandBuffer, scopeId, index);
+	}
+
+	void Renderer::EndGpuScope(uint32_t scope)
+	{
+		if (m_GpuProfiler)
+			m_GpuProfiler->EndScope(m_Frames[m_FrameIndex].commandBuffer, scope);
+	}
+
+	void Renderer::BeginBatch()
+	{
+		FrameResources& frame = m_Frames[m_FrameIndex];
+
+		// Earlier batches of this frame are still to be read by the GPU, so every batch gets its own buffer.
+		if (frame.vertexBufferCount == frame.vertexBuffers.size())
+		{
+			frame.vertexBuffers.emplace_back();
+			CreateVertexBuffer(frame.vertexBuffers.back());
+		}
+		m_BatchVertexBuffer = &frame.vertexBuffers[frame.vertexBufferCount++];
+		m_BatchMemory = m_Capabilities.diffVertexStream ? m_BatchShadow.data() : m_BatchVertexBuffer->cpuMemoryPtr;
+		m_BatchQuadCount = 0;
+		m_BatchFirstQuad = 0;
+	}
+
+	void Renderer::Flush()
+	{
+		if (m_BatchQuadCount == m_BatchFirstQuad)
+			return;
+
+		FrameResources& frame = m_Frames[m_FrameIndex];
+
+		WriteBatchToDevice();
+		BindPipeline(m_Pipeline);
+		vk::DeviceSize offsets[] = { 0 };
+		frame.commandBuffer.bindVertexBuffers(0, 1, &m_BatchVertexBuffer->buffer, offsets);
+
+		// The instanced path draws one quad per instance, either from the index buffer or from gl_VertexIndex alone.
+		uint32_t quadCount = m_BatchQuadCount - m_BatchFirstQuad;
+		uint32_t scope = BeginGpuScope(m_GpuScopeIds.batch, m_GpuBatchScopes++);
+		if (m_IndexMode == QuadIndexMode::eGenerated)
+		{
+			frame.commandBuffer.draw(6, quadCount, 0, m_BatchFirstQuad);
+		}
+		else
+		{
+			frame.commandBuffer.bindIndexBuffer(m_IndexBuffer.buffer, 0, m_IndexBuffer.indexType);
+			if (m_Capabilities.batchMode == QuadBatchMode::eInstanced)
+				frame.commandBuffer.drawIndexed(6, quadCount, 0, 0, m_BatchFirstQuad);
+			else
+				frame.commandBuffer.drawIndexed(quadCount * 6, 1, m_BatchFirstQuad * 6, 0, 0);
+		}
+		EndGpuScope(scope);
+		m_Statistics.drawCalls++;
+
+		// A partly filled buffer keeps collecting quads after a layer draw interrupted it.
+		if (m_BatchQuadCount < m_BatchQuadCapacity)
+		{
+			m_BatchFirstQuad = m_BatchQuadCount;
+			return;
+		}
+		m_BatchVertexBuffer = nullptr;
+		m_BatchMemory = nullptr;
+		m_BatchQuadCount = 0;
+		m_BatchFirstQuad = 0;
+	}
+
+	void Renderer::WriteBatchToDevice()
+	{
+		VertexBuffer& vertexBuffer = *m_BatchVertexBuffer;
+		size_t begin = (size_t)m_BatchFirstQuad * m_BatchQuadStride;
+		size_t end = (size_t)m_BatchQuadCount * m_BatchQuadStride;
+
+		vk::Result result;
+		if (!m_Capabilities.diffVertexStream)
+		{
+			// Already written in place, only non-coherent memory needs to be told.
+			result = m_MemoryAllocator->Flush(vertexBuffer.allocation, begin, end - begin);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to flush vertex buffer.");
+			m_Statistics.vertexUploadBytes += end - begin;
+			return;
+		}
+
+		// The buffer last held this slot's batch from framesInFlight frames ago, copy only the pages that differ.
+		m_ScratchDirtyRanges.clear();
+		vertexBuffer.dirtyRanges.Diff(m_BatchMemory, begin, end);
+		vertexBuffer.dirtyRanges.TakeDirtyRanges(end, &m_ScratchDirtyRanges);
+
+		size_t copiedBytes = 0;
+		for (const DirtyRange& range : m_ScratchDirtyRanges)
+		{
+			memcpy(vertexBuffer.cpuMemoryPtr + range.offset, m_BatchMemory + range.offset, range.size);
+			result = m_MemoryAllocator->Flush(vertexBuffer.allocation, range.offset, range.size);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to flush vertex buffer.");
+			copiedBytes += range.size;
+		}
+		m_Statistics.vertexUploadBytes += copiedBytes;
+		if (end - begin > copiedBytes)
+			m_Statistics.vertexSkippedBytes += end - begin - copiedBytes;
 	}
 
 	void Renderer::DrawQuad(glm::vec2 translation = { 0.0f, 0.0f }, glm::vec2 scale = { 1.0f, 1.0f },
 							float rotationAngle = 0, glm::vec4 color  = { 1.0f, 1.0f, 1.0f, 1.0f })
 	{
-		glm::mat4 transformation = glm::scale(glm::identity<glm::mat4>(), glm::vec3(scale, 1.0f));
-		transformation = glm::rotate(transformation, rotationAngle, glm::vec3(0.0f, 0.0f, 1.0f));
-		transformation = glm::translate(transformation, glm::vec3(translation, 0.0f));
-		for (uint32_t i = 0; i < 4; i++)
+		if (m_Capabilities.cullQuads)
 		{
-			Vertex vertex;
-			vertex.position = transformation * g_QuadVertices[i].position;
-			vertex.color = color;
-			vertex.normal = g_QuadVertices[i].position;
-			m_Vertices.push_back(vertex);
+			if (!IsQuadVisible(translation, scale, rotationAngle))
+			{
+				m_Statistics.culledQuads++;
+				return;
+			}
+			m_Statistics.visibleQuads++;
 		}
+
+		if (m_BatchQuadCount == m_BatchQuadCapacity)
+			Flush();
+		if (!m_BatchMemory)
+			BeginBatch();
+
+		if (m_Capabilities.batchMode == QuadBatchMode::eInstanced)
+			WriteQuadInstance(reinterpret_cast<QuadInstance*>(m_BatchMemory) + m_BatchQuadCount, translation, scale, rotationAngle, color);
+		else
+			WriteQuadVertices(m_Capabilities.vertexLayout, m_BatchMemory + (size_t)m_BatchQuadCount * m_BatchQuadStride, translation, scale, rotationAngle, color);
+		m_BatchQuadCount++;
+
 		m_Statistics.vertices += 4;
 		m_Statistics.indices += 6;
 		m_Statistics.quads++;
 	}
+
+	bool Renderer::IsQuadVisible(glm::vec2 translation, glm::vec2 scale, float rotationAngle) const
+	{
+		glm::vec2 center, halfExtent;
+		GetQuadBounds(translation, scale, rotationAngle, &center, &halfExtent);
+		return center.x + halfExtent.x >= m_ViewBounds.x && center.x - halfExtent.x <= m_ViewBounds.z &&
+			   center.y + halfExtent.y >= m_ViewBounds.y && center.y - halfExtent.y <= m_ViewBounds.w;
+	}
+
+	void Renderer::DrawSprite(glm::vec2 translation, glm::vec2 scale, float rotationAngle, const Sprite& sprite, glm::vec4 color)
+	{
+		CEE_ASSERT_WITH_MESSAGE(m_Capabilities.batchMode == QuadBatchMode::eInstanced, "Sprites need the instanced batch mode.");
+		CEE_ASSERT_WITH_MESSAGE(sprite.texture < m_MaxTextures, "Sprite texture out of range.");
+
+		if (m_Capabilities.cullQuads)
+		{
+			if (!IsQuadVisible(translation, scale, rotationAngle))
+			{
+				m_Statistics.culledQuads++;
+				return;
+			}
+			m_Statistics.visibleQuads++;
+		}
+
+		uint8_t* destination;
+		ReserveBatchQuads(1, &destination);
+		WriteQuadInstance(reinterpret_cast<QuadInstance*>(destination), translation, scale, rotationAngle, color, sprite);
+		CommitBatchQuads(1);
+	}
+
+	uint32_t Renderer::ReserveBatchQuads(size_t count, uint8_t** destination)
+	{
+		if (m_BatchQuadCount == m_BatchQuadCapacity)
+			Flush();
+		if (!m_BatchMemory)
+			BeginBatch();
+
+		*destination = m_BatchMemory + (size_t)m_BatchQuadCount * m_BatchQuadStride;
+		return (uint32_t)std::min<size_t>(std::min<size_t>(count, m_BatchQuadCapacity - m_BatchQuadCount), g_QuadTransformChunkSize);
+	}
+
+	void Renderer::CommitBatchQuads(uint32_t quadCount)
+	{
+		m_BatchQuadCount += quadCount;
+
+		m_Statistics.vertices += (size_t)quadCount * 4;
+		m_Statistics.indices += (size_t)quadCount * 6;
+		m_Statistics.quads += quadCount;
+	}
+
+	void Renderer::DrawQuads(const Quad* quads, size_t count)
+	{
+		auto const start = std::chrono::steady_clock::now();
+		m_Statistics.bulkQuads += count;
+
+		while (count > 0)
+		{
+			uint8_t* destination;
+			uint32_t chunkSize = ReserveBatchQuads(count, &destination);
+			uint32_t writtenCount = chunkSize;
+			if (m_Capabilities.batchMode == QuadBatchMode::eInstanced && !m_Capabilities.cullQuads)
+			{
+				QuadInstance* instances = reinterpret_cast<QuadInstance*>(destination);
+				for (uint32_t i = 0; i < chunkSize; i++)
+					WriteQuadInstance(instances + i, quads[i].translation, quads[i].scale, quads[i].rotation, quads[i].color);
+			}
+			else
+			{
+				for (uint32_t i = 0; i < chunkSize; i++)
+				{
+					m_ScratchTranslations[i] = quads[i].translation;
+					m_ScratchScales[i] = quads[i].scale;
+					m_ScratchRotations[i] = quads[i].rotation;
+					m_ScratchColors[i] = quads[i].color;
+				}
+
+				QuadTransformInput input;
+				input.translations = m_ScratchTranslations.data();
+				input.scales = m_ScratchScales.data();
+				input.rotations = m_ScratchRotations.data();
+				writtenCount = WriteQuadChunk(input, m_ScratchColors.data(), chunkSize, destination);
+			}
+			CommitBatchQuads(writtenCount);
+
+			quads += chunkSize;
+			count -= chunkSize;
+		}
+		m_Statistics.bulkWriteTime += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void Renderer::DrawQuads(const QuadArrays& quads)
+	{
+		CEE_ASSERT_WITH_MESSAGE(quads.translations != nullptr || quads.count == 0, "Quad arrays need translations.");
+
+		auto const start = std::chrono::steady_clock::now();
+		m_Statistics.bulkQuads += quads.count;
+
+		size_t offset = 0;
+		while (offset < quads.count)
+		{
+			uint8_t* destination;
+			uint32_t chunkSize = ReserveBatchQuads(quads.count - offset, &destination);
+			uint32_t writtenCount = chunkSize;
+			if (m_Capabilities.batchMode == QuadBatchMode::eInstanced && !m_Capabilities.cullQuads)
+			{
+				QuadInstance* instances = reinterpret_cast<QuadInstance*>(destination);
+				for (uint32_t i = 0; i < chunkSize; i++)
+				{
+					size_t index = offset + i;
+					WriteQuadInstance(instances + i, quads.translations[index],
+									  quads.scales ? quads.scales[index] : glm::vec2(1.0f),
+									  quads.rotations ? quads.rotations[index] : 0.0f,
+									  quads.colors ? quads.colors[index] : glm::vec4(1.0f));
+				}
+			}
+			else
+			{
+				// The caller's arrays feed the kernel directly, only missing ones are filled in.
+				QuadTransformInput input;
+				input.translations = quads.translations + offset;
+				input.scales = m_ScratchScales.data();
+				input.rotations = m_ScratchRotations.data();
+				const glm::vec4* colors = m_ScratchColors.data();
+				if (quads.scales)
+					input.scales = quads.scales + offset;
+				else
+					std::fill_n(m_ScratchScales.begin(), chunkSize, glm::vec2(1.0f));
+				if (quads.rotations)
+					input.rotations = quads.rotations + offset;
+				else
+					std::fill_n(m_ScratchRotations.begin(), chunkSize, 0.0f);
+				if (quads.colors)
+					colors = quads.colors + offset;
+				else
+					std::fill_n(m_ScratchColors.begin(), chunkSize, glm::vec4(1.0f));
+				writtenCount = WriteQuadChunk(input, colors, chunkSize, destination);
+			}
+			CommitBatchQuads(writtenCount);
+			offset += chunkSize;
+		}
+		m_Statistics.bulkWriteTime += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	uint32_t Renderer::WriteQuadChunk(const QuadTransformInput& input, const glm::vec4* colors, uint32_t count, uint8_t* destination)
+	{
+		CEE_ASSERT(count <= g_QuadTransformChunkSize);
+
+		QuadTransformOutput output;
+		for (uint32_t corner = 0; corner < 4; corner++)
+		{
+			output.cornerX[corner] = m_ScratchCorners.data() + corner * g_QuadTransformChunkSize;
+			output.cornerY[corner] = m_ScratchCorners.data() + (4 + corner) * g_QuadTransformChunkSize;
+		}
+		TransformQuads(input, count, output);
+
+		// The instanced path only needs the corners for culling, the GPU transforms the quads itself.
+		uint32_t writtenCount = count;
+		const uint32_t* visible = nullptr;
+		if (m_Capabilities.cullQuads)
+		{
+			writtenCount = CullQuads(output, count, m_ViewBounds, m_ScratchVisible.data());
+			visible = m_ScratchVisible.data();
+			m_Statistics.visibleQuads += writtenCount;
+			m_Statistics.culledQuads += count - writtenCount;
+		}
+
+		if (m_Capabilities.batchMode == QuadBatchMode::eInstanced)
+		{
+			QuadInstance* instances = reinterpret_cast<QuadInstance*>(destination);
+			for (uint32_t i = 0; i < writtenCount; i++)
+			{
+				uint32_t quad = visible ? visible[i] : i;
+				WriteQuadInstance(instances + i, input.translations[quad], input.scales[quad], input.rotations[quad], colors[quad]);
+			}
+			return writtenCount;
+		}
+
+		const VertexLayout& layout = m_Capabilities.vertexLayout;
+		for (uint32_t i = 0; i < writtenCount; i++)
+		{
+			uint32_t quad = visible ? visible[i] : i;
+			const glm::vec2 positions[4] = {
+				{ output.cornerX[0][quad], output.cornerY[0][quad] },
+				{ output.cornerX[1][quad], output.cornerY[1][quad] },
+				{ output.cornerX[2][quad], output.cornerY[2][quad] },
+				{ output.cornerX[3][quad], output.cornerY[3][quad] }
+			};
+			layout.WriteQuad(destination, positions, colors[quad], g_QuadNormal);
+			destination += m_BatchQuadStride;
+		}
+		return writtenCount;
+	}
+
+	void Renderer::SubmitQuadBucket(const QuadBucket& bucket)
+	{
+		CEE_ASSERT_WITH_MESSAGE(bucket.GetBatchMode() == m_Capabilities.batchMode, "Quad bucket was recorded for a different batch mode.");
+		CEE_ASSERT_WITH_MESSAGE(bucket.GetBatchMode() == QuadBatchMode::eInstanced || bucket.GetVertexLayout() == m_Capabilities.vertexLayout,
+								"Quad bucket was recorded with a different vertex layout.");
+
+		std::lock_guard<std::mutex> lock(m_SubmittedBucketsMutex);
+		m_SubmittedBuckets.push_back(&bucket);
+	}
+
+	void Renderer::AppendQuadBucket(const QuadBucket& bucket)
+	{
+		const uint8_t* data = bucket.GetData();
+		uint32_t remainingQuads = bucket.GetQuadCount();
+		while (remainingQuads > 0)
+		{
+			if (m_BatchQuadCount == m_BatchQuadCapacity)
+				Flush();
+			if (!m_BatchMemory)
+				BeginBatch();
+
+			uint32_t quadCount = std::min(remainingQuads, m_BatchQuadCapacity - m_BatchQuadCount);
+			memcpy(m_BatchMemory + (size_t)m_BatchQuadCount * m_BatchQuadStride, data, (size_t)quadCount * m_BatchQuadStride);
+			m_BatchQuadCount += quadCount;
+			data += (size_t)quadCount * m_BatchQuadStride;
+			remainingQuads -= quadCount;
+		}
+
+		m_Statistics.vertices += bucket.GetQuadCount() * 4;
+		m_Statistics.indices += bucket.GetQuadCount() * 6;
+		m_Statistics.quads += bucket.GetQuadCount();
+	}
+
+	QuadLayer* Renderer::CreateQuadLayer(uint32_t capacity, float cellSize)
+	{
+		m_QuadLayers.push_back(std::make_unique<QuadLayer>(m_Device, m_MemoryAllocator.get(), capacity, cellSize));
+		return m_QuadLayers.back().get();
+	}
+
+	void Renderer::DestroyQuadLayer(QuadLayer* layer)
+	{
+		auto it = std::find_if(m_QuadLayers.begin(), m_QuadLayers.end(),
+							   [layer](const std::unique_ptr<QuadLayer>& quadLayer) { return quadLayer.get() == layer; });
+		CEE_ASSERT_WITH_MESSAGE(it != m_QuadLayers.end(), "Quad layer was not created by this renderer.");
+
+		// Layers are long lived, waiting is simpler than tracking which frames in flight still read the buffer.
+		WaitIdle();
+		m_QuadLayers.erase(it);
+	}
+
+	void Renderer::DrawQuadLayer(const QuadLayer& layer)
+	{
+		uint32_t bufferQuadCount = layer.GetBufferQuadCount();
+		if (bufferQuadCount == 0)
+			return;
+
+		// Spatially indexed layers hand back the rows of cells in view, other layers one range covering everything.
+		m_ScratchQuadRanges.clear();
+		glm::vec4 bounds = m_Capabilities.cullQuads ? m_ViewBounds : glm::vec4(-FLT_MAX, -FLT_MAX, FLT_MAX, FLT_MAX);
+		uint32_t quadCount = layer.QueryVisibleRanges(bounds, &m_ScratchQuadRanges);
+		if (layer.HasSpatialIndex() && m_Capabilities.cullQuads)
+		{
+			m_Statistics.visibleQuads += quadCount;
+			m_Statistics.culledQuads += bufferQuadCount - quadCount;
+		}
+		if (quadCount == 0)
+			return;
+
+		// Immediate quads drawn before the layer stay beneath it.
+		Flush();
+
+		FrameResources& frame = m_Frames[m_FrameIndex];
+
+		BindPipeline(m_InstancedPipeline);
+		vk::Buffer buffer = layer.GetBuffer();
+		vk::DeviceSize offsets[] = { 0 };
+		frame.commandBuffer.bindVertexBuffers(0, 1, &buffer, offsets);
+		if (m_IndexMode != QuadIndexMode::eGenerated)
+			frame.commandBuffer.bindIndexBuffer(m_IndexBuffer.buffer, 0, m_IndexBuffer.indexType);
+
+		// The first quad's six indices serve every instance in either batch mode.
+		uint32_t scope = BeginGpuScope(m_GpuScopeIds.layer, m_GpuLayerScopes++);
+		for (const QuadRange& range : m_ScratchQuadRanges)
+		{
+			if (m_IndexMode == QuadIndexMode::eGenerated)
+				frame.commandBuffer.draw(6, range.count, 0, range.first);
+			else
+				frame.commandBuffer.drawIndexed(6, range.count, 0, 0, range.first);
+			m_Statistics.drawCalls++;
+		}
+		EndGpuScope(scope);
+
+		m_Statistics.vertices += (size_t)quadCount * 4;
+		m_Statistics.indices += (size_t)quadCount * 6;
+		m_Statistics.quads += quadCount;
+		m_Statistics.layerQuads += quadCount;
+	}
+
+	void Renderer::BindPipeline(vk::Pipeline pipeline)
+	{
+		if (m_BoundPipeline == pipeline)
+			return;
+
+		// Both pipelines share m_PipelineLayout, so the bound descriptor set stays valid.
+		m_Frames[m_FrameIndex].commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+		m_BoundPipeline = pipeline;
+	}
+
+	void Renderer::UploadQuadLayers(FrameResources& frame)
+	{
+		m_LayerCopies.clear();
+		vk::DeviceSize stagingSize = 0;
+		for (const std::unique_ptr<QuadLayer>& layer : m_QuadLayers)
+		{
+			// Also when quads were only removed and nothing is left to upload.
+			layer->UpdateBufferQuadCount();
+			if (!layer->IsDirty())
+				continue;
+
+			m_ScratchDirtyRanges.clear();
+			layer->TakeDirtyRanges(&m_ScratchDirtyRanges);
+			for (const DirtyRange& range : m_ScratchDirtyRanges)
+			{
+				m_LayerCopies.push_back({ layer.get(), range });
+				stagingSize += range.size;
+			}
+		}
+		if (stagingSize == 0)
+			return;
+
+		// The frame's fence was waited on, so its staging buffer is free to be rewritten or replaced.
+		if (frame.layerStaging.size < stagingSize)
+		{
+			DestroyStagingBuffer(frame.layerStaging);
+			CreateStagingBuffer(frame.layerStaging, stagingSize);
+		}
+
+		// Frames still in flight may be reading the layer buffers about to be overwritten. An execution dependency
+		// is enough to order the copies after those reads.
+		frame.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput, vk::PipelineStageFlagBits::eTransfer,
+											vk::DependencyFlags(), 0, nullptr, 0, nullptr, 0, nullptr);
+
+		vk::DeviceSize stagingOffset = 0;
+		for (const LayerCopy& copy : m_LayerCopies)
+		{
+			const uint8_t* instances = reinterpret_cast<const uint8_t*>(copy.layer->GetBufferData());
+			memcpy(frame.layerStaging.cpuMemoryPtr + stagingOffset, instances + copy.range.offset, copy.range.size);
+
+			auto const region = vk::BufferCopy()
+				.setSrcOffset(stagingOffset)
+				.setDstOffset(copy.range.offset)
+				.setSize(copy.range.size);
+			frame.commandBuffer.copyBuffer(frame.layerStaging.buffer, copy.layer->GetBuffer(), 1, &region);
+			stagingOffset += copy.range.size;
+		}
+		auto result = m_MemoryAllocator->Flush(frame.layerStaging.allocation, 0, stagingSize);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to flush quad layer staging buffer.");
+
+		auto const memoryBarrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eVertexAttributeRead);
+		frame.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput,
+											vk::DependencyFlags(), 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		m_Statistics.layerUploadBytes += stagingSize;
+	}
+
+	uint32_t Renderer::CreateTexture(uint32_t width, uint32_t height, const void* pixels)
+	{
+		CEE_ASSERT_WITH_MESSAGE(!m_FreeTextures.empty(), "Every texture slot is in use.");
+		CEE_ASSERT_WITH_MESSAGE(width > 0 && height > 0 && width <= m_PhysicalDeviceProperties.limits.maxImageDimension2D &&
+								height <= m_PhysicalDeviceProperties.limits.maxImageDimension2D, "Unsupported texture size.");
+
+		uint32_t slot = m_FreeTextures.back();
+		m_FreeTextures.pop_back();
+		Texture& texture = m_Textures[slot];
+		texture.width = width;
+		texture.height = height;
+		texture.mipLevels = 1;
+
+		auto const imageCreateInfo = vk::ImageCreateInfo()
+			.setImageType(vk::ImageType::e2D)
+			.setFormat(vk::Format::eR8G8B8A8Unorm)
+			.setExtent(vk::Extent3D(width, height, 1))
+			.setMipLevels(1)
+			.setArrayLayers(1)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setTiling(vk::ImageTiling::eOptimal)
+			.setInitialLayout(vk::ImageLayout::eUndefined)
+			.setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst)
+			.setQueueFamilyIndexCount(0)
+			.setPQueueFamilyIndices(nullptr)
+			.setSharingMode(vk::SharingMode::eExclusive);
+
+		auto result = m_Device.createImage(&imageCreateInfo, nullptr, &texture.image);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create texture image.");
+
+		result = m_MemoryAllocator->AllocateForImage(texture.image, vk::ImageTiling::eOptimal, vk::MemoryPropertyFlagBits::eDeviceLocal, &texture.allocation);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate memory for texture image.");
+
+		auto const imageViewCreateInfo = vk::ImageViewCreateInfo()
+			.setImage(texture.image)
+			.setFormat(vk::Format::eR8G8B8A8Unorm)
+			.setComponents(vk::ComponentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA))
+			.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1))
+			.setViewType(vk::ImageViewType::e2D);
+
+		result = m_Device.createImageView(&imageViewCreateInfo, nullptr, &texture.view);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create texture image view.");
+
+		const uint8_t* texels = static_cast<const uint8_t*>(pixels);
+		m_PendingTextureUploads.push_back({ slot, std::vector<uint8_t>(texels, texels + (size_t)width * height * 4) });
+		m_TextureDescriptorVersion++;
+		return slot;
+	}
+
+	uint32_t Renderer::LoadTexture(const std::string& filepath)
+	{
+		CEE_ASSERT_WITH_MESSAGE(!m_FreeTextures.empty(), "Every texture slot is in use.");
+		CEE_ASSERT_WITH_MESSAGE(m_MaxTextures > 1, "Loading textures needs room for the placeholder.");
+
+		uint32_t slot = m_FreeTextures.back();
+		m_FreeTextures.pop_back();
+		uint64_t request = ((uint64_t)++m_TextureLoadCounter << 32) | slot;
+		m_TextureLoadRequests[slot] = request;
+		m_TextureLoader->Load(request, filepath);
+		m_TextureDescriptorVersion++;
+		return slot;
+	}
+
+	void Renderer::UpdateTextureLoads(FrameResources& frame)
+	{
+		m_ScratchLoadedTextures.clear();
+		m_TextureLoader->Update(m_Capabilities.textureUploadBudget, &m_ScratchLoadedTextures);
+
+		TextureLoaderStatistics loaderStatistics = m_TextureLoader->GetStatistics();
+		m_Statistics.textureUploadBytes += loaderStatistics.uploadBytes;
+		m_Statistics.textureLoadQueueDepth = loaderStatistics.queueDepth;
+
+		for (LoadedTexture& loaded : m_ScratchLoadedTextures)
+		{
+			uint32_t slot = (uint32_t)(loaded.request & 0xFFFFFFFF);
+			if (m_TextureLoadRequests[slot] != loaded.request)
+			{
+				// The slot was destroyed while loading. This frame's commands acquire the image, so it lives until
+				// the frame completed.
+				if (loaded.texture.image)
+					frame.retiredTextures.push_back(loaded.texture);
+				continue;
+			}
+
+			// Failed loads keep the placeholder until the slot is destroyed.
+			if (!loaded.texture.image)
+				continue;
+
+			m_Textures[slot] = loaded.texture;
+			m_TextureLoadRequests[slot] = 0;
+			m_TextureDescriptorVersion++;
+		}
+	}
+
+	void Renderer::DestroyTexture(uint32_t texture)
+	{
+		CEE_ASSERT_WITH_MESSAGE(texture > 1, "The white and placeholder textures belong to the renderer.");
+		CEE_ASSERT_WITH_MESSAGE(texture < m_MaxTextures && (m_Textures[texture].image || m_TextureLoadRequests[texture]),
+								"Not a texture of this renderer.");
+
+		// A load in flight is left to finish, its texture is dropped when it does.
+		m_TextureLoadRequests[texture] = 0;
+
+		// Any frame in flight may still sample the slot through its descriptor set, and textures are destroyed rarely
+		// enough for waiting on the device to be cheaper than per frame bookkeeping.
+		WaitIdle();
+		m_PendingTextureUploads.erase(std::remove_if(m_PendingTextureUploads.begin(), m_PendingTextureUploads.end(),
+													 [texture](const PendingTextureUpload& upload) { return upload.texture == texture; }),
+									  m_PendingTextureUploads.end());
+		DestroyTextureResources(m_Textures[texture]);
+		m_FreeTextures.push_back(texture);
+		m_TextureDescriptorVersion++;
+	}
+
+	void Renderer::DestroyTextureResources(Texture& texture)
+	{
+		if (!texture.image)
+			return;
+
+		m_Device.destroyImageView(texture.view, nullptr);
+		m_Device.destroyImage(texture.image, nullptr);
+		m_MemoryAllocator->Free(texture.allocation);
+		texture = Texture();
+	}
+
+	void Renderer::UploadTextures(FrameResources& frame)
+	{
+		if (m_PendingTextureUploads.empty())
+			return;
+
+		vk::DeviceSize stagingSize = 0;
+		for (const PendingTextureUpload& upload : m_PendingTextureUploads)
+			stagingSize += upload.pixels.size();
+
+		if (frame.textureStaging.size < stagingSize)
+		{
+			DestroyStagingBuffer(frame.textureStaging);
+			CreateStagingBuffer(frame.textureStaging, stagingSize);
+		}
+
+		// New images have never been used, their previous contents are discarded on the way to the copy layout.
+		const vk::ImageSubresourceRange subresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+		std::vector<vk::ImageMemoryBarrier> imageBarriers(m_PendingTextureUploads.size());
+		for (size_t i = 0; i < m_PendingTextureUploads.size(); i++)
+		{
+			imageBarriers[i] = vk::ImageMemoryBarrier()
+				.setSrcAccessMask(vk::AccessFlags())
+				.setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setOldLayout(vk::ImageLayout::eUndefined)
+				.setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+				.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setImage(m_Textures[m_PendingTextureUploads[i].texture].image)
+				.setSubresourceRange(subresourceRange);
+		}
+		frame.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(),
+											0, nullptr, 0, nullptr, (uint32_t)imageBarriers.size(), imageBarriers.data());
+
+		vk::DeviceSize stagingOffset = 0;
+		for (const PendingTextureUpload& upload : m_PendingTextureUploads)
+		{
+			const Texture& texture = m_Textures[upload.texture];
+			memcpy(frame.textureStaging.cpuMemoryPtr + stagingOffset, upload.pixels.data(), upload.pixels.size());
+
+			auto const region = vk::BufferImageCopy()
+				.setBufferOffset(stagingOffset)
+				.setBufferRowLength(0)
+				.setBufferImageHeight(0)
+				.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+				.setImageOffset(vk::Offset3D(0, 0, 0))
+				.setImageExtent(vk::Extent3D(texture.width, texture.height, 1));
+			frame.commandBuffer.copyBufferToImage(frame.textureStaging.buffer, texture.image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+			stagingOffset += upload.pixels.size();
+		}
+		auto result = m_MemoryAllocator->Flush(frame.textureStaging.allocation, 0, stagingSize);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to flush texture staging buffer.");
+
+		for (vk::ImageMemoryBarrier& imageBarrier : imageBarriers)
+		{
+			imageBarrier
+				.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+				.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+				.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+		}
+		frame.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(),
+											0, nullptr, 0, nullptr, (uint32_t)imageBarriers.size(), imageBarriers.data());
+
+		m_Statistics.textureUploadBytes += stagingSize;
+		m_PendingTextureUploads.clear();
+	}
+
+	void Renderer::UpdateTextureDescriptors(FrameResources& frame)
+	{
+		if (frame.textureDescriptorVersion == m_TextureDescriptorVersion)
+			return;
+
+		// The whole array is rewritten, free slots sample white and slots still loading the placeholder, so the array
+		// is always fully bound.
+		m_ScratchImageInfos.resize(m_MaxTextures);
+		for (uint32_t i = 0; i < m_MaxTextures; i++)
+		{
+			vk::ImageView view = m_Textures[i].image ? m_Textures[i].view :
+								 m_TextureLoadRequests[i] ? m_Textures[1].view : m_Textures[0].view;
+			m_ScratchImageInfos[i] = vk::DescriptorImageInfo(m_TextureSampler, view, vk::ImageLayout::eShaderReadOnlyOptimal);
+		}
+
+		auto const writeDescriptorSet = vk::WriteDescriptorSet()
+			.setDstSet(frame.descriptorSet)
+			.setDescriptorCount(m_MaxTextures)
+			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+			.setPImageInfo(m_ScratchImageInfos.data())
+			.setDstArrayElement(0)
+			.setDstBinding(2);
+		m_Device.updateDescriptorSets(1, &writeDescriptorSet, 0, nullptr);
+		frame.textureDescriptorVersion = m_TextureDescriptorVersion;
+	}
+
+	void WriteQuadVertices(const VertexLayout& layout, uint8_t* vertices, glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color)
+	{
+		glm::mat4 transformation = glm::scale(glm::identity<glm::mat4>(), glm::vec3(scale, 1.0f));
+		transformation = glm::rotate(transformation, rotationAngle, glm::vec3(0.0f, 0.0f, 1.0f));
+		transformation = glm::translate(transformation, glm::vec3(translation, 0.0f));
+
+		// May be written straight into mapped, write-combined memory: every field is stored once,
+		// in order, and never read back.
+		glm::vec2 positions[4];
+		for (uint32_t i = 0; i < 4; i++)
+			positions[i] = glm::vec2(transformation * glm::vec4(g_QuadCorners[i], 0.0f, 1.0f));
+		layout.WriteQuad(vertices, positions, color, g_QuadNormal);
+	}
+
+	void WriteQuadInstance(QuadInstance* instance, glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color,
+						   const Sprite& sprite)
+	{
+		instance->translation = translation;
+		instance->scale = scale;
+		instance->rotation = rotationAngle;
+		instance->color = glm::packUnorm4x8(color);
+		instance->texture = sprite.texture;
+		instance->texCoordMin = glm::packUnorm2x16(glm::vec2(sprite.texCoords.x, sprite.texCoords.y));
+		instance->texCoordMax = glm::packUnorm2x16(glm::vec2(sprite.texCoords.z, sprite.texCoords.w));
+	}
 }
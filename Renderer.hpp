@@ -2,7 +2,13 @@
 #define _RENDERER_HPP
 
 #include "Window.hpp"
-#include "Shader.hpp"
+#include "ShaderLibrary.hpp"
+#include "UploadManager.hpp"
+#include "TextureLoader.hpp"
+#include "GpuProfiler.hpp"
+#include "VertexLayout.hpp"
+#include "QuadTransform.hpp"
+#include "DirtyRangeTracker.hpp"
 #include "Camera.hpp"
 
 #if defined(CEE_OS_WINDOWS)
@@ -13,25 +19,34 @@
 
 #include <glm/glm.hpp>
 
+#include <chrono>
+#include <mutex>
+
 namespace CEE
 {
+	// Swapchain image, or offscreen color image of a headless renderer which then owns its memory.
 	typedef struct SwapchainResources {
 		vk::Image image;
+		Allocation allocation;
 		vk::ImageView view;
+
+		// Signaled by the graphics submit that rendered into this image, waited on by present.
+		vk::Semaphore renderFinishedSemaphore;
+		// Fence of the frame in flight that last rendered into this image.
+		vk::Fence inFlightFence;
 	} SwapchainResources;
 
 	typedef struct DepthBuffer {
 		vk::Format format = vk::Format::eD16Unorm;
 
 		vk::Image image;
-		vk::DeviceMemory memory;
+		Allocation allocation;
 		vk::ImageView view;
 	} DepthBuffer;
 
 	typedef struct UniformBuffer {
 		vk::Buffer buffer;
-		vk::DeviceMemory deviceMemory;
-		vk::MemoryRequirements memoryRequirements;
+		Allocation allocation;
 
 		vk::DescriptorBufferInfo bufferInfo;
 
@@ -40,45 +55,228 @@ namespace CEE
 
 	typedef struct VertexBuffer {
 		vk::Buffer buffer;
-		vk::DeviceMemory deviceMemory;
+		Allocation allocation;
 		vk::DescriptorBufferInfo bufferInfo;
 
 		uint8_t* cpuMemoryPtr;
+		// Pages of the buffer as last written, used when the vertex stream is diffed.
+		DirtyRangeTracker dirtyRanges;
 	} VertexBuffer;
 
 	typedef struct IndexBuffer {
 		vk::Buffer buffer;
-		vk::DeviceMemory deviceMemory;
+		Allocation allocation;
 		vk::DescriptorBufferInfo bufferInfo;
 		vk::IndexType indexType;
-
-		uint8_t* cpuMemoryPtr;
 	} IndexBuffer;
 
-	typedef struct Vertex {
-		glm::vec4 position;
+	// Host visible buffer the frame's command buffer copies from.
+	typedef struct StagingBuffer {
+		vk::Buffer buffer;
+		Allocation allocation;
+		vk::DeviceSize size = 0;
+
+		uint8_t* cpuMemoryPtr = nullptr;
+	} StagingBuffer;
+
+	// Per-instance record of the instanced quad path, the vertex shader expands it into the quad's corners.
+	typedef struct QuadInstance {
+		glm::vec2 translation;
+		glm::vec2 scale;
+		float rotation;
+		uint32_t color; // R8G8B8A8 unorm.
+		uint32_t texture; // Slot in the renderer's texture array.
+		uint32_t texCoordMin; // R16G16 unorm.
+		uint32_t texCoordMax; // R16G16 unorm.
+	} QuadInstance;
+
+	// Part of a texture drawn on a quad and tinted by its color. Texture 0 is a single white texel, which leaves
+	// quads their plain color.
+	typedef struct Sprite {
+		uint32_t texture = 0;
+		// Normalized (min u, min v, max u, max v), see AtlasPacker::GetTexCoords.
+		glm::vec4 texCoords = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	} Sprite;
+
+	typedef struct Quad {
+		glm::vec2 translation;
+		glm::vec2 scale;
+		float rotation;
 		glm::vec4 color;
-		glm::vec3 normal;
-	} Vertex;
+	} Quad;
+
+	// Borrowed view over quads stored as separate arrays, element i of every array describes quad i. Scales,
+	// rotations and colors may be null, missing arrays default to a unit scale, no rotation and white.
+	typedef struct QuadArrays {
+		const glm::vec2* translations;
+		const glm::vec2* scales;
+		const float* rotations;
+		const glm::vec4* colors;
+		size_t count;
+	} QuadArrays;
+
+	// Consecutive quads of a batch or layer buffer.
+	typedef struct QuadRange {
+		uint32_t first;
+		uint32_t count;
+	} QuadRange;
+
+	enum class QuadBatchMode {
+		// Four transformed vertices in the renderer's VertexLayout are written per quad.
+		ePerVertex,
+		// One QuadInstance is written per quad and transformed on the GPU.
+		eInstanced
+	};
+
+	enum class QuadIndexMode {
+		// Quads are drawn from an index buffer, 32 bit indices are picked when a batch exceeds 65536 vertices.
+		eIndexed,
+		// No index buffer, the vertex shader generates both triangles from gl_VertexIndex. Instanced batches only.
+		eGenerated
+	};
+
+	// Shared by Renderer::DrawQuad and QuadBucket so both produce identical batch data.
+	void WriteQuadVertices(const VertexLayout& layout, uint8_t* vertices, glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color);
+	void WriteQuadInstance(QuadInstance* instance, glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color,
+						   const Sprite& sprite = Sprite());
+
+	class QuadBucket;
+	class QuadLayer;
+
+	typedef struct FrameResources {
+		vk::CommandBuffer commandBuffer;
+		vk::Fence fence;
+		vk::Semaphore imageAcquiredSemaphore;
+
+		UniformBuffer mvpBuffer;
+		vk::DescriptorSet descriptorSet;
+
+		// Vertex buffers for this frame's batches, vertexBufferCount of them are in use by the current submission.
+		std::vector<VertexBuffer> vertexBuffers;
+		uint32_t vertexBufferCount;
+
+		// Source of the quad layer updates BeginScene records ahead of the render pass, grown on demand.
+		StagingBuffer layerStaging;
+		// Same for texture uploads.
+		StagingBuffer textureStaging;
+		// Renderer::m_TextureDescriptorVersion the texture array of descriptorSet was last written at.
+		uint32_t textureDescriptorVersion = 0;
+		// Host visible copy of the frame's color image, recorded by EndScene when a readback was requested and
+		// collected once the frame's fence signaled.
+		StagingBuffer readback;
+		vk::Extent2D readbackExtent;
+		bool readbackPending = false;
+		uint64_t readbackFrame = 0;
+		// Set when EndScene wrote the latency timestamp, see RendererStatistics::acquireToGpuDoneTime.
+		bool latencyPending = false;
+		std::chrono::steady_clock::time_point acquiredTime;
+		// Streamed textures nobody wants anymore, destroyed once this frame's fence signals as the frame's commands
+		// may acquire them.
+		std::vector<Texture> retiredTextures;
+	} FrameResources;
+
+	// Color image of a frame copied back to the host, see Renderer::RequestReadback.
+	typedef struct FrameReadback {
+		// Renderer::GetFrameNumber during the frame's scene.
+		uint64_t frame;
+		uint32_t width;
+		uint32_t height;
+		// Tightly packed R8G8B8A8 unorm rows, top row first, whatever the swapchain format.
+		std::vector<uint8_t> pixels;
+	} FrameReadback;
 
 	typedef struct RendererCapabilities {
 		const size_t maxIndices;
 		const size_t maxVertices;
 
-		RendererCapabilities(size_t maxIndices)
-			: maxIndices(maxIndices), maxVertices((maxIndices * 4) / 6)
+		// Number of frames the CPU may record ahead of the GPU, 1 fully serializes every frame.
+		const uint32_t framesInFlight;
+
+		// Preferred present mode, falls back to the closest supported mode and finally to FIFO.
+		vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+		// Requested swapchain image count, 0 uses the surface minimum. Clamped to the surface limits.
+		uint32_t swapchainImageCount = 0;
+		// Size of the color and depth images headless renderers draw into, one color image per frame in flight.
+		vk::Extent2D offscreenExtent = vk::Extent2D(1280, 720);
+
+		QuadBatchMode batchMode = QuadBatchMode::eInstanced;
+		QuadIndexMode indexMode = QuadIndexMode::eIndexed;
+		// Vertex formats of the per-vertex batch mode.
+		VertexLayout vertexLayout = VertexLayout::Packed();
+		// Batches are written to a CPU copy first and only pages that changed since the same vertex buffer was last
+		// filled are copied to it. Pays off for scenes that mostly repeat from frame to frame.
+		bool diffVertexStream = false;
+		// Quads drawn through DrawQuad, DrawQuads and spatially indexed layers are tested against the view bounds on
+		// the CPU and dropped when off screen. Quad buckets are never culled.
+		bool cullQuads = true;
+		// Slots of the texture array sprites index, clamped to the device's per stage sampler limits.
+		uint32_t maxTextures = 256;
+		// Bytes of streamed texture data staged per frame, larger textures are uploaded over several frames.
+		vk::DeviceSize textureUploadBudget = 4 * 1024 * 1024;
+		// Reports how the renderer was set up (present mode, upload queue, batch format, shader and pipeline
+		// creation times) on stdout.
+		bool printStatistics = false;
+		// Timestamps around the uploads, the render pass and every draw of each frame, see Renderer::GetGpuProfile.
+		bool gpuProfiling = false;
+
+		RendererCapabilities(size_t maxIndices, uint32_t framesInFlight = 2)
+			: maxIndices(maxIndices), maxVertices((maxIndices * 4) / 6), framesInFlight(framesInFlight)
 		{ }
 	} RendererCapabilities;
 
 	typedef struct RendererStatistics {
+		// Number of batches submitted this frame.
 		uint32_t drawCalls;
 		
 		size_t indices;
 		size_t vertices;
 
 		size_t quads;
+
+		// Milliseconds between consecutive BeginScene calls and milliseconds spent waiting for the frame's fence.
+		float frameTime;
+		float fenceWaitTime;
+		// CPU milliseconds from acquireNextImageKHR returning to presentKHR returning, or to the submit returning for
+		// headless renderers: recording and handing over the frame. Says nothing about when the GPU finished it or
+		// the image reached the screen.
+		float recordTime;
+		// Milliseconds from acquireNextImageKHR returning to the GPU finishing the frame, for the frame submitted
+		// framesInFlight frames earlier. Scanout is not included. 0 without VK_EXT_calibrated_timestamps.
+		float acquireToGpuDoneTime;
+
+		// Quads written through DrawQuads, milliseconds spent writing them and the resulting throughput.
+		size_t bulkQuads;
+		float bulkWriteTime;
+		float bulkQuadsPerSecond;
+
+		// Quads drawn from quad layers and bytes of layer data uploaded for them.
+		size_t layerQuads;
+		size_t layerUploadBytes;
+
+		// Bytes of batch data copied to the vertex buffers, and bytes diffing found unchanged and skipped.
+		size_t vertexUploadBytes;
+		size_t vertexSkippedBytes;
+
+		// Quads that went through culling and were kept or dropped.
+		size_t visibleQuads;
+		size_t culledQuads;
+
+		// Bytes of texel data uploaded, streamed textures included.
+		size_t textureUploadBytes;
+		// Textures requested through LoadTexture and not shown yet.
+		uint32_t textureLoadQueueDepth;
 	} RendererStatistics;
 
+	typedef struct UploadBandwidth {
+		vk::DeviceSize size;
+		// Whether the upload went through the dedicated transfer queue or the graphics queue.
+		bool transferQueue;
+		// Milliseconds of the fastest upload from the copy into the staging ring to its ticket completing, and the
+		// resulting MiB per second.
+		float time;
+		float bandwidth;
+	} UploadBandwidth;
+
 	class Renderer
 	{
 	public:
@@ -87,12 +285,86 @@ namespace CEE
 #elif defined(CEE_WM_XCB)
 		Renderer(xcb_connection_t* connection, Window* window, RendererCapabilities capabilities);
 #endif
+		// Headless renderer drawing into offscreen images, for machines without a display. Needs neither a window nor
+		// surface and swapchain support from the driver, software implementations such as lavapipe suffice.
+		Renderer(RendererCapabilities capabilities);
 		~Renderer();
 
 		void BeginScene(Camera& camera);
 		void EndScene();
 
 		void DrawQuad(glm::vec2 translation, glm::vec2 scale, float rotationAngle, glm::vec4 color);
+		// Same result as calling DrawQuad for each quad, the per-vertex path transforms them with the SIMD kernel.
+		void DrawQuads(const Quad* quads, size_t count);
+		// Reads the arrays in place, the per-vertex path hands them to the SIMD kernel without gathering.
+		void DrawQuads(const QuadArrays& quads);
+		// Textured quad, instanced batch mode only. Sprites batch together whatever their texture.
+		void DrawSprite(glm::vec2 translation, glm::vec2 scale, float rotationAngle, const Sprite& sprite, glm::vec4 color = glm::vec4(1.0f));
+
+		// Thread safe. The bucket is merged into the scene by EndScene and must stay alive and unchanged until then.
+		void SubmitQuadBucket(const QuadBucket& bucket);
+
+		// The renderer owns its layers. Destroying one waits for the GPU to finish with it. A cell size above 0 gives
+		// the layer a spatial index, only cells in view are drawn.
+		QuadLayer* CreateQuadLayer(uint32_t capacity, float cellSize = 0.0f);
+		void DestroyQuadLayer(QuadLayer* layer);
+		// Drawn in call order with the immediate quads, through the instanced pipeline whatever the batch mode.
+		void DrawQuadLayer(const QuadLayer& layer);
+
+		// Returns the texture's slot for Sprite::texture. Pixels are tightly packed R8G8B8A8 unorm rows, copied before
+		// returning and uploaded by the next BeginScene. Destroying a texture waits for the GPU to finish with it and
+		// must not happen between BeginScene and EndScene.
+		uint32_t CreateTexture(uint32_t width, uint32_t height, const void* pixels);
+		void DestroyTexture(uint32_t texture);
+		// Returns the texture's slot right away, sprites using it show a checkerboard placeholder until
+		// the file is decoded and uploaded by worker threads and the transfer queue, or for good if that failed.
+		// See DecodeImageFile for the supported files.
+		uint32_t LoadTexture(const std::string& filepath);
+		inline uint32_t GetMaxTextures() const { return m_MaxTextures; }
+		// False if the device can't index the texture array non-uniformly, sprites are then drawn untextured.
+		inline bool HasSpriteTextures() const { return m_NonUniformTextureIndexing; }
+
+		// Thread safe. Copies data into a device local buffer on the transfer queue without stalling rendering. The
+		// buffer may be used by scenes begun after the returned ticket completed. Without a dedicated transfer queue
+		// the uploads go to the graphics queue, whose submissions are serialized with those of the render thread.
+		UploadTicket UploadBuffer(vk::Buffer buffer, vk::DeviceSize offset, const void* data, vk::DeviceSize size);
+		bool IsUploadComplete(UploadTicket ticket);
+		void WaitForUpload(UploadTicket ticket);
+
+		inline QuadBatchMode GetBatchMode() const { return m_Capabilities.batchMode; }
+		inline const VertexLayout& GetVertexLayout() const { return m_Capabilities.vertexLayout; }
+
+		inline const RendererStatistics& GetStatistics() const { return m_LastFrameStatistics; }
+		inline vk::PresentModeKHR GetPresentMode() const { return m_PresentMode; }
+		inline bool IsHeadless() const { return m_Headless; }
+		inline vk::Extent2D GetExtent() const { return m_SwapchainExtent; }
+
+		// Copies the color image of the scene being recorded to the host at the end of the scene, without waiting for
+		// it. Windowed renderers can only do so when the surface allows transfers from swapchain images.
+		void RequestReadback();
+		// Hands out completed readbacks in frame order. Returns false when none completed yet, or with wait set blocks
+		// for the oldest one in flight and only returns false when none was requested.
+		bool TakeReadback(FrameReadback* readback, bool wait = false);
+		// Scenes ended since the renderer was created.
+		inline uint64_t GetFrameNumber() const { return m_FrameNumber; }
+
+		// Headless only. Waits for the last frame ended and copies its color image into pixels as tightly packed
+		// R8G8B8A8 unorm rows, top row first. Must not be called between BeginScene and EndScene.
+		void ReadFrame(std::vector<uint8_t>* pixels);
+		// Statistics of the timestamped scopes: "frame", "uploads", "render pass", "batch <n>" and "layer <n>" for the
+		// n-th batch and quad layer draw of a frame, and "readback". Results lag framesInFlight frames behind. Empty
+		// unless RendererCapabilities::gpuProfiling is set and the graphics queue supports timestamps.
+		GpuProfile GetGpuProfile() const;
+		vk::Result WriteGpuProfile(const std::string& filepath) const;
+		void ResetGpuProfile();
+		inline bool IsGpuProfiling() const { return m_GpuProfiler != nullptr; }
+
+		inline MemoryStatistics GetMemoryStatistics() const { return m_MemoryAllocator->GetStatistics(); }
+		inline UploadStatistics GetUploadStatistics() const { return m_UploadManager->GetStatistics(); }
+		// Uploads each size into a scratch device local buffer, through the dedicated transfer queue if there is one
+		// and through the graphics queue, and keeps the fastest of the repetitions. Uses its own staging rings, so
+		// the upload statistics stay untouched. Must not be called between BeginScene and EndScene.
+		std::vector<UploadBandwidth> MeasureUploadBandwidth(const std::vector<vk::DeviceSize>& sizes, uint32_t repetitions);
 		
 	private:
 		void InitalizeRenderer();
@@ -101,9 +373,12 @@ namespace CEE
 		void InitalizeSurface();
 		void InitalizeDevice();
 		void InitalizeCommandBuffer();
+		void InitalizeUploadManager();
 		void InitalizeSwapchain();
+		void InitalizeOffscreenTargets();
 		void InitalizeDepthBuffer();
 		void InitalizeUniformBuffer();
+		void InitalizeTextures();
 		void InitalizePipelineLayout();
 		void InitalizeDescriptorSet();
 		void InitalizeRenderPass();
@@ -111,12 +386,63 @@ namespace CEE
 		void InitalizeFramebuffers();
 		void InitalizeVertexBuffer();
 		void InitalizeIndexBuffer();
+		void InitalizePipelineCache();
 		void InitalizePipeline();
 		void InitalizeSyncronisation();
+		void InitalizeGpuProfiler();
+		void InitalizeLatencyQueries();
+
+		void CreateVertexBuffer(VertexBuffer& vertexBuffer);
+		void DestroyVertexBuffer(VertexBuffer& vertexBuffer);
+		void CreateStagingBuffer(StagingBuffer& stagingBuffer, vk::DeviceSize size);
+		// Host visible copy destination, preferably cached for fast reads on the CPU.
+		void CreateReadbackBuffer(StagingBuffer& stagingBuffer, vk::DeviceSize size);
+		void DestroyStagingBuffer(StagingBuffer& stagingBuffer);
+
+		void CreateQuadPipeline(Shader* shader, const vk::VertexInputBindingDescription& bindingDescription,
+								const std::vector<vk::VertexInputAttributeDescription>& attributeDescriptions, bool instanced, vk::Pipeline* pipeline);
+		void BindPipeline(vk::Pipeline pipeline);
+		void UploadQuadLayers(FrameResources& frame);
+		void UploadTextures(FrameResources& frame);
+		void UpdateTextureLoads(FrameResources& frame);
+		void UpdateTextureDescriptors(FrameResources& frame);
+		void DestroyTextureResources(Texture& texture);
+
+		void BeginBatch();
+		void Flush();
+		// Makes the batch's quads since m_BatchFirstQuad visible to the device, diffing them if enabled.
+		void WriteBatchToDevice();
+		void AppendQuadBucket(const QuadBucket& bucket);
+		// Makes room for up to count quads in the current batch and returns how many, CommitBatchQuads adds the
+		// ones actually written.
+		uint32_t ReserveBatchQuads(size_t count, uint8_t** destination);
+		void CommitBatchQuads(uint32_t quadCount);
+		// Transforms a chunk with the SIMD kernel, culls it if enabled and writes the remaining quads in the batch
+		// format. Returns the number written.
+		uint32_t WriteQuadChunk(const QuadTransformInput& input, const glm::vec4* colors, uint32_t count, uint8_t* destination);
+		bool IsQuadVisible(glm::vec2 translation, glm::vec2 scale, float rotationAngle) const;
+
+		void SavePipelineCache();
+		void UpdateViewport();
 
 		void Resize();
-
-		const bool GetMemoryTypeFromProperties(uint32_t typeBits, vk::MemoryPropertyFlags requirementsMask, uint32_t* typeIndex);
+		void DestroySwapchainResources();
+		void AcquireNextImage(FrameResources& frame);
+		void RecordReadback(FrameResources& frame);
+		// The frame's fence must have signaled.
+		void CollectReadback(FrameResources& frame);
+		// The frame's fence must have signaled.
+		void CollectLatency(FrameResources& frame);
+		void Present(SwapchainResources& swapchainResources);
+		// vkDeviceWaitIdle under the queue mutex.
+		void WaitIdle();
+
+		// Both do nothing without a profiler, EndGpuScope takes what BeginGpuScope returned. Scope ids are those
+		// registered in m_GpuScopeIds, the index only counts for the batch and layer scopes.
+		uint32_t BeginGpuScope(uint32_t scopeId, uint32_t index = 0);
+		void EndGpuScope(uint32_t scope);
+
+		vk::PresentModeKHR SelectPresentMode(const vk::PresentModeKHR* presentModes, uint32_t presentModeCount) const;
 
 	private:
 #if defined(CEE_OS_WINDOWS)
@@ -125,13 +451,27 @@ namespace CEE
 		static xcb_connection_t* s_Connection;
 #endif
 
-		Window* m_Window;
+		Window* m_Window = nullptr;
 		
 		const RendererCapabilities m_Capabilities;
+		// No surface or swapchain, frame i renders into offscreen image i and nothing is presented.
+		bool m_Headless = false;
+		// Some frame ended since the renderer was created, its image is m_CurrentBuffer.
+		bool m_FrameRendered = false;
+		// Swapchain or offscreen images can be the source of transfers.
+		bool m_ColorImagesReadable = false;
+		// shaderSampledImageArrayNonUniformIndexing is supported and enabled.
+		bool m_NonUniformTextureIndexing = false;
+		uint64_t m_FrameNumber = 0;
+		bool m_ReadbackRequested = false;
+		std::deque<FrameReadback> m_CompletedReadbacks;
 		bool m_Prepared;
 		bool m_Validate;
 
 		RendererStatistics m_Statistics;
+		RendererStatistics m_LastFrameStatistics;
+		std::chrono::steady_clock::time_point m_LastBeginSceneTime;
+		std::chrono::steady_clock::time_point m_ImageAcquiredTime;
 		
 		vk::Instance m_Instance;
 		vk::PhysicalDevice m_PhysicalDevice;
@@ -148,24 +488,35 @@ namespace CEE
 
 		uint32_t m_QueueFamilyCount;
 		std::unique_ptr<vk::QueueFamilyProperties[]> m_QueueFamilyProperties;
-		uint32_t m_GraphicsQueueFamilyIndex = UINT32_MAX, m_PresentQueueFamilyIndex = UINT32_MAX;
+		uint32_t m_GraphicsQueueFamilyIndex = UINT32_MAX, m_PresentQueueFamilyIndex = UINT32_MAX, m_TransferQueueFamilyIndex = UINT32_MAX;
 		bool m_SeperatePresentQueue = false;
+		bool m_SeperateTransferQueue = false;
+		bool m_CalibratedTimestamps = false;
+		// Guards every submit, present and wait for idle on any queue. Without a dedicated transfer queue uploads from
+		// worker threads go to the graphics queue, and device wide waits need all queues synchronized anyway.
+		std::mutex m_QueueMutex;
+
+		std::unique_ptr<MemoryAllocator> m_MemoryAllocator;
+		std::unique_ptr<UploadManager> m_UploadManager;
 
 		vk::CommandPool m_CommandPool;
-		vk::CommandBuffer m_CommandBuffer;
 
-		vk::Queue m_GraphicsQueue, m_PresentQueue;
+		std::unique_ptr<FrameResources[]> m_Frames;
+		uint32_t m_FrameIndex = 0;
+
+		vk::Queue m_GraphicsQueue, m_PresentQueue, m_TransferQueue;
 
 		vk::Format m_Format;
 		vk::Extent2D m_SwapchainExtent;
 
 		vk::SwapchainKHR m_Swapchain;
+		vk::PresentModeKHR m_PresentMode = vk::PresentModeKHR::eFifo;
 		uint32_t m_SwapchainImageCount = 0;
 		std::unique_ptr<SwapchainResources[]> m_SwapchainResources;
 		uint32_t m_CurrentBuffer;
+		bool m_SwapchainOutOfDate = false;
 
 		DepthBuffer m_DepthBuffer;
-		UniformBuffer m_MvpBuffer;
 
 		uint32_t m_DescriptorSetCount;
 		std::unique_ptr<vk::DescriptorSetLayout[]> m_DescriptorSetLayouts;
@@ -174,28 +525,115 @@ namespace CEE
 
 		vk::PipelineLayout m_PipelineLayout;
 		vk::Pipeline m_Pipeline;
+		// Draws quad layers, the same pipeline as m_Pipeline in the instanced batch mode.
+		vk::Pipeline m_InstancedPipeline;
+		vk::Pipeline m_BoundPipeline;
+		vk::PipelineCache m_PipelineCache;
+		std::string m_PipelineCachePath;
+		bool m_PipelineCacheWarm = false;
 
 		vk::RenderPass m_RenderPass;
 
-		std::unique_ptr<Shader> m_Shader;
+		std::unique_ptr<ThreadPool> m_ThreadPool;
+		std::unique_ptr<ShaderCache> m_ShaderCache;
+		std::unique_ptr<ShaderLibrary> m_ShaderLibrary;
+		Shader* m_Shader = nullptr;
+		Shader* m_InstancedShader = nullptr;
 
 		std::unique_ptr<vk::Framebuffer[]> m_Framebuffers;
 
-		VertexBuffer m_VertexBuffer;
 		vk::VertexInputBindingDescription m_VertexInputBindingDescription;
-		vk::VertexInputAttributeDescription m_VertexInputAttributeDescriptions[3];
+		std::vector<vk::VertexInputAttributeDescription> m_VertexInputAttributeDescriptions;
+		vk::VertexInputBindingDescription m_InstanceBindingDescription;
+		std::vector<vk::VertexInputAttributeDescription> m_InstanceAttributeDescriptions;
 
 		IndexBuffer m_IndexBuffer;
+		QuadIndexMode m_IndexMode;
 
 		vk::Viewport m_Viewport;
 		vk::Rect2D m_ScissorRect;
 
-		vk::Semaphore m_ImageAcquiredSemaphore;
-		vk::Fence m_Fence;
-
 		glm::mat4 m_Model, m_View, m_Projection;
-
-		std::vector<Vertex> m_Vertices;
+		// Model space box (min x, min y, max x, max y) covering the viewport, recomputed by BeginScene.
+		glm::vec4 m_ViewBounds;
+
+		// The batch being written, DrawQuad writes directly into the mapped memory of m_BatchVertexBuffer.
+		VertexBuffer* m_BatchVertexBuffer = nullptr;
+		uint8_t* m_BatchMemory = nullptr;
+		uint32_t m_BatchQuadCount = 0;
+		// Quads before m_BatchFirstQuad were already drawn by an earlier Flush.
+		uint32_t m_BatchFirstQuad = 0;
+		uint32_t m_BatchQuadCapacity;
+		// Bytes written per quad, four vertices or one QuadInstance depending on the batch mode.
+		uint32_t m_BatchQuadStride;
+
+		// Chunk of quads gathered for and transformed by the SIMD kernel, sized to stay in cache.
+		std::vector<glm::vec2> m_ScratchTranslations;
+		std::vector<glm::vec2> m_ScratchScales;
+		std::vector<float> m_ScratchRotations;
+		std::vector<glm::vec4> m_ScratchColors;
+		std::vector<float> m_ScratchCorners;
+		std::vector<uint32_t> m_ScratchVisible;
+		std::vector<QuadRange> m_ScratchQuadRanges;
+
+		// CPU copy of the batch being written when the vertex stream is diffed.
+		std::vector<uint8_t> m_BatchShadow;
+		std::vector<DirtyRange> m_ScratchDirtyRanges;
+
+		typedef struct LayerCopy {
+			QuadLayer* layer;
+			DirtyRange range;
+		} LayerCopy;
+		std::vector<LayerCopy> m_LayerCopies;
+
+		std::mutex m_SubmittedBucketsMutex;
+		std::vector<const QuadBucket*> m_SubmittedBuckets;
+
+		std::vector<std::unique_ptr<QuadLayer>> m_QuadLayers;
+
+		// Indexed by slot. Free slots hold no image, their descriptors point at the white texture in slot 0, slots
+		// still loading point at the placeholder in slot 1.
+		uint32_t m_MaxTextures;
+		std::vector<Texture> m_Textures;
+		std::vector<uint32_t> m_FreeTextures;
+		// Per slot, the load request the slot waits for or 0. Requests are the slot in the low and a counter in
+		// the high 32 bits, so a load finishing after its slot was destroyed and reused is told apart.
+		std::vector<uint64_t> m_TextureLoadRequests;
+		uint32_t m_TextureLoadCounter = 0;
+		std::unique_ptr<TextureLoader> m_TextureLoader;
+		std::vector<LoadedTexture> m_ScratchLoadedTextures;
+		vk::Sampler m_TextureSampler;
+		// Bumped whenever a slot changes, frames rewrite their texture array when theirs is older.
+		uint32_t m_TextureDescriptorVersion = 1;
+		std::vector<vk::DescriptorImageInfo> m_ScratchImageInfos;
+
+		typedef struct PendingTextureUpload {
+			uint32_t texture;
+			std::vector<uint8_t> pixels;
+		} PendingTextureUpload;
+		std::vector<PendingTextureUpload> m_PendingTextureUploads;
+
+		std::unique_ptr<GpuProfiler> m_GpuProfiler;
+		typedef struct GpuScopeIds {
+			uint32_t frame;
+			uint32_t uploads;
+			uint32_t renderPass;
+			uint32_t batch;
+			uint32_t layer;
+			uint32_t readback;
+		} GpuScopeIds;
+		GpuScopeIds m_GpuScopeIds = {};
+
+		// One timestamp per frame in flight written at the end of the frame, VK_NULL_HANDLE when latency is not measured.
+		vk::QueryPool m_LatencyQueryPool;
+		uint64_t m_LatencyTimestampMask = 0;
+		PFN_vkGetCalibratedTimestampsEXT m_GetCalibratedTimestamps = nullptr;
+		// Batch and layer draws of the current frame, numbering their scopes.
+		uint32_t m_GpuBatchScopes = 0;
+		uint32_t m_GpuLayerScopes = 0;
+		// Open for the whole frame and for the render pass.
+		uint32_t m_GpuFrameScope = UINT32_MAX;
+		uint32_t m_GpuRenderPassScope = UINT32_MAX;
 		
 		vk::PolygonMode m_PolygonMode;
 	};
@@ -5,8 +5,8 @@
 
 namespace CEE
 {
-	Shader::Shader(vk::Device* device)
-		: m_Device(device)
+	Shader::Shader(vk::Device* device, ShaderCache* cache)
+		: m_Device(device), m_Cache(cache)
 	{
 
 	}
@@ -22,120 +22,112 @@ namespace CEE
 		std::string vertexSource;
 		std::string fragmentSource;
 
-		std::ifstream vertexFile(vertexFilepath, std::ios::binary);
-		if (!vertexFile.is_open())
-		{
-			fprintf(stderr, "Failed to open vertex source!\n");
-			return vk::Result::eErrorUnknown;
-		}
-		size_t fileSize = vertexFile.tellg();
-		vertexFile.seekg(0, std::ios::end);
-		fileSize = (size_t)vertexFile.tellg() - fileSize;
-
-		vertexFile.seekg(0, std::ios::beg);
-
-		char* fileBuffer = (char*)malloc(fileSize);
-		if (!fileBuffer)
-			return vk::Result::eErrorUnknown;
-
-		vertexFile.read(fileBuffer, fileSize);
-
-		vertexSource.reserve(fileSize);
-		vertexSource.assign(fileBuffer, fileSize);
+		auto result = ReadSourceFile(vertexFilepath, vertexSource);
+		if (result != vk::Result::eSuccess)
+			return result;
+		result = ReadSourceFile(fragmentFilepath, fragmentSource);
+		if (result != vk::Result::eSuccess)
+			return result;
 
-		vertexFile.close();
+		return this->CompileShadersFromGLSL(vertexSource, fragmentSource);
+	}
 
-		std::ifstream fragmentFile(fragmentFilepath, std::ios::binary);
-		if (!fragmentFile.is_open())
+	vk::Result Shader::ReadSourceFile(const std::string& filepath, std::string& source)
+	{
+		std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
 		{
-			fprintf(stderr, "Failed to open fragment source!\n");
+			fprintf(stderr, "Failed to open shader source %s!\n", filepath.c_str());
 			return vk::Result::eErrorUnknown;
 		}
+		size_t fileSize = (size_t)file.tellg();
+		file.seekg(0, std::ios::beg);
 
-		fileSize = fragmentFile.tellg();
-		fragmentFile.seekg(0, std::ios::end);
-		fileSize = (size_t)fragmentFile.tellg() - fileSize;
-
-		fragmentFile.seekg(0, std::ios::beg);
-
-		fileBuffer = (char*)realloc(fileBuffer, fileSize);
-		if (!fileBuffer)
+		source.resize(fileSize);
+		file.read(&source[0], fileSize);
+		if (!file)
 			return vk::Result::eErrorUnknown;
+		return vk::Result::eSuccess;
+	}
 
-		fragmentFile.read(fileBuffer, fileSize);
-
-		fragmentSource.reserve(fileSize);
-		fragmentSource.assign(fileBuffer, fileSize);
-
-		fragmentFile.close();
+	std::string Shader::GetCacheCompileOptions(shaderc_optimization_level optimizationLevel)
+	{
+		// The SPIR-V version shaderc reports only names the highest version it can target, not the compiler build,
+		// so the shaderc and glslang versions are baked in by CMake.
+		unsigned int spirvVersion = 0, spirvRevision = 0;
+		shaderc_get_spv_version(&spirvVersion, &spirvRevision);
+		std::stringstream compileOptions;
+		compileOptions << "glsl;spirv1.3;O" << (int)optimizationLevel << ";shaderc-spv" << spirvVersion << "." << spirvRevision
+					   << ";" << CEE_SHADER_COMPILER_VERSION;
+		return compileOptions.str();
+	}
 
-		free(fileBuffer);
+	vk::Result Shader::CompileShadersFromGLSL(std::string vertexSource, std::string fragmentSource)
+	{
+		auto result = CompileStageFromGLSL(vk::ShaderStageFlagBits::eVertex, vertexSource);
+		if (result != vk::Result::eSuccess)
+			return result;
+		return CompileStageFromGLSL(vk::ShaderStageFlagBits::eFragment, fragmentSource);
+	}
 
-		return this->CompileShadersFromGLSL(vertexSource, fragmentSource);
+	vk::Result Shader::CompileStageFromGLSL(vk::ShaderStageFlagBits stage, const std::string& source, bool* cacheHit)
+	{
+		switch (stage)
+		{
+			case vk::ShaderStageFlagBits::eVertex:
+				return CompileStage(source, shaderc_vertex_shader, "vertex", &m_VertexModule, cacheHit);
+			case vk::ShaderStageFlagBits::eFragment:
+				return CompileStage(source, shaderc_fragment_shader, "fragment", &m_FragmentModule, cacheHit);
+			default:
+				fprintf(stderr, "Unsupported shader stage %s!\n", vk::to_string(stage).c_str());
+				return vk::Result::eErrorUnknown;
+		}
 	}
 
-	vk::Result Shader::CompileShadersFromGLSL(std::string vertexSource, std::string fragmentSource)
+	vk::Result Shader::CompileStage(const std::string& source, shaderc_shader_kind kind, const char* stageName, vk::ShaderModule* module, bool* cacheHit)
 	{
-		shaderc::Compiler compiler;
-		shaderc::CompileOptions compilerOptions;
-		compilerOptions.SetSourceLanguage(shaderc_source_language_glsl);
-		compilerOptions.SetTargetSpirv(shaderc_spirv_version_1_3);
 #if defined(_NDEBUG)
-		compilerOptions.SetOptimizationLevel(shaderc_optimization_level_performance);
+		shaderc_optimization_level optimizationLevel = shaderc_optimization_level_performance;
 #else
-		compilerOptions.SetOptimizationLevel(shaderc_optimization_level_zero);
+		shaderc_optimization_level optimizationLevel = shaderc_optimization_level_zero;
 #endif
-		shaderc::CompilationResult<uint32_t> compilationResult;
-		// VERTEX
+		std::vector<uint32_t> spirv;
+		uint64_t cacheKey = 0;
+		if (m_Cache)
 		{
-			compilationResult = compiler.CompileGlslToSpv(vertexSource, shaderc_vertex_shader, "Compiled from hardcoded source", compilerOptions);
-			if (compilationResult.GetCompilationStatus() != shaderc_compilation_status_success)
-			{
-				if (compilationResult.GetNumErrors() > 0)
-				{
-					fprintf(stderr, "Failed to compile vertex shader!\n\tError message: %s\n", compilationResult.GetErrorMessage().c_str());
-					return vk::Result::eErrorUnknown;
-				}
-				else
-				{
-					fprintf(stderr, "Failed to compile vertex shader!\n\tUnknown error!\n");
-					return vk::Result::eErrorUnknown;
-				}
-			}
-
-			auto shaderModuleCreateInfo = vk::ShaderModuleCreateInfo()
-				.setCodeSize(4 * ((uint32_t)(compilationResult.end() - compilationResult.begin())))
-				.setPCode(compilationResult.begin());
-
-			auto result = m_Device->createShaderModule(&shaderModuleCreateInfo, nullptr, &m_VertexModule);
-			if (result != vk::Result::eSuccess)
-				return result;
+			cacheKey = ShaderCache::ComputeKey(source, (uint32_t)kind, GetCacheCompileOptions(optimizationLevel));
+			m_Cache->Load(cacheKey, spirv);
 		}
-		// FRAGMENT
+		if (cacheHit)
+			*cacheHit = !spirv.empty();
+
+		if (spirv.empty())
 		{
-			compilationResult = compiler.CompileGlslToSpv(fragmentSource, shaderc_fragment_shader, "Compiled from hardcoded source", compilerOptions);
+			shaderc::Compiler compiler;
+			shaderc::CompileOptions compilerOptions;
+			compilerOptions.SetSourceLanguage(shaderc_source_language_glsl);
+			compilerOptions.SetTargetSpirv(shaderc_spirv_version_1_3);
+			compilerOptions.SetOptimizationLevel(optimizationLevel);
+
+			shaderc::CompilationResult<uint32_t> compilationResult = compiler.CompileGlslToSpv(source, kind, "Compiled from hardcoded source", compilerOptions);
 			if (compilationResult.GetCompilationStatus() != shaderc_compilation_status_success)
 			{
 				if (compilationResult.GetNumErrors() > 0)
-				{
-					fprintf(stderr, "Failed to compile fragment shader!\n\tError message: %s\n", compilationResult.GetErrorMessage().c_str());
-					return vk::Result::eErrorUnknown;
-				}
+					fprintf(stderr, "Failed to compile %s shader!\n\tError message: %s\n", stageName, compilationResult.GetErrorMessage().c_str());
 				else
-				{
-					fprintf(stderr, "Failed to compile fragment shader!\n\tUnknown error!\n");
-					return vk::Result::eErrorUnknown;
-				}
+					fprintf(stderr, "Failed to compile %s shader!\n\tUnknown error!\n", stageName);
+				return vk::Result::eErrorUnknown;
 			}
+			spirv.assign(compilationResult.begin(), compilationResult.end());
 
-			auto shaderModuleCreateInfo = vk::ShaderModuleCreateInfo()
-				.setCodeSize(4 * ((uint32_t)(compilationResult.end() - compilationResult.begin())))
-				.setPCode(compilationResult.begin());
-
-			auto result = m_Device->createShaderModule(&shaderModuleCreateInfo, nullptr, &m_FragmentModule);
-			if (result != vk::Result::eSuccess)
-				return result;
+			if (m_Cache && !m_Cache->Store(cacheKey, spirv))
+				fprintf(stderr, "Failed to store %s shader in the shader cache.\n", stageName);
 		}
-		return vk::Result::eSuccess;
+
+		auto shaderModuleCreateInfo = vk::ShaderModuleCreateInfo()
+			.setCodeSize(sizeof(uint32_t) * spirv.size())
+			.setPCode(spirv.data());
+
+		return m_Device->createShaderModule(&shaderModuleCreateInfo, nullptr, module);
 	}
 }
@@ -4,22 +4,38 @@
 #include <vulkan/vulkan.hpp>
 #include <shaderc/shaderc.hpp>
 
+#include "ShaderCache.hpp"
+
 namespace CEE
 {
 	class Shader
 	{
 	public:
-		Shader(vk::Device* device);
+		// The cache is optional, without one every stage is compiled from source.
+		Shader(vk::Device* device, ShaderCache* cache = nullptr);
 		~Shader();
 
 		vk::Result CompileShadersFromFiles(std::string vertexFilepath, std::string fragmentFilepath);
 		vk::Result CompileShadersFromGLSL(std::string vertexSource, std::string fragmentSource);
 
+		// Compiles a single stage. Different stages of one Shader may be compiled from different threads.
+		vk::Result CompileStageFromGLSL(vk::ShaderStageFlagBits stage, const std::string& source, bool* cacheHit = nullptr);
+
+		static vk::Result ReadSourceFile(const std::string& filepath, std::string& source);
+
+		// Everything besides the source and the stage that influences the generated code, including the compiler
+		// build, as hashed into the shader cache key.
+		static std::string GetCacheCompileOptions(shaderc_optimization_level optimizationLevel);
+
 		vk::ShaderModule GetVertexModule() const { return m_VertexModule; }
 		vk::ShaderModule GetFragmentModule() const { return m_FragmentModule; }
 
+	private:
+		vk::Result CompileStage(const std::string& source, shaderc_shader_kind kind, const char* stageName, vk::ShaderModule* module, bool* cacheHit);
+
 	private:
 		vk::Device* m_Device;
+		ShaderCache* m_Cache;
 
 		vk::ShaderModule m_VertexModule;
 		vk::ShaderModule m_FragmentModule;
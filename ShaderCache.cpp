@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "ShaderCache.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace CEE
+{
+	// Bump whenever the entry layout or the key derivation changes.
+	constexpr uint32_t g_ShaderCacheVersion = 2;
+	constexpr uint32_t g_ShaderCacheMagic = 0x56505343; // "CSPV"
+	constexpr uint32_t g_SpirvMagic = 0x07230203;
+
+	typedef struct ShaderCacheEntryHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint64_t checksum;
+		uint32_t wordCount;
+		uint32_t reserved;
+	} ShaderCacheEntryHeader;
+
+	static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+	{
+		// 64 bit FNV-1a.
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	constexpr uint64_t g_HashSeed = 0xcbf29ce484222325ull;
+
+	ShaderCache::ShaderCache(const std::string& directory)
+		: m_Directory(directory)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(m_Directory, error);
+		if (error)
+			fprintf(stderr, "Failed to create shader cache directory %s.\n\t%s\n", m_Directory.c_str(), error.message().c_str());
+	}
+
+	ShaderCache::~ShaderCache()
+	{
+
+	}
+
+	uint64_t ShaderCache::ComputeKey(const std::string& source, uint32_t stage, const std::string& compileOptions)
+	{
+		uint64_t hash = g_HashSeed;
+		hash = HashBytes(hash, &g_ShaderCacheVersion, sizeof(g_ShaderCacheVersion));
+		hash = HashBytes(hash, &stage, sizeof(stage));
+		hash = HashBytes(hash, compileOptions.data(), compileOptions.size());
+		// Length prefix so option and source bytes cannot shift into each other.
+		uint64_t sourceSize = source.size();
+		hash = HashBytes(hash, &sourceSize, sizeof(sourceSize));
+		hash = HashBytes(hash, source.data(), source.size());
+		return hash;
+	}
+
+	bool ShaderCache::Load(uint64_t key, std::vector<uint32_t>& spirv) const
+	{
+		std::ifstream entryFile(GetEntryPath(key), std::ios::binary);
+		if (!entryFile.is_open())
+			return false;
+
+		ShaderCacheEntryHeader header;
+		if (!entryFile.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			return false;
+		if (header.magic != g_ShaderCacheMagic || header.version != g_ShaderCacheVersion || header.key != key || header.wordCount == 0)
+			return false;
+
+		spirv.resize(header.wordCount);
+		if (!entryFile.read(reinterpret_cast<char*>(spirv.data()), (std::streamsize)header.wordCount * sizeof(uint32_t)))
+			return false;
+
+		// Catches truncated or corrupted entries, such as one written by a process that was killed mid-write.
+		if (spirv[0] != g_SpirvMagic || HashBytes(g_HashSeed, spirv.data(), spirv.size() * sizeof(uint32_t)) != header.checksum)
+		{
+			spirv.clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool ShaderCache::Store(uint64_t key, const std::vector<uint32_t>& spirv) const
+	{
+		if (spirv.empty())
+			return false;
+
+		ShaderCacheEntryHeader header;
+		header.magic = g_ShaderCacheMagic;
+		header.version = g_ShaderCacheVersion;
+		header.key = key;
+		header.checksum = HashBytes(g_HashSeed, spirv.data(), spirv.size() * sizeof(uint32_t));
+		header.wordCount = (uint32_t)spirv.size();
+		header.reserved = 0;
+
+		// Written to a temporary file and renamed so concurrent readers never observe a partial entry.
+		std::string entryPath = GetEntryPath(key);
+		// The thread id keeps concurrent stores of the same entry from sharing a temporary file.
+		std::string temporaryPath = entryPath + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		{
+			std::ofstream entryFile(temporaryPath, std::ios::binary | std::ios::trunc);
+			if (!entryFile.is_open())
+				return false;
+			entryFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			entryFile.write(reinterpret_cast<const char*>(spirv.data()), (std::streamsize)spirv.size() * sizeof(uint32_t));
+			if (!entryFile)
+				return false;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, entryPath, error);
+		return !error;
+	}
+
+	std::string ShaderCache::GetEntryPath(uint64_t key) const
+	{
+		char fileName[32];
+		snprintf(fileName, sizeof(fileName), "%016llx.spv", (unsigned long long)key);
+		return (std::filesystem::path(m_Directory) / fileName).string();
+	}
+}
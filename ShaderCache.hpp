@@ -0,0 +1,33 @@
+#ifndef _SHADER_CACHE_HPP
+#define _SHADER_CACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CEE
+{
+	// Content addressed on-disk cache of compiled SPIR-V. Entries are keyed by a hash of the source,
+	// the shader stage and the compile options, so a changed input simply misses instead of going stale.
+	class ShaderCache
+	{
+	public:
+		ShaderCache(const std::string& directory);
+		~ShaderCache();
+
+		static uint64_t ComputeKey(const std::string& source, uint32_t stage, const std::string& compileOptions);
+
+		bool Load(uint64_t key, std::vector<uint32_t>& spirv) const;
+		bool Store(uint64_t key, const std::vector<uint32_t>& spirv) const;
+
+		inline const std::string& GetDirectory() const { return m_Directory; }
+
+	private:
+		std::string GetEntryPath(uint64_t key) const;
+
+	private:
+		std::string m_Directory;
+	};
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "ShaderLibrary.hpp"
+
+#include <chrono>
+
+namespace CEE
+{
+	ShaderLibrary::ShaderLibrary(vk::Device* device, ShaderCache* cache, ThreadPool* threadPool)
+		: m_Device(device), m_Cache(cache), m_ThreadPool(threadPool)
+	{
+
+	}
+
+	ShaderLibrary::~ShaderLibrary()
+	{
+
+	}
+
+	void ShaderLibrary::Add(const std::string& name, const std::string& vertexFilepath, const std::string& fragmentFilepath)
+	{
+		CEE_ASSERT_WITH_MESSAGE(m_Shaders.find(name) == m_Shaders.end(), "Shader names must be unique.");
+
+		ShaderEntry& entry = m_Shaders[name];
+		entry.vertexFilepath = vertexFilepath;
+		entry.fragmentFilepath = fragmentFilepath;
+		entry.shader = std::make_unique<Shader>(m_Device, m_Cache);
+		entry.compiled = false;
+	}
+
+	vk::Result ShaderLibrary::CompileAll()
+	{
+		typedef struct StageTask {
+			const std::string* name;
+			ShaderEntry* entry;
+			vk::ShaderStageFlagBits stage;
+			const std::string* filepath;
+			float* time;
+			bool* cacheHit;
+			vk::Result result;
+		} StageTask;
+
+		size_t firstTiming = m_Timings.size();
+		for (auto& [name, entry] : m_Shaders)
+		{
+			if (entry.compiled)
+				continue;
+			ShaderTiming timing = {};
+			timing.name = name;
+			m_Timings.push_back(timing);
+		}
+
+		// Built after m_Timings has stopped growing so the pointers into it stay valid.
+		std::vector<StageTask> tasks;
+		size_t timingIndex = firstTiming;
+		for (auto& [name, entry] : m_Shaders)
+		{
+			if (entry.compiled)
+				continue;
+			ShaderTiming& timing = m_Timings[timingIndex++];
+			tasks.push_back({ &name, &entry, vk::ShaderStageFlagBits::eVertex, &entry.vertexFilepath,
+							  &timing.vertexTime, &timing.vertexCacheHit, vk::Result::eSuccess });
+			tasks.push_back({ &name, &entry, vk::ShaderStageFlagBits::eFragment, &entry.fragmentFilepath,
+							  &timing.fragmentTime, &timing.fragmentCacheHit, vk::Result::eSuccess });
+		}
+
+		std::vector<std::future<void>> futures;
+		futures.reserve(tasks.size());
+		for (StageTask& task : tasks)
+		{
+			futures.push_back(m_ThreadPool->Submit([&task]() {
+				auto const start = std::chrono::steady_clock::now();
+				std::string source;
+				task.result = Shader::ReadSourceFile(*task.filepath, source);
+				if (task.result == vk::Result::eSuccess)
+					task.result = task.entry->shader->CompileStageFromGLSL(task.stage, source, task.cacheHit);
+				*task.time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}));
+		}
+		for (std::future<void>& future : futures)
+			future.wait();
+
+		// Both stages of an entry are next to each other.
+		vk::Result result = vk::Result::eSuccess;
+		for (size_t i = 0; i < tasks.size(); i += 2)
+		{
+			ShaderEntry& entry = *tasks[i].entry;
+			entry.compiled = true;
+			for (size_t j = i; j < i + 2; j++)
+			{
+				if (tasks[j].result == vk::Result::eSuccess)
+					continue;
+				fprintf(stderr, "Failed to compile %s stage %s of shader %s.\n", vk::to_string(tasks[j].stage).c_str(),
+						tasks[j].filepath->c_str(), tasks[j].name->c_str());
+				if (result == vk::Result::eSuccess)
+					result = tasks[j].result;
+				entry.compiled = false;
+			}
+			// Starts over with a fresh Shader, which also destroys the module of a stage that did compile.
+			if (!entry.compiled)
+				entry.shader = std::make_unique<Shader>(m_Device, m_Cache);
+		}
+		return result;
+	}
+
+	Shader* ShaderLibrary::Get(const std::string& name) const
+	{
+		auto it = m_Shaders.find(name);
+		if (it == m_Shaders.end() || !it->second.compiled)
+			return nullptr;
+		return it->second.shader.get();
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef _SHADER_LIBRARY_HPP
+#define _SHADER_LIBRARY_HPP
+
+#include "Shader.hpp"
+#include "ThreadPool.hpp"
+
+#include <unordered_map>
+
+namespace CEE
+{
+	typedef struct ShaderTiming {
+		std::string name;
+
+		// Milliseconds spent reading, compiling (or loading from the cache) and creating each stage's module.
+		float vertexTime;
+		float fragmentTime;
+
+		bool vertexCacheHit;
+		bool fragmentCacheHit;
+	} ShaderTiming;
+
+	// Named collection of shader programs whose stages are all compiled concurrently on a thread pool.
+	class ShaderLibrary
+	{
+	public:
+		ShaderLibrary(vk::Device* device, ShaderCache* cache, ThreadPool* threadPool);
+		~ShaderLibrary();
+
+		void Add(const std::string& name, const std::string& vertexFilepath, const std::string& fragmentFilepath);
+
+		// Compiles every shader added or failed since the last call, returns the first failure if any. A shader is
+		// only marked compiled when both of its stages are, failed ones are retried by the next call.
+		vk::Result CompileAll();
+
+		// Null for unknown shaders and shaders that have not compiled.
+		Shader* Get(const std::string& name) const;
+		inline const std::vector<ShaderTiming>& GetTimings() const { return m_Timings; }
+
+	private:
+		typedef struct ShaderEntry {
+			std::string vertexFilepath;
+			std::string fragmentFilepath;
+			std::unique_ptr<Shader> shader;
+			bool compiled;
+		} ShaderEntry;
+
+	private:
+		vk::Device* m_Device;
+		ShaderCache* m_Cache;
+		ThreadPool* m_ThreadPool;
+
+		std::unordered_map<std::string, ShaderEntry> m_Shaders;
+		std::vector<ShaderTiming> m_Timings;
+	};
+}
+
+#endif
@@ -0,0 +1,359 @@
+#include "pch.h"
+#include "TextureLoader.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+
+namespace CEE
+{
+	// Next whitespace separated token of a PPM header, skipping comments.
+	static bool ReadHeaderToken(std::istream& file, std::string* token)
+	{
+		token->clear();
+		int c = file.get();
+		while (c != EOF && (isspace(c) || c == '#'))
+		{
+			if (c == '#')
+			{
+				while (c != EOF && c != '\n')
+					c = file.get();
+			}
+			c = file.get();
+		}
+		while (c != EOF && !isspace(c))
+		{
+			token->push_back((char)c);
+			c = file.get();
+		}
+		// The single whitespace after the last token separates the header from the samples and is consumed.
+		return !token->empty();
+	}
+
+	static bool ParseHeaderValue(const std::string& token, uint32_t* value)
+	{
+		if (token.empty() || token.size() > 9 || !std::all_of(token.begin(), token.end(), [](char c) { return isdigit((unsigned char)c); }))
+			return false;
+
+		*value = (uint32_t)std::stoul(token);
+		return true;
+	}
+
+	vk::Result DecodeImageFile(const std::string& filepath, DecodedImage* image)
+	{
+		std::ifstream file(filepath, std::ios::binary);
+		if (!file)
+		{
+			fprintf(stderr, "Failed to open image %s.\n", filepath.c_str());
+			return vk::Result::eErrorInitializationFailed;
+		}
+
+		std::string token;
+		uint32_t width = 0, height = 0, depth = 0, maxValue = 0;
+		bool valid = ReadHeaderToken(file, &token);
+		if (valid && token == "P6")
+		{
+			depth = 3;
+			for (uint32_t* value : { &width, &height, &maxValue })
+				valid = valid && ReadHeaderToken(file, &token) && ParseHeaderValue(token, value);
+		}
+		else if (valid && token == "P7")
+		{
+			// PAM headers are KEY value lines up to ENDHDR, the tuple type is implied by the depth.
+			std::string line;
+			valid = false;
+			while (std::getline(file, line))
+			{
+				std::istringstream stream(line);
+				std::string key, value;
+				stream >> key >> value;
+				if (key == "ENDHDR")
+				{
+					valid = true;
+					break;
+				}
+
+				if (key == "WIDTH")
+					ParseHeaderValue(value, &width);
+				else if (key == "HEIGHT")
+					ParseHeaderValue(value, &height);
+				else if (key == "DEPTH")
+					ParseHeaderValue(value, &depth);
+				else if (key == "MAXVAL")
+					ParseHeaderValue(value, &maxValue);
+			}
+		}
+		else
+			valid = false;
+
+		if (!valid || width == 0 || height == 0 || depth == 0 || depth > 4 || maxValue == 0 || maxValue > 65535)
+		{
+			fprintf(stderr, "Unsupported image %s, only binary PPM and PAM files are read.\n", filepath.c_str());
+			return vk::Result::eErrorFormatNotSupported;
+		}
+
+		uint32_t sampleSize = maxValue > 255 ? 2 : 1;
+		size_t texelCount = (size_t)width * height;
+		std::vector<uint8_t> samples(texelCount * depth * sampleSize);
+		file.read(reinterpret_cast<char*>(samples.data()), (std::streamsize)samples.size());
+		if ((size_t)file.gcount() != samples.size())
+		{
+			fprintf(stderr, "Image %s is truncated.\n", filepath.c_str());
+			return vk::Result::eErrorFormatNotSupported;
+		}
+
+		image->texels.resize(texelCount * 4);
+		image->levels.assign(1, { width, height, 0 });
+
+		// Samples are big endian and rescaled from maxValue to 255, grayscale is replicated and alpha defaults to opaque.
+		uint8_t channels[4];
+		for (size_t texel = 0; texel < texelCount; texel++)
+		{
+			const uint8_t* source = samples.data() + texel * depth * sampleSize;
+			for (uint32_t channel = 0; channel < depth; channel++)
+			{
+				uint32_t sample = sampleSize == 2 ? (source[channel * 2] << 8) | source[channel * 2 + 1] : source[channel];
+				channels[channel] = (uint8_t)((std::min(sample, maxValue) * 255 + maxValue / 2) / maxValue);
+			}
+
+			uint8_t* destination = image->texels.data() + texel * 4;
+			bool grayscale = depth <= 2;
+			destination[0] = channels[0];
+			destination[1] = grayscale ? channels[0] : channels[1];
+			destination[2] = grayscale ? channels[0] : channels[2];
+			destination[3] = depth == 2 ? channels[1] : depth == 4 ? channels[3] : 255;
+		}
+		return vk::Result::eSuccess;
+	}
+
+	void BuildMipChain(DecodedImage* image)
+	{
+		CEE_ASSERT_WITH_MESSAGE(image->levels.size() == 1, "Mip chains are built from a single level.");
+
+		// Every level is laid out first, then filtered from the one before it.
+		MipLevel level = image->levels[0];
+		size_t size = (size_t)level.width * level.height * 4;
+		while (level.width > 1 || level.height > 1)
+		{
+			MipLevel next = { std::max(level.width / 2, 1u), std::max(level.height / 2, 1u), level.offset + (size_t)level.width * level.height * 4 };
+			image->levels.push_back(next);
+			size = next.offset + (size_t)next.width * next.height * 4;
+			level = next;
+		}
+		image->texels.resize(size);
+
+		for (size_t i = 1; i < image->levels.size(); i++)
+		{
+			const MipLevel& source = image->levels[i - 1];
+			const MipLevel& destination = image->levels[i];
+			const uint8_t* sourceTexels = image->texels.data() + source.offset;
+			uint8_t* destinationTexels = image->texels.data() + destination.offset;
+
+			// Odd sizes repeat their last row or column rather than reading past it.
+			for (uint32_t y = 0; y < destination.height; y++)
+			{
+				uint32_t y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+				for (uint32_t x = 0; x < destination.width; x++)
+				{
+					uint32_t x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+					const uint8_t* texels[4] = {
+						sourceTexels + ((size_t)y0 * source.width + x0) * 4, sourceTexels + ((size_t)y0 * source.width + x1) * 4,
+						sourceTexels + ((size_t)y1 * source.width + x0) * 4, sourceTexels + ((size_t)y1 * source.width + x1) * 4
+					};
+					uint8_t* texel = destinationTexels + ((size_t)y * destination.width + x) * 4;
+					for (uint32_t channel = 0; channel < 4; channel++)
+						texel[channel] = (uint8_t)((texels[0][channel] + texels[1][channel] + texels[2][channel] + texels[3][channel] + 2) / 4);
+				}
+			}
+		}
+	}
+
+	TextureLoader::TextureLoader(vk::Device device, MemoryAllocator* allocator, UploadManager* uploadManager, ThreadPool* threadPool)
+		: m_Device(device), m_Allocator(allocator), m_UploadManager(uploadManager), m_ThreadPool(threadPool)
+	{
+	}
+
+	TextureLoader::~TextureLoader()
+	{
+		for (std::future<void>& decode : m_Decodes)
+			decode.wait();
+
+		// Copies into partially staged images may still be in flight.
+		m_UploadManager->Wait(m_UploadManager->Submit());
+
+		for (std::unique_ptr<PendingTexture>& pending : m_DecodedTextures)
+			DestroyTexture(pending->texture.texture);
+		for (std::unique_ptr<PendingTexture>& pending : m_StagingTextures)
+			DestroyTexture(pending->texture.texture);
+		for (std::unique_ptr<PendingTexture>& pending : m_UploadingTextures)
+			DestroyTexture(pending->texture.texture);
+	}
+
+	void TextureLoader::Load(uint64_t request, const std::string& filepath)
+	{
+		m_QueueDepth++;
+
+		std::lock_guard<std::mutex> lock(m_DecodedMutex);
+		m_Decodes.push_back(m_ThreadPool->Submit([this, request, filepath]() { Decode(request, filepath); }));
+	}
+
+	void TextureLoader::Decode(uint64_t request, const std::string& filepath)
+	{
+		std::unique_ptr<PendingTexture> pending(new PendingTexture());
+		pending->texture.request = request;
+		pending->stagedLevel = 0;
+		pending->stagedRows = 0;
+		pending->ticket = 0;
+
+		if (DecodeImageFile(filepath, &pending->decoded) == vk::Result::eSuccess)
+		{
+			BuildMipChain(&pending->decoded);
+			CreateImage(*pending);
+		}
+
+		std::lock_guard<std::mutex> lock(m_DecodedMutex);
+		m_DecodedTextures.push_back(std::move(pending));
+	}
+
+	void TextureLoader::CreateImage(PendingTexture& pending)
+	{
+		Texture& texture = pending.texture.texture;
+		texture.width = pending.decoded.levels[0].width;
+		texture.height = pending.decoded.levels[0].height;
+		texture.mipLevels = (uint32_t)pending.decoded.levels.size();
+
+		auto const imageCreateInfo = vk::ImageCreateInfo()
+			.setImageType(vk::ImageType::e2D)
+			.setFormat(vk::Format::eR8G8B8A8Unorm)
+			.setExtent(vk::Extent3D(texture.width, texture.height, 1))
+			.setMipLevels(texture.mipLevels)
+			.setArrayLayers(1)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setTiling(vk::ImageTiling::eOptimal)
+			.setInitialLayout(vk::ImageLayout::eUndefined)
+			.setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst)
+			.setQueueFamilyIndexCount(0)
+			.setPQueueFamilyIndices(nullptr)
+			.setSharingMode(vk::SharingMode::eExclusive);
+
+		auto result = m_Device.createImage(&imageCreateInfo, nullptr, &texture.image);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create texture image.");
+
+		result = m_Allocator->AllocateForImage(texture.image, vk::ImageTiling::eOptimal, vk::MemoryPropertyFlagBits::eDeviceLocal, &texture.allocation);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate memory for texture image.");
+
+		auto const imageViewCreateInfo = vk::ImageViewCreateInfo()
+			.setImage(texture.image)
+			.setFormat(vk::Format::eR8G8B8A8Unorm)
+			.setComponents(vk::ComponentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA))
+			.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, texture.mipLevels, 0, 1))
+			.setViewType(vk::ImageViewType::e2D);
+
+		result = m_Device.createImageView(&imageViewCreateInfo, nullptr, &texture.view);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create texture image view.");
+	}
+
+	void TextureLoader::DestroyTexture(Texture& texture)
+	{
+		if (!texture.image)
+			return;
+
+		m_Device.destroyImageView(texture.view, nullptr);
+		m_Device.destroyImage(texture.image, nullptr);
+		m_Allocator->Free(texture.allocation);
+		texture = Texture();
+	}
+
+	void TextureLoader::Update(vk::DeviceSize uploadBudget, std::vector<LoadedTexture>* loaded)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_DecodedMutex);
+			for (std::unique_ptr<PendingTexture>& pending : m_DecodedTextures)
+				m_StagingTextures.push_back(std::move(pending));
+			m_DecodedTextures.clear();
+
+			m_Decodes.erase(std::remove_if(m_Decodes.begin(), m_Decodes.end(), [](const std::future<void>& decode) {
+								return decode.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+							}), m_Decodes.end());
+		}
+
+		// Textures are staged one after the other, so the first requested is the first shown.
+		vk::DeviceSize uploadBytes = 0;
+		size_t firstStaged = m_UploadingTextures.size();
+		while (!m_StagingTextures.empty() && uploadBytes < uploadBudget)
+		{
+			PendingTexture& pending = *m_StagingTextures.front();
+			if (pending.texture.texture.image)
+			{
+				uploadBytes += StageTexture(pending, uploadBudget - uploadBytes);
+				if (pending.stagedLevel < pending.texture.texture.mipLevels)
+					break;
+			}
+			m_UploadingTextures.push_back(std::move(m_StagingTextures.front()));
+			m_StagingTextures.pop_front();
+		}
+
+		UploadTicket ticket = m_UploadManager->Submit();
+		for (size_t i = firstStaged; i < m_UploadingTextures.size(); i++)
+			m_UploadingTextures[i]->ticket = ticket;
+
+		for (size_t i = 0; i < m_UploadingTextures.size();)
+		{
+			if (!m_UploadManager->IsComplete(m_UploadingTextures[i]->ticket))
+			{
+				i++;
+				continue;
+			}
+
+			loaded->push_back(m_UploadingTextures[i]->texture);
+			m_UploadingTextures.erase(m_UploadingTextures.begin() + i);
+			m_QueueDepth--;
+		}
+		m_LastUploadBytes = uploadBytes;
+	}
+
+	vk::DeviceSize TextureLoader::StageTexture(PendingTexture& pending, vk::DeviceSize budget)
+	{
+		const Texture& texture = pending.texture.texture;
+		if (pending.stagedLevel == 0 && pending.stagedRows == 0)
+			m_UploadManager->BeginImage(texture.image, texture.mipLevels);
+
+		vk::DeviceSize staged = 0;
+		while (pending.stagedLevel < texture.mipLevels && staged < budget)
+		{
+			const MipLevel& level = pending.decoded.levels[pending.stagedLevel];
+			vk::DeviceSize rowSize = (vk::DeviceSize)level.width * 4;
+			// At least one row, so textures make progress whatever the budget.
+			uint32_t rowCount = (uint32_t)std::min<vk::DeviceSize>(level.height - pending.stagedRows,
+																   std::max<vk::DeviceSize>((budget - staged) / rowSize, 1));
+
+			const uint8_t* rows = pending.decoded.texels.data() + level.offset + pending.stagedRows * rowSize;
+			m_UploadManager->UploadImageRows(texture.image, pending.stagedLevel, level.width, pending.stagedRows, rowCount, 4, rows);
+			staged += rowCount * rowSize;
+
+			pending.stagedRows += rowCount;
+			if (pending.stagedRows == level.height)
+			{
+				pending.stagedLevel++;
+				pending.stagedRows = 0;
+			}
+		}
+
+		if (pending.stagedLevel == texture.mipLevels)
+		{
+			m_UploadManager->EndImage(texture.image, texture.mipLevels);
+			// Everything is in the staging ring now.
+			pending.decoded = DecodedImage();
+		}
+		return staged;
+	}
+
+	TextureLoaderStatistics TextureLoader::GetStatistics() const
+	{
+		TextureLoaderStatistics statistics;
+		statistics.queueDepth = m_QueueDepth;
+		statistics.uploadBytes = m_LastUploadBytes;
+		return statistics;
+	}
+}
@@ -0,0 +1,112 @@
+#ifndef _TEXTURE_LOADER_HPP
+#define _TEXTURE_LOADER_HPP
+
+#include "UploadManager.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+
+namespace CEE
+{
+	typedef struct MipLevel {
+		uint32_t width;
+		uint32_t height;
+		// Byte offset of the level in the mip chain.
+		size_t offset;
+	} MipLevel;
+
+	// R8G8B8A8 unorm texels, every mip level tightly packed after the previous one.
+	typedef struct DecodedImage {
+		std::vector<uint8_t> texels;
+		std::vector<MipLevel> levels;
+	} DecodedImage;
+
+	// Reads binary PPM (P6) and PAM (P7) files with up to 16 bits per channel into a single mip level. PAM files may
+	// carry one to four channels, grayscale and missing alpha are expanded to RGBA.
+	vk::Result DecodeImageFile(const std::string& filepath, DecodedImage* image);
+	// Appends every smaller level down to 1x1 to an image holding only its first level, each a box filtered
+	// half of the previous one.
+	void BuildMipChain(DecodedImage* image);
+
+	// Sampled R8G8B8A8 unorm image with a view of all of its mip levels.
+	typedef struct Texture {
+		vk::Image image;
+		Allocation allocation;
+		vk::ImageView view;
+
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+	} Texture;
+
+	typedef struct LoadedTexture {
+		// Passed to TextureLoader::Load.
+		uint64_t request;
+		// No image when the file could not be decoded.
+		Texture texture;
+	} LoadedTexture;
+
+	typedef struct TextureLoaderStatistics {
+		// Loads requested and not yet handed back by Update.
+		uint32_t queueDepth;
+		// Texel bytes staged by the last Update.
+		uint64_t uploadBytes;
+	} TextureLoaderStatistics;
+
+	// Loads textures without stalling the render thread. Files are decoded, their mip chains built and their images
+	// created on the thread pool. Update, called once per frame, stages decoded texels into the upload ring up to a
+	// byte budget, continuing large images over several frames, and hands back the textures whose upload completed.
+	class TextureLoader
+	{
+	public:
+		TextureLoader(vk::Device device, MemoryAllocator* allocator, UploadManager* uploadManager, ThreadPool* threadPool);
+		// Waits for decodes in flight and destroys every texture not handed back yet.
+		~TextureLoader();
+
+		// Thread safe. The request identifies the texture when Update hands it back.
+		void Load(uint64_t request, const std::string& filepath);
+
+		// Render thread only. Textures appended to loaded may be sampled once RecordAcquires of the upload manager
+		// ran on the owning queue, and belong to the caller from then on.
+		void Update(vk::DeviceSize uploadBudget, std::vector<LoadedTexture>* loaded);
+
+		TextureLoaderStatistics GetStatistics() const;
+
+	private:
+		typedef struct PendingTexture {
+			LoadedTexture texture;
+			DecodedImage decoded;
+
+			// Next level and row of it to stage.
+			uint32_t stagedLevel;
+			uint32_t stagedRows;
+			UploadTicket ticket;
+		} PendingTexture;
+
+	private:
+		void Decode(uint64_t request, const std::string& filepath);
+		void CreateImage(PendingTexture& pending);
+		void DestroyTexture(Texture& texture);
+		// Stages up to budget bytes of the texture, returns the number staged.
+		vk::DeviceSize StageTexture(PendingTexture& pending, vk::DeviceSize budget);
+
+	private:
+		vk::Device m_Device;
+		MemoryAllocator* m_Allocator;
+		UploadManager* m_UploadManager;
+		ThreadPool* m_ThreadPool;
+
+		std::mutex m_DecodedMutex;
+		std::vector<std::unique_ptr<PendingTexture>> m_DecodedTextures;
+		std::vector<std::future<void>> m_Decodes;
+
+		// Render thread only: textures being staged, in request order, and staged textures waiting for their ticket.
+		std::deque<std::unique_ptr<PendingTexture>> m_StagingTextures;
+		std::vector<std::unique_ptr<PendingTexture>> m_UploadingTextures;
+
+		std::atomic<uint32_t> m_QueueDepth{ 0 };
+		uint64_t m_LastUploadBytes = 0;
+	};
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _THREAD_POOL_HPP
+#define _THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CEE
+{
+	// Fixed set of worker threads consuming a FIFO task queue.
+	class ThreadPool
+	{
+	public:
+		// A thread count of zero uses one worker per hardware thread.
+		ThreadPool(uint32_t threadCount = 0);
+		~ThreadPool();
+
+		template<typename F>
+		std::future<void> Submit(F&& task)
+		{
+			auto packagedTask = std::make_shared<std::packaged_task<void()>>(std::forward<F>(task));
+			std::future<void> future = packagedTask->get_future();
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Tasks.emplace_back([packagedTask]() { (*packagedTask)(); });
+			}
+			m_Condition.notify_one();
+			return future;
+		}
+
+		inline uint32_t GetThreadCount() const { return (uint32_t)m_Workers.size(); }
+
+	private:
+		void WorkerLoop();
+
+	private:
+		std::vector<std::thread> m_Workers;
+		std::deque<std::function<void()>> m_Tasks;
+		std::mutex m_Mutex;
+		std::condition_variable m_Condition;
+		bool m_Stopping = false;
+	};
+}
+
+#endif
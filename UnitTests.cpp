@@ -0,0 +1,275 @@
+#include "pch.h"
+#include "UnitTests.hpp"
+#include "Shader.hpp"
+#include "ShaderCache.hpp"
+#include "BuddyAllocator.hpp"
+#include "AtlasPacker.hpp"
+
+#include <filesystem>
+#include <algorithm>
+#include <random>
+
+namespace CEE
+{
+	void CheckTest(TestResults& results, bool passed, const char* condition, const char* file, int line)
+	{
+		results.checks++;
+		if (passed)
+			return;
+		printf("%s FAILED at %s:%d: %s\n", results.name, file, line, condition);
+		results.failures++;
+	}
+
+	uint32_t ReportTests(const TestResults& results)
+	{
+		printf("%s: %u of %u checks failed\n", results.name, results.failures, results.checks);
+		return results.failures;
+	}
+
+	uint32_t TestShaderCache()
+	{
+		TestResults results;
+		results.name = "Shader cache";
+
+		std::error_code error;
+		std::filesystem::path directory = std::filesystem::temp_directory_path(error) / "cee-shader-cache-test";
+		std::filesystem::remove_all(directory, error);
+
+		{
+			ShaderCache cache(directory.string());
+			const std::string source = "#version 450\nvoid main() { gl_Position = vec4(0.0); }\n";
+			const std::string editedSource = "#version 450\nvoid main() { gl_Position = vec4(1.0); }\n";
+			const uint32_t stage = (uint32_t)shaderc_vertex_shader;
+			const std::string options = Shader::GetCacheCompileOptions(shaderc_optimization_level_zero);
+			const std::vector<uint32_t> spirv = { 0x07230203, 0x00010300, 0, 1, 0 };
+
+			uint64_t key = ShaderCache::ComputeKey(source, stage, options);
+			CEE_CHECK(key == ShaderCache::ComputeKey(source, stage, options));
+			CEE_CHECK(cache.Store(key, spirv));
+			std::vector<uint32_t> loaded;
+			CEE_CHECK(cache.Load(key, loaded) && loaded == spirv);
+
+			// Every edit of an input has to miss instead of loading the stale entry.
+			uint64_t editedSourceKey = ShaderCache::ComputeKey(editedSource, stage, options);
+			CEE_CHECK(editedSourceKey != key);
+			CEE_CHECK(!cache.Load(editedSourceKey, loaded));
+
+			uint64_t otherStageKey = ShaderCache::ComputeKey(source, (uint32_t)shaderc_fragment_shader, options);
+			CEE_CHECK(otherStageKey != key);
+			CEE_CHECK(!cache.Load(otherStageKey, loaded));
+
+			const std::string optimizedOptions = Shader::GetCacheCompileOptions(shaderc_optimization_level_performance);
+			CEE_CHECK(optimizedOptions != options);
+			uint64_t optimizedKey = ShaderCache::ComputeKey(source, stage, optimizedOptions);
+			CEE_CHECK(optimizedKey != key);
+			CEE_CHECK(!cache.Load(optimizedKey, loaded));
+
+			// A different compiler build shows up as a different version string in the options.
+			CEE_CHECK(options.find(CEE_SHADER_COMPILER_VERSION) != std::string::npos);
+			uint64_t otherCompilerKey = ShaderCache::ComputeKey(source, stage, options + "-other");
+			CEE_CHECK(otherCompilerKey != key);
+			CEE_CHECK(!cache.Load(otherCompilerKey, loaded));
+
+			// Moving option bytes into the source must not produce the same key.
+			CEE_CHECK(ShaderCache::ComputeKey("b" + source, stage, options) != ShaderCache::ComputeKey(source, stage, options + "b"));
+
+			// The original entry is still there after the misses.
+			CEE_CHECK(cache.Load(key, loaded) && loaded == spirv);
+		}
+
+		std::filesystem::remove_all(directory, error);
+		return ReportTests(results);
+	}
+
+	// True when no two allocations share a byte.
+	static bool AllocationsAreDisjoint(const BuddyAllocator& allocator)
+	{
+		std::vector<std::pair<uint64_t, uint64_t>> blocks;
+		allocator.ForEachAllocation([&blocks](uint64_t offset, uint64_t blockSize) { blocks.push_back({ offset, blockSize }); });
+		std::sort(blocks.begin(), blocks.end());
+		for (size_t i = 1; i < blocks.size(); i++)
+		{
+			if (blocks[i - 1].first + blocks[i - 1].second > blocks[i].first)
+				return false;
+		}
+		return true;
+	}
+
+	uint32_t TestBuddyAllocator()
+	{
+		TestResults results;
+		results.name = "Buddy allocator";
+
+		const uint64_t size = 1024, minBlockSize = 16;
+		BuddyAllocator allocator(size, minBlockSize);
+		CEE_CHECK(allocator.IsEmpty() && allocator.GetLargestFreeBlock() == size);
+
+		// Splitting the whole range down to one minimum block leaves one free block of every larger order.
+		uint64_t small = UINT64_MAX;
+		CEE_CHECK(allocator.Allocate(1, 1, &small));
+		CEE_CHECK(allocator.GetBlockSize(small) == minBlockSize);
+		CEE_CHECK(allocator.GetUsedSize() == minBlockSize);
+		CEE_CHECK(allocator.GetLargestFreeBlock() == size / 2);
+
+		// Sizes round up to the next power of two, placed at a multiple of it.
+		uint64_t rounded = UINT64_MAX;
+		CEE_CHECK(allocator.Allocate(100, 1, &rounded));
+		CEE_CHECK(allocator.GetBlockSize(rounded) == 128 && rounded % 128 == 0);
+
+		// Alignment larger than the size takes a block of the alignment.
+		uint64_t aligned = UINT64_MAX;
+		CEE_CHECK(allocator.Allocate(16, 256, &aligned));
+		CEE_CHECK(aligned % 256 == 0 && allocator.GetBlockSize(aligned) == 256);
+		CEE_CHECK(AllocationsAreDisjoint(allocator));
+		CEE_CHECK(allocator.GetUsedSize() == minBlockSize + 128 + 256);
+
+		// Freeing everything merges back into the single block of the whole range.
+		allocator.Free(small);
+		allocator.Free(rounded);
+		allocator.Free(aligned);
+		CEE_CHECK(allocator.IsEmpty() && allocator.GetUsedSize() == 0);
+		CEE_CHECK(allocator.GetLargestFreeBlock() == size);
+		uint64_t whole = UINT64_MAX;
+		bool allocatedWhole = allocator.Allocate(size, 1, &whole);
+		CEE_CHECK(allocatedWhole && whole == 0);
+		if (allocatedWhole)
+			allocator.Free(whole);
+
+		// Requests that can never fit fail without side effects.
+		uint64_t rejected = UINT64_MAX;
+		CEE_CHECK(!allocator.Allocate(size + 1, 1, &rejected));
+		CEE_CHECK(!allocator.Allocate(16, size * 2, &rejected));
+		CEE_CHECK(rejected == UINT64_MAX && allocator.IsEmpty());
+
+		// Exhaustion with minimum blocks, every one of them is handed out exactly once.
+		std::vector<uint64_t> blocks;
+		uint64_t offset = 0;
+		while (allocator.Allocate(minBlockSize, 1, &offset))
+			blocks.push_back(offset);
+		CEE_CHECK(blocks.size() == size / minBlockSize);
+		CEE_CHECK(allocator.GetUsedSize() == size && allocator.GetLargestFreeBlock() == 0);
+		CEE_CHECK(AllocationsAreDisjoint(allocator));
+		CEE_CHECK(!allocator.Allocate(1, 1, &offset));
+		// The offsets freed below are only allocated when exhaustion went as expected.
+		if (blocks.size() != size / minBlockSize)
+			return ReportTests(results);
+
+		// A freed block is reused by the next allocation of its size.
+		allocator.Free(64);
+		CEE_CHECK(allocator.Allocate(minBlockSize, 1, &offset) && offset == 64);
+
+		// Two free blocks that are not buddies cannot merge, two buddies can.
+		allocator.Free(16);
+		allocator.Free(32);
+		CEE_CHECK(allocator.GetLargestFreeBlock() == minBlockSize);
+		CEE_CHECK(!allocator.Allocate(32, 1, &offset));
+		allocator.Free(0);
+		CEE_CHECK(allocator.GetLargestFreeBlock() == 32);
+		CEE_CHECK(allocator.Allocate(32, 1, &offset) && offset == 0);
+		CEE_CHECK(AllocationsAreDisjoint(allocator));
+
+		std::vector<uint64_t> remaining;
+		allocator.ForEachAllocation([&remaining](uint64_t offset, uint64_t) { remaining.push_back(offset); });
+		for (uint64_t block : remaining)
+			allocator.Free(block);
+		CEE_CHECK(allocator.IsEmpty() && allocator.GetLargestFreeBlock() == size);
+
+		return ReportTests(results);
+	}
+
+	// True when every region lies inside the atlas and at least padding texels away from every other region.
+	static bool RegionsAreSeparated(const std::vector<AtlasRegion>& regions, uint32_t width, uint32_t height, uint32_t padding)
+	{
+		for (size_t i = 0; i < regions.size(); i++)
+		{
+			const AtlasRegion& a = regions[i];
+			if (a.x + a.width > width || a.y + a.height > height)
+				return false;
+			for (size_t j = i + 1; j < regions.size(); j++)
+			{
+				const AtlasRegion& b = regions[j];
+				bool separated = a.x + a.width + padding <= b.x || b.x + b.width + padding <= a.x ||
+								 a.y + a.height + padding <= b.y || b.y + b.height + padding <= a.y;
+				if (!separated)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	uint32_t TestAtlasPacker()
+	{
+		TestResults results;
+		results.name = "Atlas packer";
+
+		// Rectangles of mixed sizes until several in a row no longer fit.
+		const uint32_t atlasSize = 512, padding = 2;
+		AtlasPacker packer(atlasSize, atlasSize, padding);
+		std::mt19937 random(8);
+		std::vector<AtlasRegion> regions;
+		uint64_t packedArea = 0;
+		for (uint32_t misses = 0; misses < 64;)
+		{
+			uint32_t width = 4 + random() % 60, height = 4 + random() % 60;
+			AtlasRegion region;
+			if (!packer.Pack(width, height, &region))
+			{
+				misses++;
+				continue;
+			}
+			CEE_CHECK(region.width == width && region.height == height);
+			regions.push_back(region);
+			packedArea += (uint64_t)width * height;
+		}
+		CEE_CHECK(regions.size() > 50);
+		CEE_CHECK(packer.GetRegionCount() == regions.size());
+		CEE_CHECK(packer.GetOccupancy() == (float)((double)packedArea / ((double)atlasSize * atlasSize)));
+		CEE_CHECK(RegionsAreSeparated(regions, atlasSize, atlasSize, padding));
+
+		// Requests that can never fit are rejected and leave the region untouched.
+		AtlasRegion untouched = { 7, 7, 7, 7 };
+		AtlasRegion rejected = untouched;
+		CEE_CHECK(!packer.Pack(atlasSize + 1, 1, &rejected));
+		CEE_CHECK(!packer.Pack(0, 1, &rejected));
+		CEE_CHECK(!packer.Pack(1, 0, &rejected));
+		CEE_CHECK(rejected.x == untouched.x && rejected.y == untouched.y && rejected.width == untouched.width &&
+				  rejected.height == untouched.height);
+
+		// Padding only separates rectangles, so four of 31 texels fill a 64 texel atlas with padding 1, and the
+		// atlas is full afterwards.
+		AtlasPacker small(64, 64, 1);
+		std::vector<AtlasRegion> tiles(4);
+		for (AtlasRegion& tile : tiles)
+			CEE_CHECK(small.Pack(31, 31, &tile));
+		CEE_CHECK(RegionsAreSeparated(tiles, 64, 64, 1));
+		CEE_CHECK(!small.Pack(1, 1, &rejected));
+		CEE_CHECK(rejected.x == untouched.x && rejected.width == untouched.width);
+
+		// Two rectangles of 32 texels and the padding between them do not fit either way, one of 31 does.
+		small.Reset();
+		AtlasRegion first, second;
+		CEE_CHECK(small.Pack(32, 32, &first) && first.x == 0 && first.y == 0);
+		CEE_CHECK(!small.Pack(32, 32, &rejected));
+		CEE_CHECK(small.Pack(31, 32, &second) && second.x == 33 && second.y == 0);
+
+		// Reset reclaims everything, the whole atlas fits again.
+		packer.Reset();
+		CEE_CHECK(packer.GetRegionCount() == 0 && packer.GetOccupancy() == 0.0f);
+		AtlasRegion whole;
+		CEE_CHECK(packer.Pack(atlasSize, atlasSize, &whole) && whole.x == 0 && whole.y == 0);
+		CEE_CHECK(!packer.Pack(1, 1, &rejected));
+
+		// Texture coordinates cover exactly the region, its padding excluded.
+		AtlasPacker padded(256, 128, 4);
+		AtlasRegion left, right;
+		CEE_CHECK(padded.Pack(10, 20, &left) && padded.Pack(30, 10, &right));
+		CEE_CHECK(left.x == 0 && left.y == 0 && right.x == left.width + 4 && right.y == 0);
+		glm::vec4 texCoords = padded.GetTexCoords(right);
+		CEE_CHECK(texCoords.x == 14.0f / 256.0f && texCoords.y == 0.0f);
+		CEE_CHECK(texCoords.z == 44.0f / 256.0f && texCoords.w == 10.0f / 128.0f);
+		// The padding between the regions maps to texels neither of them samples.
+		CEE_CHECK(padded.GetTexCoords(left).z < texCoords.x);
+
+		return ReportTests(results);
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef _UNIT_TESTS_HPP
+#define _UNIT_TESTS_HPP
+
+#include <cstdint>
+
+namespace CEE
+{
+	typedef struct TestResults {
+		const char* name;
+		uint32_t checks = 0;
+		uint32_t failures = 0;
+	} TestResults;
+
+	// Counts the check and prints it if it failed, through CEE_CHECK with a TestResults named results in scope.
+	void CheckTest(TestResults& results, bool passed, const char* condition, const char* file, int line);
+	// Prints the summary line and returns the number of failed checks.
+	uint32_t ReportTests(const TestResults& results);
+
+#define CEE_CHECK(condition) CheckTest(results, (condition), #condition, __FILE__, __LINE__)
+
+	// Asserting checks of the components that work without a device, run by the --test-* modes. Each prints the
+	// checks that failed and returns their number.
+	uint32_t TestShaderCache();
+	uint32_t TestBuddyAllocator();
+	uint32_t TestAtlasPacker();
+}
+
+#endif
@@ -0,0 +1,398 @@
+#include "pch.h"
+#include "UploadManager.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace CEE
+{
+	// Keeps every staging region suitably aligned for buffer to buffer as well as buffer to image copies.
+	static const vk::DeviceSize s_StagingAlignment = 16;
+
+	UploadManager::UploadManager(vk::Device device, MemoryAllocator* allocator, uint32_t queueFamilyIndex, vk::Queue queue,
+								 std::mutex* queueMutex, uint32_t ownerQueueFamilyIndex, vk::DeviceSize stagingSize)
+		: m_Device(device), m_Allocator(allocator), m_Queue(queue), m_QueueMutex(queueMutex), m_QueueFamilyIndex(queueFamilyIndex),
+		  m_OwnerQueueFamilyIndex(ownerQueueFamilyIndex), m_StagingSize(stagingSize)
+	{
+		CEE_ASSERT_WITH_MESSAGE(stagingSize % (2 * s_StagingAlignment) == 0, "Staging size must be a multiple of twice the staging alignment.");
+
+		auto const commandPoolCreateInfo = vk::CommandPoolCreateInfo()
+			.setQueueFamilyIndex(queueFamilyIndex)
+			.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient);
+		auto result = m_Device.createCommandPool(&commandPoolCreateInfo, nullptr, &m_CommandPool);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create upload command pool.");
+
+		auto const stagingBufferCreateInfo = vk::BufferCreateInfo()
+			.setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+			.setSize(m_StagingSize)
+			.setQueueFamilyIndexCount(0)
+			.setPQueueFamilyIndices(nullptr)
+			.setSharingMode(vk::SharingMode::eExclusive);
+		result = m_Device.createBuffer(&stagingBufferCreateInfo, nullptr, &m_StagingBuffer);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create staging buffer.");
+
+		vk::MemoryPropertyFlags typeBits = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+		result = m_Allocator->AllocateForBuffer(m_StagingBuffer, typeBits, &m_StagingAllocation);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate memory for staging buffer.");
+
+		memset(&m_Statistics, 0, sizeof(UploadStatistics));
+	}
+
+	UploadManager::~UploadManager()
+	{
+		Wait(Submit());
+
+		for (UploadSubmission& submission : m_FreeSubmissions)
+		{
+			m_Device.destroyFence(submission.fence, nullptr);
+			m_Device.freeCommandBuffers(m_CommandPool, 1, &submission.commandBuffer);
+		}
+		m_Device.destroyCommandPool(m_CommandPool, nullptr);
+
+		m_Device.destroyBuffer(m_StagingBuffer, nullptr);
+		m_Allocator->Free(m_StagingAllocation);
+	}
+
+	void UploadManager::Upload(vk::Buffer buffer, vk::DeviceSize offset, const void* data, vk::DeviceSize size)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// Uploads larger than half the ring are split so that a chunk always fits once the ring has drained.
+		const uint8_t* source = static_cast<const uint8_t*>(data);
+		while (size > 0)
+		{
+			vk::DeviceSize chunkSize = std::min(size, m_StagingSize / 2);
+
+			vk::DeviceSize stagingOffset;
+			uint8_t* staging = AllocateStaging(chunkSize, &stagingOffset);
+			memcpy(staging, source, chunkSize);
+
+			PendingCopy copy;
+			copy.buffer = buffer;
+			copy.region = vk::BufferCopy(stagingOffset, offset, chunkSize);
+			m_PendingCopies.push_back(copy);
+
+			m_Statistics.bytesUploaded += chunkSize;
+			source += chunkSize;
+			offset += chunkSize;
+			size -= chunkSize;
+		}
+	}
+
+	void UploadManager::BeginImage(vk::Image image, uint32_t mipLevels)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_PendingImageBegins.push_back({ image, mipLevels });
+	}
+
+	void UploadManager::UploadImageRows(vk::Image image, uint32_t mipLevel, uint32_t width, uint32_t firstRow, uint32_t rowCount,
+										uint32_t texelSize, const void* rows)
+	{
+		CEE_ASSERT_WITH_MESSAGE(s_StagingAlignment % texelSize == 0, "Unsupported texel size.");
+		vk::DeviceSize rowSize = (vk::DeviceSize)width * texelSize;
+		CEE_ASSERT_WITH_MESSAGE(rowSize <= m_StagingSize / 2, "Image rows do not fit the staging ring.");
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// Split into bands of whole rows no larger than half the ring, for the same reason as buffer uploads.
+		const uint8_t* source = static_cast<const uint8_t*>(rows);
+		while (rowCount > 0)
+		{
+			uint32_t bandRows = (uint32_t)std::min<vk::DeviceSize>(rowCount, (m_StagingSize / 2) / rowSize);
+			vk::DeviceSize bandSize = bandRows * rowSize;
+
+			vk::DeviceSize stagingOffset;
+			uint8_t* staging = AllocateStaging(bandSize, &stagingOffset);
+			memcpy(staging, source, bandSize);
+
+			PendingImageCopy copy;
+			copy.image = image;
+			copy.region = vk::BufferImageCopy()
+				.setBufferOffset(stagingOffset)
+				.setBufferRowLength(0)
+				.setBufferImageHeight(0)
+				.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, mipLevel, 0, 1))
+				.setImageOffset(vk::Offset3D(0, (int32_t)firstRow, 0))
+				.setImageExtent(vk::Extent3D(width, bandRows, 1));
+			m_PendingImageCopies.push_back(copy);
+
+			m_Statistics.bytesUploaded += bandSize;
+			source += bandSize;
+			firstRow += bandRows;
+			rowCount -= bandRows;
+		}
+	}
+
+	void UploadManager::EndImage(vk::Image image, uint32_t mipLevels)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_PendingImageEnds.push_back({ image, mipLevels });
+	}
+
+	UploadTicket UploadManager::Submit()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return SubmitPending();
+	}
+
+	bool UploadManager::IsComplete(UploadTicket ticket)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		RetireCompleted();
+		return ticket <= m_LastCompletedTicket;
+	}
+
+	void UploadManager::Wait(UploadTicket ticket)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		CEE_ASSERT_WITH_MESSAGE(ticket <= m_LastSubmittedTicket, "Waiting on an upload ticket that was never submitted.");
+
+		// The fence is waited on unlocked, RecordAcquires on the render thread must not stall behind the transfer.
+		auto const start = std::chrono::steady_clock::now();
+		while (ticket > m_LastCompletedTicket)
+		{
+			vk::Fence fence = m_InFlightSubmissions.front().fence;
+			m_FenceWaiters++;
+			lock.unlock();
+			auto result = m_Device.waitForFences(1, &fence, VK_TRUE, UINT64_MAX);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to wait for upload fence.");
+			lock.lock();
+			m_FenceWaiters--;
+			RetireCompleted();
+		}
+		m_Statistics.stallTime += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void UploadManager::RecordAcquires(vk::CommandBuffer commandBuffer)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		RetireCompleted();
+		if (m_PendingAcquireBarriers.empty() && m_PendingAcquireImageBarriers.empty())
+			return;
+
+		// The upload fence was observed signaled on the host, so no semaphore is needed to order the acquire after
+		// the release and uploads still in flight never hold back the owning queue.
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands,
+									  vk::DependencyFlags(), 0, nullptr, (uint32_t)m_PendingAcquireBarriers.size(),
+									  m_PendingAcquireBarriers.data(), (uint32_t)m_PendingAcquireImageBarriers.size(),
+									  m_PendingAcquireImageBarriers.data());
+		m_PendingAcquireBarriers.clear();
+		m_PendingAcquireImageBarriers.clear();
+	}
+
+	uint8_t* UploadManager::AllocateStaging(vk::DeviceSize size, vk::DeviceSize* offset)
+	{
+		vk::DeviceSize head = (m_StagingHead + s_StagingAlignment - 1) & ~(s_StagingAlignment - 1);
+		// Never straddle the end of the ring.
+		if (head % m_StagingSize + size > m_StagingSize)
+			head += m_StagingSize - head % m_StagingSize;
+
+		if (head + size - m_StagingTail > m_StagingSize)
+		{
+			auto const start = std::chrono::steady_clock::now();
+			// Pending copies read from the ring as well, they have to be submitted before their space can drain.
+			if (!m_PendingCopies.empty() || !m_PendingImageCopies.empty())
+				SubmitPending();
+			while (head + size - m_StagingTail > m_StagingSize)
+				RetireOldest();
+			m_Statistics.stallTime += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		m_StagingHead = head + size;
+		*offset = head % m_StagingSize;
+		return m_StagingAllocation.mappedPtr + *offset;
+	}
+
+	UploadTicket UploadManager::SubmitPending()
+	{
+		if (m_PendingCopies.empty() && m_PendingImageCopies.empty() && m_PendingImageBegins.empty() && m_PendingImageEnds.empty())
+			return m_LastSubmittedTicket;
+
+		UploadSubmission submission;
+		// Another thread may be waiting on the fence of a retired submission, it can only be reset once none is.
+		if (!m_FreeSubmissions.empty() && m_FenceWaiters == 0)
+		{
+			submission = m_FreeSubmissions.back();
+			m_FreeSubmissions.pop_back();
+			auto result = m_Device.resetFences(1, &submission.fence);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to reset upload fence.");
+		}
+		else
+		{
+			auto const commandBufferAllocateInfo = vk::CommandBufferAllocateInfo()
+				.setCommandBufferCount(1)
+				.setCommandPool(m_CommandPool);
+			auto result = m_Device.allocateCommandBuffers(&commandBufferAllocateInfo, &submission.commandBuffer);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to allocate upload command buffer.");
+
+			auto const fenceCreateInfo = vk::FenceCreateInfo();
+			result = m_Device.createFence(&fenceCreateInfo, nullptr, &submission.fence);
+			CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to create upload fence.");
+		}
+
+		auto const beginInfo = vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+		auto result = submission.commandBuffer.begin(&beginInfo);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to begin upload command buffer.");
+
+		// Images being started lose their contents on the way to the copy layout.
+		if (!m_PendingImageBegins.empty())
+		{
+			std::vector<vk::ImageMemoryBarrier> beginBarriers;
+			for (const PendingImageTransition& transition : m_PendingImageBegins)
+			{
+				beginBarriers.push_back(vk::ImageMemoryBarrier()
+					.setSrcAccessMask(vk::AccessFlags())
+					.setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+					.setOldLayout(vk::ImageLayout::eUndefined)
+					.setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+					.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+					.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+					.setImage(transition.image)
+					.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, transition.mipLevels, 0, 1)));
+			}
+			submission.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+													 vk::DependencyFlags(), 0, nullptr, 0, nullptr, (uint32_t)beginBarriers.size(),
+													 beginBarriers.data());
+			m_PendingImageBegins.clear();
+		}
+
+		// One copy command per destination buffer carrying all of its regions.
+		std::stable_sort(m_PendingCopies.begin(), m_PendingCopies.end(),
+						 [](const PendingCopy& a, const PendingCopy& b) { return a.buffer < b.buffer; });
+		std::vector<vk::BufferCopy> regions;
+		std::vector<vk::BufferMemoryBarrier> releaseBarriers;
+		submission.acquireBarriers.clear();
+		regions.reserve(m_PendingCopies.size());
+		for (size_t i = 0; i < m_PendingCopies.size();)
+		{
+			vk::Buffer buffer = m_PendingCopies[i].buffer;
+			regions.clear();
+			for (; i < m_PendingCopies.size() && m_PendingCopies[i].buffer == buffer; i++)
+				regions.push_back(m_PendingCopies[i].region);
+			submission.commandBuffer.copyBuffer(m_StagingBuffer, buffer, (uint32_t)regions.size(), regions.data());
+
+			if (TransfersOwnership())
+			{
+				for (const vk::BufferCopy& region : regions)
+				{
+					auto const releaseBarrier = vk::BufferMemoryBarrier()
+						.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+						.setDstAccessMask(vk::AccessFlags())
+						.setSrcQueueFamilyIndex(m_QueueFamilyIndex)
+						.setDstQueueFamilyIndex(m_OwnerQueueFamilyIndex)
+						.setBuffer(buffer)
+						.setOffset(region.dstOffset)
+						.setSize(region.size);
+					releaseBarriers.push_back(releaseBarrier);
+
+					vk::BufferMemoryBarrier acquireBarrier = releaseBarrier;
+					acquireBarrier.setSrcAccessMask(vk::AccessFlags()).setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+					submission.acquireBarriers.push_back(acquireBarrier);
+				}
+			}
+		}
+
+		std::stable_sort(m_PendingImageCopies.begin(), m_PendingImageCopies.end(),
+						 [](const PendingImageCopy& a, const PendingImageCopy& b) { return a.image < b.image; });
+		std::vector<vk::BufferImageCopy> imageRegions;
+		for (size_t i = 0; i < m_PendingImageCopies.size();)
+		{
+			vk::Image image = m_PendingImageCopies[i].image;
+			imageRegions.clear();
+			for (; i < m_PendingImageCopies.size() && m_PendingImageCopies[i].image == image; i++)
+				imageRegions.push_back(m_PendingImageCopies[i].region);
+			submission.commandBuffer.copyBufferToImage(m_StagingBuffer, image, vk::ImageLayout::eTransferDstOptimal,
+													   (uint32_t)imageRegions.size(), imageRegions.data());
+		}
+
+		// Finished images are ready to be sampled, copies of earlier submissions are in the barrier's first scope too.
+		// Ownership transfers carry the layout transition, which then happens once between release and acquire.
+		std::vector<vk::ImageMemoryBarrier> endBarriers;
+		submission.acquireImageBarriers.clear();
+		for (const PendingImageTransition& transition : m_PendingImageEnds)
+		{
+			auto const endBarrier = vk::ImageMemoryBarrier()
+				.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setDstAccessMask(TransfersOwnership() ? vk::AccessFlags() : vk::AccessFlagBits::eShaderRead)
+				.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+				.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+				.setSrcQueueFamilyIndex(TransfersOwnership() ? m_QueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(TransfersOwnership() ? m_OwnerQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED)
+				.setImage(transition.image)
+				.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, transition.mipLevels, 0, 1));
+			endBarriers.push_back(endBarrier);
+
+			if (TransfersOwnership())
+			{
+				vk::ImageMemoryBarrier acquireBarrier = endBarrier;
+				acquireBarrier.setSrcAccessMask(vk::AccessFlags()).setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+				submission.acquireImageBarriers.push_back(acquireBarrier);
+			}
+		}
+
+		if (TransfersOwnership())
+		{
+			submission.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+													 vk::DependencyFlags(), 0, nullptr, (uint32_t)releaseBarriers.size(),
+													 releaseBarriers.data(), (uint32_t)endBarriers.size(), endBarriers.data());
+		}
+		else
+		{
+			// Later submissions on this queue are in the barrier's second scope, so whatever reads the data next sees it.
+			auto const memoryBarrier = vk::MemoryBarrier()
+				.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+			submission.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands,
+													 vk::DependencyFlags(), 1, &memoryBarrier, 0, nullptr,
+													 (uint32_t)endBarriers.size(), endBarriers.data());
+		}
+		m_PendingImageEnds.clear();
+
+		submission.commandBuffer.end();
+
+		auto const submitInfo = vk::SubmitInfo()
+			.setCommandBufferCount(1)
+			.setPCommandBuffers(&submission.commandBuffer);
+		{
+			std::lock_guard<std::mutex> queueLock(*m_QueueMutex);
+			result = m_Queue.submit(1, &submitInfo, submission.fence);
+		}
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to submit uploads.");
+
+		submission.ticket = ++m_LastSubmittedTicket;
+		submission.stagingEnd = m_StagingHead;
+		m_InFlightSubmissions.push_back(submission);
+
+		m_Statistics.copyRegions += m_PendingCopies.size() + m_PendingImageCopies.size();
+		m_Statistics.submissions++;
+		m_PendingCopies.clear();
+		m_PendingImageCopies.clear();
+		return submission.ticket;
+	}
+
+	void UploadManager::RetireCompleted()
+	{
+		while (!m_InFlightSubmissions.empty() && m_Device.getFenceStatus(m_InFlightSubmissions.front().fence) == vk::Result::eSuccess)
+			RetireOldest();
+	}
+
+	void UploadManager::RetireOldest()
+	{
+		CEE_ASSERT_WITH_MESSAGE(!m_InFlightSubmissions.empty(), "No upload in flight to wait for.");
+
+		UploadSubmission submission = m_InFlightSubmissions.front();
+		m_InFlightSubmissions.pop_front();
+
+		auto result = m_Device.waitForFences(1, &submission.fence, VK_TRUE, UINT64_MAX);
+		CEE_ASSERT_WITH_MESSAGE(result == vk::Result::eSuccess, "Failed to wait for upload fence.");
+
+		m_LastCompletedTicket = submission.ticket;
+		m_StagingTail = submission.stagingEnd;
+		m_PendingAcquireBarriers.insert(m_PendingAcquireBarriers.end(), submission.acquireBarriers.begin(), submission.acquireBarriers.end());
+		m_PendingAcquireImageBarriers.insert(m_PendingAcquireImageBarriers.end(), submission.acquireImageBarriers.begin(),
+											 submission.acquireImageBarriers.end());
+		submission.acquireBarriers.clear();
+		submission.acquireImageBarriers.clear();
+		m_FreeSubmissions.push_back(submission);
+	}
+}
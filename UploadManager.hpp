@@ -0,0 +1,132 @@
+#ifndef _UPLOAD_MANAGER_HPP
+#define _UPLOAD_MANAGER_HPP
+
+#include "MemoryAllocator.hpp"
+
+#include <deque>
+#include <mutex>
+
+namespace CEE
+{
+	// Identifies a submitted batch of uploads, larger tickets are submitted later.
+	typedef uint64_t UploadTicket;
+
+	typedef struct UploadStatistics {
+		uint64_t bytesUploaded;
+		uint64_t copyRegions;
+		uint32_t submissions;
+
+		// Milliseconds spent waiting for the staging ring to drain and for tickets to complete.
+		float stallTime;
+	} UploadStatistics;
+
+	// Copies data into device local buffers and images through a persistently mapped staging ring. Uploads are
+	// collected and recorded as one copy command per destination with all of its regions when Submit is called.
+	// Thread safe. Submissions lock queueMutex, which everything else submitting to, presenting on or waiting for the
+	// same queue has to lock as well, the upload queue may well be the graphics queue.
+	//
+	// When the upload queue belongs to another family than the owning (graphics) queue, every uploaded range and
+	// image is released to the owning family and has to be acquired there with RecordAcquires once its ticket completed.
+	class UploadManager
+	{
+	public:
+		UploadManager(vk::Device device, MemoryAllocator* allocator, uint32_t queueFamilyIndex, vk::Queue queue,
+					  std::mutex* queueMutex, uint32_t ownerQueueFamilyIndex, vk::DeviceSize stagingSize = 16 * 1024 * 1024);
+		~UploadManager();
+
+		// Data is copied into the staging ring before returning, the destination needs eTransferDst usage. The caller
+		// guarantees the owning queue is done reading the destination range.
+		void Upload(vk::Buffer buffer, vk::DeviceSize offset, const void* data, vk::DeviceSize size);
+
+		// Image uploads may span several calls and submissions. BeginImage discards the contents of every mip level
+		// and readies them for copies, UploadImageRows copies tightly packed rows of one level and EndImage moves all
+		// levels to eShaderReadOnlyOptimal. The image needs eTransferDst usage and must not be in use.
+		void BeginImage(vk::Image image, uint32_t mipLevels);
+		void UploadImageRows(vk::Image image, uint32_t mipLevel, uint32_t width, uint32_t firstRow, uint32_t rowCount,
+							 uint32_t texelSize, const void* rows);
+		void EndImage(vk::Image image, uint32_t mipLevels);
+		// Submits every upload made since the last call.
+		UploadTicket Submit();
+
+		bool IsComplete(UploadTicket ticket);
+		void Wait(UploadTicket ticket);
+
+		// Records the acquire half of the ownership transfer for every completed upload not acquired yet, a no-op when
+		// both queues share a family. Must precede any use of the uploaded data on the owning queue.
+		void RecordAcquires(vk::CommandBuffer commandBuffer);
+
+		inline bool TransfersOwnership() const { return m_QueueFamilyIndex != m_OwnerQueueFamilyIndex; }
+
+		inline UploadStatistics GetStatistics() const { std::lock_guard<std::mutex> lock(m_Mutex); return m_Statistics; }
+
+	private:
+		typedef struct PendingCopy {
+			vk::Buffer buffer;
+			vk::BufferCopy region;
+		} PendingCopy;
+
+		typedef struct PendingImageCopy {
+			vk::Image image;
+			vk::BufferImageCopy region;
+		} PendingImageCopy;
+
+		// Layout transition recorded ahead of or after the copies of the next submission.
+		typedef struct PendingImageTransition {
+			vk::Image image;
+			uint32_t mipLevels;
+		} PendingImageTransition;
+
+		typedef struct UploadSubmission {
+			vk::CommandBuffer commandBuffer;
+			vk::Fence fence;
+			UploadTicket ticket;
+			// Staging ring position up to which this submission reads.
+			vk::DeviceSize stagingEnd;
+
+			// Acquire barriers matching the releases recorded in this submission.
+			std::vector<vk::BufferMemoryBarrier> acquireBarriers;
+			std::vector<vk::ImageMemoryBarrier> acquireImageBarriers;
+		} UploadSubmission;
+
+	private:
+		uint8_t* AllocateStaging(vk::DeviceSize size, vk::DeviceSize* offset);
+		UploadTicket SubmitPending();
+		void RetireCompleted();
+		void RetireOldest();
+
+	private:
+		vk::Device m_Device;
+		MemoryAllocator* m_Allocator;
+		vk::Queue m_Queue;
+		std::mutex* m_QueueMutex;
+		uint32_t m_QueueFamilyIndex;
+		uint32_t m_OwnerQueueFamilyIndex;
+		vk::CommandPool m_CommandPool;
+
+		vk::Buffer m_StagingBuffer;
+		Allocation m_StagingAllocation;
+		vk::DeviceSize m_StagingSize;
+		// Monotonic ring positions, the ring offset is position % m_StagingSize. Everything in [tail, head) is in use.
+		vk::DeviceSize m_StagingHead = 0;
+		vk::DeviceSize m_StagingTail = 0;
+
+		std::vector<PendingCopy> m_PendingCopies;
+		std::vector<PendingImageCopy> m_PendingImageCopies;
+		std::vector<PendingImageTransition> m_PendingImageBegins;
+		std::vector<PendingImageTransition> m_PendingImageEnds;
+		std::deque<UploadSubmission> m_InFlightSubmissions;
+		std::vector<UploadSubmission> m_FreeSubmissions;
+		std::vector<vk::BufferMemoryBarrier> m_PendingAcquireBarriers;
+		std::vector<vk::ImageMemoryBarrier> m_PendingAcquireImageBarriers;
+
+		UploadTicket m_LastSubmittedTicket = 0;
+		UploadTicket m_LastCompletedTicket = 0;
+
+		mutable std::mutex m_Mutex;
+		// Threads in Wait blocked on a fence outside m_Mutex, retired fences are not reset and reused meanwhile.
+		uint32_t m_FenceWaiters = 0;
+		UploadStatistics m_Statistics;
+	};
+}
+
+#endif
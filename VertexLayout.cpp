@@ -0,0 +1,146 @@
+#include "pch.h"
+#include "VertexLayout.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+namespace CEE
+{
+	static uint32_t GetFormatSize(vk::Format format)
+	{
+		switch (format)
+		{
+		case vk::Format::eUndefined:			return 0;
+		case vk::Format::eR8G8B8A8Unorm:		return 4;
+		case vk::Format::eR16G16Sfloat:			return 4;
+		case vk::Format::eR32G32Sfloat:			return 8;
+		case vk::Format::eR16G16B16A16Sfloat:	return 8;
+		case vk::Format::eR32G32B32Sfloat:		return 12;
+		case vk::Format::eR32G32B32A32Sfloat:	return 16;
+		default:
+			CEE_ASSERT_WITH_MESSAGE(false, "Unsupported vertex attribute format.");
+			return 0;
+		}
+	}
+
+	VertexLayout::VertexLayout(vk::Format positionFormat, vk::Format colorFormat, vk::Format normalFormat)
+		: m_PositionFormat(positionFormat), m_ColorFormat(colorFormat), m_NormalFormat(normalFormat)
+	{
+		CEE_ASSERT_WITH_MESSAGE(positionFormat == vk::Format::eR16G16Sfloat || positionFormat == vk::Format::eR32G32Sfloat ||
+								positionFormat == vk::Format::eR32G32B32A32Sfloat, "Unsupported vertex position format.");
+		CEE_ASSERT_WITH_MESSAGE(colorFormat == vk::Format::eR8G8B8A8Unorm || colorFormat == vk::Format::eR32G32B32A32Sfloat,
+								"Unsupported vertex color format.");
+		CEE_ASSERT_WITH_MESSAGE(normalFormat == vk::Format::eUndefined || normalFormat == vk::Format::eR16G16B16A16Sfloat ||
+								normalFormat == vk::Format::eR32G32B32Sfloat, "Unsupported vertex normal format.");
+
+		// Every format above is a multiple of four bytes, so each attribute stays aligned to its components.
+		m_ColorOffset = GetFormatSize(m_PositionFormat);
+		m_NormalOffset = m_ColorOffset + GetFormatSize(m_ColorFormat);
+		m_Stride = m_NormalOffset + GetFormatSize(m_NormalFormat);
+	}
+
+	VertexLayout VertexLayout::Packed()
+	{
+		return VertexLayout(vk::Format::eR16G16Sfloat, vk::Format::eR8G8B8A8Unorm, vk::Format::eUndefined);
+	}
+
+	VertexLayout VertexLayout::Full()
+	{
+		return VertexLayout(vk::Format::eR32G32B32A32Sfloat, vk::Format::eR32G32B32A32Sfloat, vk::Format::eR32G32B32Sfloat);
+	}
+
+	vk::VertexInputBindingDescription VertexLayout::GetBindingDescription(uint32_t binding) const
+	{
+		return vk::VertexInputBindingDescription()
+			.setBinding(binding)
+			.setInputRate(vk::VertexInputRate::eVertex)
+			.setStride(m_Stride);
+	}
+
+	std::vector<vk::VertexInputAttributeDescription> VertexLayout::GetAttributeDescriptions(uint32_t binding) const
+	{
+		std::vector<vk::VertexInputAttributeDescription> attributeDescriptions;
+		attributeDescriptions.push_back(vk::VertexInputAttributeDescription()
+			.setBinding(binding).setLocation(0).setFormat(m_PositionFormat).setOffset(0));
+		attributeDescriptions.push_back(vk::VertexInputAttributeDescription()
+			.setBinding(binding).setLocation(1).setFormat(m_ColorFormat).setOffset(m_ColorOffset));
+		if (HasNormal())
+		{
+			attributeDescriptions.push_back(vk::VertexInputAttributeDescription()
+				.setBinding(binding).setLocation(2).setFormat(m_NormalFormat).setOffset(m_NormalOffset));
+		}
+		return attributeDescriptions;
+	}
+
+	void VertexLayout::WriteVertex(uint8_t* destination, glm::vec2 position, glm::vec4 color, glm::vec3 normal) const
+	{
+		WritePosition(destination, position);
+		WriteAttributes(destination + m_ColorOffset, color, normal);
+	}
+
+	void VertexLayout::WriteQuad(uint8_t* destination, const glm::vec2 positions[4], glm::vec4 color, glm::vec3 normal) const
+	{
+		// Color and normal are shared by all four vertices, encode them once.
+		uint8_t attributes[32];
+		WriteAttributes(attributes, color, normal);
+		uint32_t attributeSize = m_Stride - m_ColorOffset;
+
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			WritePosition(destination, positions[i]);
+			memcpy(destination + m_ColorOffset, attributes, attributeSize);
+			destination += m_Stride;
+		}
+	}
+
+	void VertexLayout::WritePosition(uint8_t* destination, glm::vec2 position) const
+	{
+		// memcpy keeps the stores unaligned-safe and lets the compiler emit plain moves.
+		switch (m_PositionFormat)
+		{
+		case vk::Format::eR16G16Sfloat:
+		{
+			uint32_t packed = glm::packHalf2x16(position);
+			memcpy(destination, &packed, sizeof(packed));
+			break;
+		}
+		case vk::Format::eR32G32Sfloat:
+			memcpy(destination, &position, sizeof(position));
+			break;
+		default:
+		{
+			glm::vec4 homogeneous(position, 0.0f, 1.0f);
+			memcpy(destination, &homogeneous, sizeof(homogeneous));
+			break;
+		}
+		}
+	}
+
+	void VertexLayout::WriteAttributes(uint8_t* destination, glm::vec4 color, glm::vec3 normal) const
+	{
+		if (m_ColorFormat == vk::Format::eR8G8B8A8Unorm)
+		{
+			uint32_t packed = glm::packUnorm4x8(color);
+			memcpy(destination, &packed, sizeof(packed));
+		}
+		else
+		{
+			memcpy(destination, &color, sizeof(color));
+		}
+
+		uint8_t* normalDestination = destination + (m_NormalOffset - m_ColorOffset);
+		if (m_NormalFormat == vk::Format::eR16G16B16A16Sfloat)
+		{
+			uint64_t packed = glm::packHalf4x16(glm::vec4(normal, 0.0f));
+			memcpy(normalDestination, &packed, sizeof(packed));
+		}
+		else if (m_NormalFormat == vk::Format::eR32G32B32Sfloat)
+		{
+			memcpy(normalDestination, &normal, sizeof(normal));
+		}
+	}
+
+	bool VertexLayout::operator==(const VertexLayout& other) const
+	{
+		return m_PositionFormat == other.m_PositionFormat && m_ColorFormat == other.m_ColorFormat && m_NormalFormat == other.m_NormalFormat;
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef _VERTEX_LAYOUT_HPP
+#define _VERTEX_LAYOUT_HPP
+
+#include <glm/glm.hpp>
+
+namespace CEE
+{
+	// Attribute formats of the per-vertex quad path. The pipeline's vertex input state and the batch writers are
+	// both derived from the same layout, so the bytes written always match what the pipeline reads.
+	//
+	// Attributes are packed in order position, color, normal at locations 0, 1 and 2. Missing components read as
+	// (0, 0, 1) in the shader, so a two component position still arrives as vec4(x, y, 0, 1).
+	class VertexLayout
+	{
+	public:
+		// positionFormat: eR16G16Sfloat, eR32G32Sfloat or eR32G32B32A32Sfloat.
+		// colorFormat: eR8G8B8A8Unorm or eR32G32B32A32Sfloat.
+		// normalFormat: eUndefined for no normal, eR16G16B16A16Sfloat or eR32G32B32Sfloat.
+		VertexLayout(vk::Format positionFormat = vk::Format::eR16G16Sfloat, vk::Format colorFormat = vk::Format::eR8G8B8A8Unorm,
+					 vk::Format normalFormat = vk::Format::eUndefined);
+
+		// Half precision positions, unorm colors and no normal, 8 bytes per vertex.
+		static VertexLayout Packed();
+		// Full precision positions and colors plus a normal, 44 bytes per vertex.
+		static VertexLayout Full();
+
+		inline uint32_t GetStride() const { return m_Stride; }
+		inline bool HasNormal() const { return m_NormalFormat != vk::Format::eUndefined; }
+
+		vk::VertexInputBindingDescription GetBindingDescription(uint32_t binding) const;
+		std::vector<vk::VertexInputAttributeDescription> GetAttributeDescriptions(uint32_t binding) const;
+
+		// Stores every attribute once and in order, safe to use on write-combined memory.
+		void WriteVertex(uint8_t* destination, glm::vec2 position, glm::vec4 color, glm::vec3 normal) const;
+		// Four vertices sharing color and normal, which are encoded only once.
+		void WriteQuad(uint8_t* destination, const glm::vec2 positions[4], glm::vec4 color, glm::vec3 normal) const;
+
+		bool operator==(const VertexLayout& other) const;
+		inline bool operator!=(const VertexLayout& other) const { return !(*this == other); }
+
+	private:
+		void WritePosition(uint8_t* destination, glm::vec2 position) const;
+		// Color followed by the normal, if any.
+		void WriteAttributes(uint8_t* destination, glm::vec4 color, glm::vec3 normal) const;
+
+	private:
+		vk::Format m_PositionFormat;
+		vk::Format m_ColorFormat;
+		vk::Format m_NormalFormat;
+
+		uint32_t m_ColorOffset;
+		uint32_t m_NormalOffset;
+		uint32_t m_Stride;
+	};
+}
+
+#endif
@@ -1,10 +1,18 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) out vec4 color;
 
 layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTexture;
+
+// Sized to the renderer's texture array. Slot 0 is a white texel, untextured quads keep their color.
+layout(constant_id = 1) const uint c_MaxTextures = 1;
+layout(binding = 2) uniform sampler2D u_Textures[c_MaxTextures];
 
 void main()
 {
-	color = fragColor;
+	// Quads of one batch may use different textures, the index is not uniform across the draw.
+	color = fragColor * texture(u_Textures[nonuniformEXT(fragTexture)], fragTexCoord);
 }
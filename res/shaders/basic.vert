@@ -2,17 +2,21 @@
 
 layout(location = 0) in vec4 position;
 layout(location = 1) in vec4 color;
-layout(location = 2) in vec3 surfaceNormal;
 
 layout(binding = 0) uniform MVPUBO {
 	mat4 mvpMatrix;
 } u_MVP;
 
 layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTexture;
 
 void main()
 {
-	gl_Position = /*u_MVP.mvpMatrix */ position;
+	gl_Position = u_MVP.mvpMatrix * position;
 	fragColor = color;
+	// Per-vertex quads are untextured and sample the white texture.
+	fragTexCoord = vec2(0.0);
+	fragTexture = 0u;
 }
 
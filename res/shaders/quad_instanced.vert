@@ -0,0 +1,45 @@
+#version 450
+
+layout(location = 0) in vec2 translation;
+layout(location = 1) in vec2 scale;
+layout(location = 2) in float rotation;
+layout(location = 3) in vec4 color;
+layout(location = 4) in uint textureIndex;
+layout(location = 5) in vec2 texCoordMin;
+layout(location = 6) in vec2 texCoordMax;
+
+layout(binding = 0) uniform MVPUBO {
+	mat4 mvpMatrix;
+} u_MVP;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTexture;
+
+// Set when quads are drawn without an index buffer, gl_VertexIndex then runs over both triangles.
+layout(constant_id = 0) const bool c_GeneratedIndices = false;
+
+const vec2 quadCorners[4] = vec2[](
+	vec2(-0.5,  0.5),
+	vec2( 0.5,  0.5),
+	vec2( 0.5, -0.5),
+	vec2(-0.5, -0.5)
+);
+
+const int quadIndices[6] = int[](0, 1, 2, 2, 3, 0);
+
+void main()
+{
+	// Same transform as the per-vertex path: scale * rotate * translate * corner.
+	int corner = c_GeneratedIndices ? quadIndices[gl_VertexIndex] : gl_VertexIndex;
+	vec2 position = quadCorners[corner] + translation;
+	float s = sin(rotation);
+	float c = cos(rotation);
+	position = vec2(c * position.x - s * position.y, s * position.x + c * position.y) * scale;
+
+	gl_Position = u_MVP.mvpMatrix * vec4(position, 0.0, 1.0);
+	fragColor = color;
+	// Clip space y points down and so does v, the corner at -0.5, -0.5 samples texCoordMin.
+	fragTexCoord = mix(texCoordMin, texCoordMax, quadCorners[corner] + 0.5);
+	fragTexture = textureIndex;
+}
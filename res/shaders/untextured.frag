@@ -0,0 +1,16 @@
+#version 450
+
+layout(location = 0) out vec4 color;
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTexture;
+
+layout(constant_id = 1) const uint c_MaxTextures = 1;
+layout(binding = 2) uniform sampler2D u_Textures[c_MaxTextures];
+
+void main()
+{
+	// Used when the texture array can't be indexed non-uniformly. Slot 0 is a white texel, sprites keep their tint.
+	color = fragColor * texture(u_Textures[0], fragTexCoord);
+}